@@ -7,6 +7,7 @@
 #include <backend/amd64/amd64.h>
 #include <templates/vector.h>
 #include <templates/graph.h>
+#include <util/timing.h>
 
 #define ir_add(value) vector_ir_insn_add(ir, value)
 #define symtable_add_fn() hashmap_ast_fn_vector_ir_var_add(fn_symtable, ir_current_fn, vector_ir_var_new())
@@ -19,20 +20,16 @@ int fn_label = 0; // has a label been placed on the first line of the current fu
 hashmap_ast_fn_vector_ir_var* fn_symtable = 0;
 
 char* ir_output = 0;
+int n_temps = 0; // for naming temporaries and labels, IR_read.c starts them past the ones it reads
+int n_labels = 0;
 
 void ir_stmt(ast_stmt* s);
 
 // Create an ir_var to hold the result of a composite expression.
 ir_var* ir_temp(type_info* type)
 {
-    static int n_temps = 0;
     ir_var* new = calloc(1, sizeof(ir_var));
-    new->type = malloc(sizeof(type_info));
-    if(type) memcpy(new->type, type, sizeof(type_info));
-    else {
-        new->type->base = LONG_T;
-        new->type->ptr_layers = 0;
-    }
+    new->type = type ? type : type_get(LONG_T, 0);
     char buffer[1024] = {0};
     sprintf(buffer, ".t%d.l", n_temps++);
     new->name = strdup(buffer);
@@ -40,9 +37,21 @@ ir_var* ir_temp(type_info* type)
     return new;
 }
 
+// small literals are shared, nothing writes to a value once it's made
+#define SMALL_LIT_MIN -16
+#define SMALL_LIT_MAX 255
+static ir_value small_lits[SMALL_LIT_MAX - SMALL_LIT_MIN + 1];
+
 // returns an ir_value of type literal with the given value
 ir_value* ir_value_lit(long value)
 {
+    if(value >= SMALL_LIT_MIN && value <= SMALL_LIT_MAX) {
+        ir_value* v = &small_lits[value - SMALL_LIT_MIN];
+        v->type = IR_LIT;
+        v->content.lit.i = value;
+        return v;
+    }
+
     ir_value* v = malloc(sizeof(ir_value));
     v->type = IR_LIT;
     v->content.lit.i = value;
@@ -50,23 +59,159 @@ ir_value* ir_value_lit(long value)
     return v;
 }
 
-ir_var* ir_dummy_var(void)
+// returns an ir_value of type var that refers to the given var
+ir_value* ir_value_var(ir_var* var)
 {
-    ir_var* new = calloc(1, sizeof(ir_var));
-    new->name = strdup("dummy");
-    new->type = malloc(sizeof(type_info));
-    new->type->base = INT_T;
-    new->type->ptr_layers = 1; // have it be the same width as a pointer on any arch
-    return new;
+    ir_value* v = malloc(sizeof(ir_value));
+    v->type = IR_VAR;
+    v->content.var = var;
+
+    return v;
 }
 
-char* ir_autolabel(void)
+// decides between signed and unsigned division, modulo and right shifts
+// untyped values (params, compiler temps) are treated as signed
+int ir_is_unsigned(type_info* type)
 {
-    static int n_labels = 0;
-    char buffer[1024] = {0};
-    sprintf(buffer, "L.%d", n_labels++);
-    
-    return strdup(buffer);
+    if(!type || type->ptr_layers) return 0;
+    return type->base == UCHAR_T || type->base == UINT_T || type->base == ULONG_T;
+}
+
+// the size of a value of the type in bytes, untyped values being 64-bit like everything else
+int ir_type_size(type_info* type)
+{
+    if(!type || type->ptr_layers) return 8;
+    switch(type->base) {
+        case CHAR_T:
+        case UCHAR_T:
+        return 1;
+
+        case INT_T:
+        case UINT_T:
+        return 4;
+
+        default: return 8;
+    }
+}
+
+// the value converted to the type, wrapping around like the hardware does
+// a narrow value is kept sign- or zero-extended to 64 bits, whichever its signedness calls for
+int64_t ir_canonical(type_info* type, int64_t value)
+{
+    int bits = ir_type_size(type) * 8;
+    if(bits == 64) return value;
+
+    uint64_t mask = ((uint64_t) 1 << bits) - 1;
+    uint64_t low = (uint64_t) value & mask;
+    if(!ir_is_unsigned(type) && low >> (bits - 1)) return (int64_t) (low | ~mask);
+    return (int64_t) low;
+}
+
+// whether converting a value of type from to type to leaves it as it is, so that no truncation is needed
+int ir_type_contains(type_info* to, type_info* from)
+{
+    if(to == from) return 1; // types are shared, so the same one is the same pointer
+    int to_size = ir_type_size(to);
+    int from_size = ir_type_size(from);
+
+    if(to_size == 8) return 1;
+    if(from_size < to_size) return ir_is_unsigned(from) || !ir_is_unsigned(to);
+    return from_size == to_size && ir_is_unsigned(from) == ir_is_unsigned(to);
+}
+
+// the type of *p for a p of the given type, untyped pointers point at 64-bit values
+type_info ir_pointee(type_info* type)
+{
+    if(!type || !type->ptr_layers) return (type_info) { LONG_T, 0 };
+    return (type_info) { type->base, type->ptr_layers - 1 };
+}
+
+// the label table, a label is its index; labels[0] isn't used so that 0 can mean no label
+typedef struct {
+    char* name; // made by ir_label_name, or given to ir_named_label
+    int number; // the n in L.n for the ones ir_autolabel hands out
+    ast_fn* fn; // set on a function's entry label
+} ir_label_info;
+
+static ir_label_info* labels = 0;
+static int n_label_ids = 1;
+static int max_label_ids = 0;
+static int* label_map = 0; // open addressing, name -> label, only for the ones from ir_named_label
+static int label_map_size = 0;
+static int n_named_labels = 0;
+
+static int ir_new_label(char* name, int number, ast_fn* fn)
+{
+    if(n_label_ids == max_label_ids || !labels) {
+        max_label_ids = max_label_ids ? 2 * max_label_ids : 256;
+        labels = realloc(labels, max_label_ids * sizeof(ir_label_info));
+    }
+    labels[n_label_ids] = (ir_label_info) { name, number, fn };
+    return n_label_ids++;
+}
+
+int ir_autolabel(void)
+{
+    return ir_new_label(0, n_labels++, 0);
+}
+
+// the entry label of the given function, made once per function
+int ir_fn_label(ast_fn* fn)
+{
+    return ir_new_label(0, -1, fn);
+}
+
+static uint32_t ir_hash_name(char* s)
+{
+    uint32_t h = 5381;
+    while(*s) h = h * 33 + (unsigned char) *s++;
+    return h;
+}
+
+static int* ir_label_slot(int* map, int size, char* name)
+{
+    int slot = ir_hash_name(name) & (size - 1);
+    while(map[slot] && strcmp(labels[map[slot]].name, name)) slot = (slot + 1) & (size - 1);
+    return &map[slot];
+}
+
+// the label with the given text, made the first time it's asked for; for reading IR back in and the epilogue labels of the backend
+int ir_named_label(char* name)
+{
+    if(2 * (n_named_labels + 1) > label_map_size) {
+        int size = label_map_size ? 2 * label_map_size : 64;
+        int* map = calloc(size, sizeof(int));
+        for(int i = 0; i < label_map_size; i++)
+            if(label_map[i]) *ir_label_slot(map, size, labels[label_map[i]].name) = label_map[i];
+        free(label_map);
+        label_map = map;
+        label_map_size = size;
+    }
+
+    int* slot = ir_label_slot(label_map, label_map_size, name);
+    if(!*slot) {
+        *slot = ir_new_label(strdup(name), -1, 0);
+        n_named_labels++;
+    }
+    return *slot;
+}
+
+// the label's text, L.n or fn.name, made the first time it's needed
+char* ir_label_name(int label)
+{
+    ir_label_info* l = &labels[label];
+    if(l->name) return l->name;
+
+    char buffer[256];
+    if(l->fn) snprintf(buffer, sizeof(buffer), "fn.%s", l->fn->name);
+    else sprintf(buffer, "L.%d", l->number);
+    return l->name = strdup(buffer);
+}
+
+// the function the label is the entry of, or null for any other label
+ast_fn* ir_label_fn(int label)
+{
+    return label ? labels[label].fn : 0;
 }
 
 ir_op convert_op(ast_op op)
@@ -76,6 +221,9 @@ ir_op convert_op(ast_op op)
         case O_MINUS: return IR_SUBTRACT;
         case O_TIMES: return IR_MULTIPLY;
         case O_BY: return IR_DIVIDE;
+        case O_MOD: return IR_MODULO;
+        case O_LSHIFT: return IR_LSHIFT;
+        case O_RSHIFT: return IR_RSHIFT;
         case O_GREATER: return IR_GREATER;
         case O_LESSER: return IR_LESSER;
         case O_GREATER_EQUAL: return IR_GREATER_EQUAL;
@@ -107,14 +255,11 @@ ir_var* ir_create_param(char* param_name)
 // Create an ir_value based on the passed AST expression.
 ir_value* ir_create_value(ast_expr* e)
 {
-    ir_value* value = malloc(sizeof(ir_value));
+    if(e->type == EXPR_LITERAL) return ir_value_lit(e->content.lit.content.number.content.ld);
 
-    if(e->type == EXPR_LITERAL) {
-        value->type = IR_LIT;
-        value->content.lit.i = e->content.lit.content.number.content.ld;
-    }
+    ir_value* value = malloc(sizeof(ir_value));
 
-    else if(e->type == EXPR_VARIABLE) {
+    if(e->type == EXPR_VARIABLE) {
         if(e->content.var.value) {
             free(value);
             return ir_expr(e->content.var.value);
@@ -131,10 +276,7 @@ ir_value* ir_create_value(ast_expr* e)
         else sprintf(name, "%s.l", e->content.var.name);
         
         value->content.var->name = strdup(name);
-        value->content.var->type = calloc(1, sizeof(type_info));
-        if(e->content.var.type)
-            memcpy(value->content.var->type, e->content.var.type, sizeof(type_info));
-        else value->content.var->type->base = LONG_T;
+        value->content.var->type = e->content.var.type ? e->content.var.type : type_get(LONG_T, 0);
     }
 
     else value->type = IR_NONE;
@@ -151,6 +293,7 @@ ir_value* ir_unary(ast_expr* e)
     insn->content.un.result = temp;
     insn->content.un.op = convert_op(e->content.un.op);
     insn->content.un.operand = operand;
+    insn->content.un.type = e->content.un.type;
 
     ir_add(insn);
 
@@ -176,6 +319,7 @@ ir_value* ir_binary(ast_expr* e)
     insn->content.bin.left = left;
     insn->content.bin.op = convert_op(e->content.bin.op);
     insn->content.bin.right = right;
+    insn->content.bin.type = e->content.bin.type;
     ir_add(insn);
 
     ir_value* result = malloc(sizeof(ir_value));
@@ -237,6 +381,7 @@ void ir_deref_expr(ast_copy* copy)
     insn->type = IR_DEREF_ASSIGN;
     insn->content.deref_assign.dst = ir_expr(copy->dst->content.un.e)->content.var;
     insn->content.deref_assign.src = ir_expr(copy->src);
+    insn->content.deref_assign.type = ir_pointee(insn->content.deref_assign.dst->type);
     
     ir_add(insn);
 }
@@ -317,8 +462,7 @@ void ir_stmt(ast_stmt* s)
             else strcat(name, ".g");
 
             insn->content.copy.dst->name = strdup(name);
-            insn->content.copy.dst->type = malloc(sizeof(type_info));
-            memcpy(insn->content.copy.dst->type, s->content.copy.dst->content.var.type, sizeof(type_info));
+            insn->content.copy.dst->type = s->content.copy.dst->content.var.type;
             ir_add(insn);
         }
         break;
@@ -328,9 +472,7 @@ void ir_stmt(ast_stmt* s)
 
         ir_insn* label_op = malloc(sizeof(ir_insn));
         label_op->type = IR_NOP;
-        char fn_name[1024] = {0};
-        snprintf(fn_name, 1024, "fn.%s", s->content.fn.name);
-        label_op->label = strdup(fn_name);
+        label_op->label = ir_fn_label(ir_current_fn); // s is a copy of it made for the call
         ir_add(label_op);
         ir_block_stmt(s->content.fn.body);
         break;
@@ -371,10 +513,17 @@ void ir_stmt(ast_stmt* s)
             ir_add(insn); // condjmp(expr, label_true)
 
             ir_stmt(if_stmt->if_false); // works even if it's null
-            ir_insn* goto_after = calloc(1, sizeof(ir_insn));
-            goto_after->type = IR_GOTO;
-            goto_after->content.jmp.dst = ir_autolabel();
-            ir_add(goto_after);
+
+            // if the else branch ends in a return or a jump, it never reaches label_after,
+            // and if_true can just fall through into whatever comes after the if
+            ir_insn* last = ir->values[ir->n_values-1];
+            ir_insn* goto_after = 0;
+            if(last->type != IR_RETURN && last->type != IR_GOTO) {
+                goto_after = calloc(1, sizeof(ir_insn));
+                goto_after->type = IR_GOTO;
+                goto_after->content.jmp.dst = ir_autolabel();
+                ir_add(goto_after);
+            }
 
             // if_true handling
             // first make a label, then generate the IR code
@@ -385,26 +534,24 @@ void ir_stmt(ast_stmt* s)
             ir_stmt(if_stmt->if_true);
 
             // make the nop for goto_after
-            ir_insn* goto_after_op = malloc(sizeof(ir_insn));
-            goto_after_op->type = IR_NOP;
-            goto_after_op->label = goto_after->content.jmp.dst;
-            ir_add(goto_after_op);
+            if(goto_after) {
+                ir_insn* goto_after_op = malloc(sizeof(ir_insn));
+                goto_after_op->type = IR_NOP;
+                goto_after_op->label = goto_after->content.jmp.dst;
+                ir_add(goto_after_op);
+            }
         }
         break;
 
         case STMT_WHILE: {
-            // make a label for the loop
-            // parse condition
-            // condjmp to after the loop if the condition doesn't hold
+            // loops are rotated so that the condition is tested at the bottom:
+            // t = !cond; if t goto loop_end
+            // loop_body:
             // loop code
-            // goto loop label
-            // label for the condjmp
-
-            // make a nop to hold the loop label
-            ir_insn* loop_label = malloc(sizeof(ir_insn));
-            loop_label->type = IR_NOP;
-            loop_label->label = ir_autolabel();
-            ir_add(loop_label);
+            // t = cond; if t goto loop_body
+            // loop_end:
+            // this takes one jump per iteration instead of two, and makes the loop body
+            // dominate the exit, which lets loop optimizations move code out of it
 
             // make an instruction to make a negation of the while condition
             ast_while* while_stmt = &s->content.while_stmt;
@@ -416,30 +563,33 @@ void ir_stmt(ast_stmt* s)
             cond_negate->content.un.op = IR_LOGICAL_NOT;
             ir_add(cond_negate);
 
-            // make an instruction to evaluate the condition
-            ir_insn* cond_check = calloc(1, sizeof(ir_insn));
-            cond_check->type = IR_IF;
-            // have to pack it like this because condjmp.cond expects an ir_value*, nor ir_var*
-            ir_value* result_value = malloc(sizeof(ir_value));
-            result_value->type = IR_VAR;
-            result_value->content.var = cond_negate->content.un.result;
-            cond_check->content.condjmp.cond = result_value;
-            cond_check->content.condjmp.if_true = ir_autolabel(); // loop exit
-            ir_add(cond_check);
+            // make an instruction to skip the loop if the condition doesn't hold to begin with
+            ir_insn* guard = calloc(1, sizeof(ir_insn));
+            guard->type = IR_IF;
+            guard->content.condjmp.cond = ir_value_var(cond_negate->content.un.result);
+            guard->content.condjmp.if_true = ir_autolabel(); // loop exit
+            ir_add(guard);
+
+            // make a nop to hold the loop label
+            ir_insn* loop_label = calloc(1, sizeof(ir_insn));
+            loop_label->type = IR_NOP;
+            loop_label->label = ir_autolabel();
+            ir_add(loop_label);
 
             // now parse the loop body
             ir_stmt(while_stmt->body);
 
-            // then an unconditional jump back to the loop
-            ir_insn* jmp = calloc(1, sizeof(ir_insn));
-            jmp->type = IR_GOTO;
-            jmp->content.jmp.dst = loop_label->label;
-            ir_add(jmp);
+            // then evaluate the condition again and jump back to the loop
+            ir_insn* cond_check = calloc(1, sizeof(ir_insn));
+            cond_check->type = IR_IF;
+            cond_check->content.condjmp.cond = ir_expr(while_stmt->cond);
+            cond_check->content.condjmp.if_true = loop_label->label;
+            ir_add(cond_check);
 
             // and finally the loop end label
-            ir_insn* loop_end_label = malloc(sizeof(ir_insn));
+            ir_insn* loop_end_label = calloc(1, sizeof(ir_insn));
             loop_end_label->type = IR_NOP;
-            loop_end_label->label = cond_check->content.condjmp.if_true;
+            loop_end_label->label = guard->content.condjmp.if_true;
             ir_add(loop_end_label);
         }
         break;
@@ -454,7 +604,6 @@ void ir_stmt(ast_stmt* s)
             insn->content.ret.fn = strdup(ir_current_fn->name);
             if(s->content.ret.var)
                 insn->content.ret.value = ir_expr(s->content.ret.var);
-            insn->content.ret.is_last = s->content.ret.is_last;
             ir_add(insn);
         }
         break;
@@ -467,9 +616,24 @@ void ir_stmt(ast_stmt* s)
     }
 }
 
+// runs value numbering and the cleanups until they stop finding anything,
+// since folding branches exposes more dead code, and the values flowing out of it may be constant too
+static void ir_optimize_values(void)
+{
+    int changed;
+    do {
+        timed(ir_simplify_cfg);
+        timed(ir_remove_dead_code);
+        timing_begin("ir_number_values");
+        changed = ir_number_values();
+        timing_end();
+    } while(changed);
+}
+
 void ir_init(void)
 {
     ir = vector_ir_insn_new();
+    timing_begin("ir_stmt");
 
     // first cover global variables
     for(int i = 0; i < root->content.b.stmts->n_values; i++) {
@@ -499,6 +663,21 @@ void ir_init(void)
         free(s);
     }
 
-    // optimization passes go here
-    ir_remove_redundant_assignments();
+    timing_end();
+    ir_optimize();
+}
+
+// the optimization passes, which also run on IR read with --from-ir
+void ir_optimize(void)
+{
+    timed(ir_remove_redundant_assignments);
+    timed(ir_inline_functions);
+    timed(ir_eliminate_tail_calls);
+    timed(ir_optimize_values);
+    timed(ir_convert_ifs);
+    timed(ir_hoist_loop_invariants);
+    timed(ir_optimize_values);
+    timed(ir_reduce_induction_variables);
+    timed(ir_optimize_values);
+    timed(ir_fold_addresses);
 }
\ No newline at end of file
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <IR/IR.h>
+#include <IR/IR_cfg.h>
+#include <IR/IR_optimize.h>
+#include <templates/set.h>
+#include <util/bitset.h>
+
+type_set(ir_insn);
+
+// addressing mode folding
+// x86 loads and stores can compute base + index * scale + disp on their own, so a temporary that
+// only exists to be dereferenced, like t in
+//   t = p + 8
+//   x = *t
+// is folded into the load or store that uses it and its instruction is removed
+// this runs last, after everything else has had its chance at the address arithmetic,
+// and turns every load into an IR_ASSIGN_DEREF, which is what carries the folded address
+// along with the type of the value in memory
+
+typedef struct {
+    ir_cfg* cfg;
+    int* uses; // how many times each var is read in the function
+    int* defs; // and written to
+    uint64_t* exposed;
+} addr_state;
+
+static void addr_count(addr_state* a)
+{
+    ir_cfg* cfg = a->cfg;
+    for(int i = 0; i < cfg->use_start[cfg->end - cfg->start]; i++) a->uses[cfg->uses[i]]++;
+    for(int i = 0; i < cfg->end - cfg->start; i++) if(cfg->defs[i] != -1) a->defs[cfg->defs[i]]++;
+}
+
+// the instruction in [from, ip) that computes var, if it's a temporary nothing else needs
+static int addr_def(addr_state* a, ir_var* var, int from, int ip)
+{
+    int x = ir_cfg_var_index(a->cfg, var);
+    if(a->uses[x] != 1 || a->defs[x] != 1 || bitset_test(a->exposed, x)) return -1;
+
+    for(int i = ip - 1; i >= from; i--) {
+        ir_insn* insn = ir->values[i];
+        if(!insn) continue;
+        ir_var* def = ir_insn_def(insn);
+        if(def && strcmp(def->name, var->name) == 0) return insn->type == IR_BIN ? i : -1;
+    }
+
+    return -1;
+}
+
+// whether var still holds the same value at ip as it did right after the instruction at def
+static int addr_unchanged(addr_state* a, ir_var* var, int def, int ip)
+{
+    int exposed = bitset_test(a->exposed, ir_cfg_var_index(a->cfg, var));
+
+    for(int i = def + 1; i < ip; i++) {
+        ir_insn* insn = ir->values[i];
+        if(!insn) continue;
+        ir_var* d = ir_insn_def(insn);
+        if(d && strcmp(d->name, var->name) == 0) return 0;
+        // globals and vars whose address is taken can also change behind a pointer or in a call
+        if(exposed && ir_insn_is(insn, 3, IR_DEREF_ASSIGN, IR_FN_CALL, IR_PROC_CALL)) return 0;
+    }
+
+    return 1;
+}
+
+static int is_imm32(int64_t n)
+{
+    return n >= INT32_MIN && n <= INT32_MAX;
+}
+
+// index * scale, where the scaled value is a temporary computed as i * {1, 2, 4, 8} or i << {0, 1, 2, 3}
+static int addr_scaled(addr_state* a, ir_var* var, int from, int ip, ir_var** index, int* scale)
+{
+    int d = addr_def(a, var, from, ip);
+    if(d == -1) return -1;
+    ir_bin* bin = &ir->values[d]->content.bin;
+
+    ir_value* x = bin->left;
+    ir_value* n = bin->right;
+    if(bin->op == IR_MULTIPLY && x->type == IR_LIT) {
+        x = bin->right;
+        n = bin->left;
+    }
+    if(x->type != IR_VAR || n->type != IR_LIT) return -1;
+
+    int64_t s = n->content.lit.i;
+    if(bin->op == IR_LSHIFT && s >= 0 && s <= 3) s = 1 << s;
+    else if(bin->op != IR_MULTIPLY) return -1;
+    if(s != 1 && s != 2 && s != 4 && s != 8) return -1;
+    if(!addr_unchanged(a, x->content.var, d, ip)) return -1;
+
+    *index = x->content.var;
+    *scale = s;
+    return d;
+}
+
+static void addr_remove(int ip)
+{
+    if(ir->values[ip]->label) ir->values[ip]->type = IR_NOP;
+    else ir->values[ip] = 0;
+}
+
+// folds the computation of *ptr into the address, going back as long as it finds more to fold
+static void addr_fold(addr_state* a, ir_var** ptr, ir_var** index, int* scale, int64_t* disp, int from, int ip)
+{
+    for(;;) {
+        int d = addr_def(a, *ptr, from, ip);
+        if(d == -1) return;
+        ir_bin* bin = &ir->values[d]->content.bin;
+        ir_value* l = bin->left;
+        ir_value* r = bin->right;
+
+        if(bin->op == IR_ADD && l->type == IR_LIT) {
+            l = bin->right;
+            r = bin->left;
+        }
+        if(l->type != IR_VAR || (bin->op != IR_ADD && !(bin->op == IR_SUBTRACT && r->type == IR_LIT))) return;
+        if(!addr_unchanged(a, l->content.var, d, ip)) return;
+
+        if(r->type == IR_LIT) {
+            // p + n and p - n
+            int64_t n = bin->op == IR_ADD ? r->content.lit.i : -r->content.lit.i;
+            if(!is_imm32(*disp + n)) return;
+            *disp += n;
+        }
+        else {
+            // p + i, with i possibly scaled, and only one of those fits in an address
+            if(*index || !addr_unchanged(a, r->content.var, d, ip)) return;
+
+            ir_var* scaled;
+            int s;
+            int m = addr_scaled(a, r->content.var, from, d, &scaled, &s);
+            if(m == -1) m = addr_scaled(a, l->content.var, from, d, &scaled, &s);
+            if(m != -1) {
+                // the scaled side is the index and the other one the base
+                ir_var* base = strcmp(ir_insn_def(ir->values[m])->name, r->content.var->name) == 0 ? l->content.var : r->content.var;
+                if(!addr_unchanged(a, scaled, d, ip)) return;
+                addr_remove(m);
+                *index = scaled;
+                *scale = s;
+                *ptr = base;
+                addr_remove(d);
+                continue;
+            }
+
+            *index = r->content.var;
+            *scale = 1;
+        }
+
+        *ptr = l->content.var;
+        addr_remove(d);
+    }
+}
+
+static void addr_block(addr_state* a, ir_block* b)
+{
+    for(int ip = b->start; ip < b->end; ip++) {
+        ir_insn* insn = ir->values[ip];
+        if(!insn) continue;
+
+        if(insn->type == IR_UN && insn->content.un.op == IR_DEREFERENCE) {
+            ir_un un = insn->content.un;
+            insn->type = IR_ASSIGN_DEREF;
+            memset(&insn->content.assign_deref, 0, sizeof(ir_assign_deref));
+            insn->content.assign_deref.dst = un.result;
+            insn->content.assign_deref.src = un.operand;
+            insn->content.assign_deref.type = un.type ? *un.type : ir_pointee(0);
+        }
+
+        if(insn->type == IR_ASSIGN_DEREF && insn->content.assign_deref.src->type == IR_VAR) {
+            ir_assign_deref* load = &insn->content.assign_deref;
+            ir_var* ptr = load->src->content.var;
+            addr_fold(a, &ptr, &load->index, &load->scale, &load->disp, b->start, ip);
+            load->src = ir_value_var(ptr);
+        }
+        else if(insn->type == IR_DEREF_ASSIGN) {
+            ir_deref_assign* store = &insn->content.deref_assign;
+            addr_fold(a, &store->dst, &store->index, &store->scale, &store->disp, b->start, ip);
+        }
+    }
+}
+
+void ir_fold_addresses(void)
+{
+    int start, end = 0;
+
+    while(ir_next_fn(end, &start, &end)) {
+        addr_state a;
+        a.cfg = ir_cfg_build(start, end);
+        ir_cfg_liveness(a.cfg); // numbers the vars
+        a.uses = calloc(a.cfg->vars->n_values, sizeof(int));
+        a.defs = calloc(a.cfg->vars->n_values, sizeof(int));
+        a.exposed = ir_cfg_exposed_vars(a.cfg);
+        addr_count(&a);
+
+        for(int i = 0; i < a.cfg->blocks->n_values; i++) addr_block(&a, a.cfg->blocks->values[i]);
+
+        free(a.uses);
+        free(a.defs);
+        free(a.exposed);
+        ir_cfg_free(a.cfg);
+    }
+
+    ir_compact();
+}
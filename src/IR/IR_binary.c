@@ -0,0 +1,684 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <imperivm.h>
+#include <IR/IR.h>
+#include <IR/IR_cfg.h>
+#include <frontend/parser.h>
+
+// the IR in binary, written with --ir-bin and read back with --from-ir
+// the file is a header and a number of sections, each an array of fixed-size records:
+//   strings  every name and label once, NUL-terminated, referred to by offset
+//   vars     every distinct var once, a name and a type
+//   fns      the function index, what the IR needs of each function's AST and its parameters in fn_symtable
+//   params   the AST parameters of the functions, names and types like the vars
+//   symtable var indices of the fn_symtable entries
+//   insns    one record per instruction, where operands are indices into the other sections
+//   args     the arguments of the calls
+// so loading it is mapping the file and going over the records, with nothing to parse
+// the records are in the byte order of the machine, it's a cache and not something to move around
+
+#define BIR_MAGIC "IMIR"
+#define BIR_VERSION 1
+#define BIR_NONE 0xffffffff // no string, var or type
+#define BIR_ABSENT 3 // kind of a value that's a null pointer, past IR_NONE, IR_LIT and IR_VAR
+#define BIR_MAX_PTR_LAYERS 255 // more than any program has, and it keeps a corrupt type from growing type_get's table
+
+enum { BIR_STRINGS, BIR_VARS, BIR_FNS, BIR_PARAMS, BIR_SYMTABLE, BIR_INSNS, BIR_ARGS, BIR_N_SECTIONS };
+
+typedef struct {
+    uint64_t offset; // from the start of the file
+    uint64_t count; // of records, or bytes for the strings
+} bir_section;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    bir_section sections[BIR_N_SECTIONS];
+} bir_header;
+
+typedef struct {
+    uint32_t base; // BIR_NONE for a var without a type
+    uint32_t ptr_layers;
+} bir_type;
+
+typedef struct {
+    uint32_t name;
+    bir_type type;
+} bir_var;
+
+typedef struct {
+    int64_t lit;
+    uint32_t kind; // IR_NONE, IR_LIT, IR_VAR or BIR_ABSENT
+    uint32_t var;
+} bir_value;
+
+typedef struct {
+    uint32_t name, label; // f and fn.f
+    bir_type ret;
+    uint32_t params, n_params; // in the params section
+    uint32_t vars, n_vars; // in the symtable section, n_vars is BIR_NONE if the function has no entry
+} bir_fn;
+
+typedef struct {
+    uint8_t kind, op, is_tail, pad; // kind is the ir_insn's type
+    uint32_t label;
+    uint32_t dst; // result or dst, a var
+    uint32_t index; // of a folded address, a var
+    uint32_t target; // the label jumped to, the function called, or the one returned from
+    uint32_t target2; // the else label of an if
+    uint32_t fn; // index of the function called
+    uint32_t args, n_args;
+    int32_t scale;
+    bir_type type; // of an un or bin, or of the value in memory for a load or store
+    int64_t disp;
+    bir_value a, b, c;
+} bir_insn;
+
+// a section being written, where strings and vars are only added once
+typedef struct {
+    char* data;
+    uint64_t size, max_size;
+    uint64_t item; // the size of a record, 0 for strings
+    uint64_t* slots; // open addressing, offset + 1 of an item or 0
+    uint64_t n_slots, n_items;
+} bir_table;
+
+static bir_table tables[BIR_N_SECTIONS];
+static uint64_t record_sizes[BIR_N_SECTIONS] = { 1, sizeof(bir_var), sizeof(bir_fn), sizeof(bir_var), sizeof(uint32_t), sizeof(bir_insn), sizeof(bir_value) };
+
+static uint64_t bir_hash(void* data, uint64_t size)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for(uint64_t i = 0; i < size; i++) h = (h ^ ((uint8_t*) data)[i]) * 1099511628211ULL;
+    return h;
+}
+
+static uint64_t bir_item_size(bir_table* t, uint64_t offset)
+{
+    return t->item ? t->item : strlen(t->data + offset) + 1;
+}
+
+static uint64_t bir_append(bir_table* t, void* data, uint64_t size)
+{
+    if(t->size + size > t->max_size) {
+        t->max_size = (t->size + size) * 2;
+        t->data = realloc(t->data, t->max_size);
+    }
+    memcpy(t->data + t->size, data, size);
+    t->size += size;
+    return t->size - size;
+}
+
+// the offset of data in the table, added if it isn't there yet
+static uint64_t bir_intern(bir_table* t, void* data, uint64_t size)
+{
+    if(2 * (t->n_items + 1) > t->n_slots) {
+        uint64_t* old = t->slots;
+        uint64_t n_old = t->n_slots;
+        t->n_slots = t->n_slots ? 2 * t->n_slots : 256;
+        t->slots = calloc(t->n_slots, sizeof(uint64_t));
+        for(uint64_t i = 0; i < n_old; i++) {
+            if(!old[i]) continue;
+            uint64_t s = bir_hash(t->data + old[i] - 1, bir_item_size(t, old[i] - 1)) & (t->n_slots - 1);
+            while(t->slots[s]) s = (s + 1) & (t->n_slots - 1);
+            t->slots[s] = old[i];
+        }
+        free(old);
+    }
+
+    uint64_t s = bir_hash(data, size) & (t->n_slots - 1);
+    for(; t->slots[s]; s = (s + 1) & (t->n_slots - 1)) {
+        uint64_t offset = t->slots[s] - 1;
+        if(bir_item_size(t, offset) == size && memcmp(t->data + offset, data, size) == 0) return offset;
+    }
+    t->n_items++;
+    t->slots[s] = bir_append(t, data, size) + 1;
+    return t->slots[s] - 1;
+}
+
+static uint32_t bir_string(char* s)
+{
+    if(!s) return BIR_NONE;
+    return bir_intern(&tables[BIR_STRINGS], s, strlen(s) + 1);
+}
+
+static bir_type bir_type_of(type_info* type)
+{
+    if(!type) return (bir_type) { BIR_NONE, 0 };
+    return (bir_type) { type->base, type->ptr_layers };
+}
+
+static uint32_t bir_var_of(ir_var* var)
+{
+    if(!var) return BIR_NONE;
+    bir_var v = { bir_string(var->name), bir_type_of(var->type) };
+    return bir_intern(&tables[BIR_VARS], &v, sizeof(v)) / sizeof(v);
+}
+
+static bir_value bir_value_of(ir_value* value)
+{
+    if(!value) return (bir_value) { 0, BIR_ABSENT, BIR_NONE };
+    if(value->type == IR_VAR) return (bir_value) { 0, IR_VAR, bir_var_of(value->content.var) };
+    return (bir_value) { value->type == IR_LIT ? value->content.lit.i : 0, value->type, BIR_NONE };
+}
+
+static void bir_args(bir_insn* r, vector_ir_value* args)
+{
+    r->args = tables[BIR_ARGS].size / sizeof(bir_value);
+    r->n_args = args ? args->n_values : 0;
+    for(int i = 0; i < r->n_args; i++) {
+        bir_value v = bir_value_of(args->values[i]);
+        bir_append(&tables[BIR_ARGS], &v, sizeof(v));
+    }
+}
+
+static void bir_address(bir_insn* r, struct ir_ptr_stuff* addr, ir_value* ptr)
+{
+    r->dst = bir_var_of(addr->dst);
+    r->a = bir_value_of(ptr);
+    r->index = bir_var_of(addr->index);
+    r->scale = addr->scale;
+    r->disp = addr->disp;
+    r->type = bir_type_of(&addr->type);
+}
+
+static uint32_t* fn_at; // the function whose label is at an offset in the strings
+static uint64_t fn_labels_size; // which are the first strings
+
+static uint32_t bir_fn_index(uint32_t label)
+{
+    return label < fn_labels_size ? fn_at[label] : BIR_NONE;
+}
+
+// labels are numbers in memory and their text in the file
+static uint32_t bir_label(int label)
+{
+    return label ? bir_string(ir_label_name(label)) : BIR_NONE;
+}
+
+static void bir_insn_of(ir_insn* insn)
+{
+    bir_insn r = { .kind = insn->type, .label = bir_label(insn->label), .dst = BIR_NONE, .index = BIR_NONE,
+                   .target = BIR_NONE, .target2 = BIR_NONE, .fn = BIR_NONE, .type = { BIR_NONE, 0 } };
+    r.a = r.b = r.c = bir_value_of(0);
+
+    switch(insn->type) {
+        case IR_NOP: break;
+
+        case IR_UN:
+        r.dst = bir_var_of(insn->content.un.result);
+        r.op = insn->content.un.op;
+        r.a = bir_value_of(insn->content.un.operand);
+        r.type = bir_type_of(insn->content.un.type);
+        break;
+
+        case IR_BIN:
+        r.dst = bir_var_of(insn->content.bin.result);
+        r.a = bir_value_of(insn->content.bin.left);
+        r.op = insn->content.bin.op;
+        r.b = bir_value_of(insn->content.bin.right);
+        r.type = bir_type_of(insn->content.bin.type);
+        break;
+
+        case IR_COPY:
+        r.dst = bir_var_of(insn->content.copy.dst);
+        r.a = bir_value_of(insn->content.copy.src);
+        break;
+
+        case IR_GOTO:
+        r.target = bir_label(insn->content.jmp.dst);
+        break;
+
+        case IR_IF:
+        r.a = bir_value_of(insn->content.condjmp.cond);
+        r.target = bir_label(insn->content.condjmp.if_true);
+        r.target2 = bir_label(insn->content.condjmp.if_false);
+        break;
+
+        case IR_FN_CALL:
+        r.dst = bir_var_of(insn->content.fn_call.result);
+        r.target = bir_string(insn->content.fn_call.fn_label);
+        r.fn = bir_fn_index(r.target);
+        r.is_tail = insn->content.fn_call.is_tail;
+        bir_args(&r, insn->content.fn_call.args);
+        break;
+
+        case IR_PROC_CALL:
+        r.target = bir_string(insn->content.proc_call.fn_label);
+        r.fn = bir_fn_index(r.target);
+        r.is_tail = insn->content.proc_call.is_tail;
+        bir_args(&r, insn->content.proc_call.args);
+        break;
+
+        case IR_RETURN:
+        r.target = bir_string(insn->content.ret.fn);
+        r.a = bir_value_of(insn->content.ret.value);
+        break;
+
+        case IR_ASSIGN_REF:
+        case IR_ASSIGN_DEREF:
+        bir_address(&r, &insn->content.assign_deref, insn->content.assign_deref.src);
+        break;
+
+        case IR_DEREF_ASSIGN:;
+        ir_value ptr = { .content.var = insn->content.deref_assign.dst, .type = IR_VAR };
+        bir_address(&r, &insn->content.deref_assign, &ptr);
+        r.dst = BIR_NONE;
+        r.b = bir_value_of(insn->content.deref_assign.src);
+        break;
+
+        case IR_SELECT:
+        r.dst = bir_var_of(insn->content.select.result);
+        r.a = bir_value_of(insn->content.select.cond);
+        r.b = bir_value_of(insn->content.select.if_true);
+        r.c = bir_value_of(insn->content.select.if_false);
+        break;
+    }
+    bir_append(&tables[BIR_INSNS], &r, sizeof(r));
+}
+
+static void bir_fn_of(ast_fn* fn)
+{
+    char label[1024];
+    snprintf(label, sizeof(label), "fn.%s", fn->name);
+    bir_fn r = { bir_string(fn->name), bir_string(label), bir_type_of(fn->ret_type) };
+
+    r.params = tables[BIR_PARAMS].size / sizeof(bir_var);
+    r.n_params = fn->params ? fn->params->n_values : 0;
+    for(int i = 0; i < r.n_params; i++) {
+        bir_var param = { bir_string(fn->params->values[i]->name), bir_type_of(fn->params->values[i]->type) };
+        bir_append(&tables[BIR_PARAMS], &param, sizeof(param));
+    }
+
+    r.vars = tables[BIR_SYMTABLE].size / sizeof(uint32_t);
+    r.n_vars = BIR_NONE;
+    if(hashmap_ast_fn_vector_ir_var_has_key(fn_symtable, fn)) {
+        vector_ir_var* vars = hashmap_ast_fn_vector_ir_var_get(fn_symtable, fn);
+        r.n_vars = vars->n_values;
+        for(int i = 0; i < vars->n_values; i++) {
+            uint32_t var = bir_var_of(vars->values[i]);
+            bir_append(&tables[BIR_SYMTABLE], &var, sizeof(var));
+        }
+    }
+    bir_append(&tables[BIR_FNS], &r, sizeof(r));
+}
+
+int ir_save(char* file)
+{
+    memset(tables, 0, sizeof(tables));
+    tables[BIR_VARS].item = sizeof(bir_var);
+
+    // the labels of the functions are the first strings, so a call can find its function by the offset of its label
+    char label[1024];
+    for(int i = 0; i < program->n_values; i++) {
+        snprintf(label, sizeof(label), "fn.%s", program->values[i]->name);
+        bir_string(label);
+    }
+    fn_labels_size = tables[BIR_STRINGS].size;
+    fn_at = malloc((fn_labels_size + 1) * sizeof(uint32_t));
+    for(int i = program->n_values - 1; i >= 0; i--) {
+        snprintf(label, sizeof(label), "fn.%s", program->values[i]->name);
+        fn_at[bir_string(label)] = i; // the first one with the name wins, like in ir_get_ast_fn
+    }
+
+    for(int i = 0; i < program->n_values; i++) bir_fn_of(program->values[i]);
+    for(int i = 0; i < ir->n_values; i++) bir_insn_of(ir->values[i]);
+    free(fn_at);
+
+    FILE* f = fopen(file, "wb");
+    if(!f) return 0;
+    bir_header header = { BIR_MAGIC, BIR_VERSION };
+    uint64_t offset = sizeof(header);
+    for(int s = 0; s < BIR_N_SECTIONS; s++) {
+        bir_table* t = &tables[s];
+        offset = (offset + 7) & ~7ULL;
+        header.sections[s].offset = offset;
+        header.sections[s].count = t->size / record_sizes[s];
+        offset += t->size;
+    }
+    fwrite(&header, sizeof(header), 1, f);
+    for(int s = 0; s < BIR_N_SECTIONS; s++) {
+        static char zeros[8];
+        fwrite(zeros, 1, header.sections[s].offset - ftell(f), f);
+        fwrite(tables[s].data, 1, tables[s].size, f);
+        free(tables[s].data);
+        free(tables[s].slots);
+    }
+    fclose(f);
+    return 1;
+}
+
+// --- loading
+
+static char* map;
+static bir_header* loaded;
+static char* load_file;
+
+static void __attribute__((noreturn)) bir_corrupt(void)
+{
+    printf("imc: %s: corrupt binary IR\n", load_file);
+    exit(1);
+}
+
+static void* bir_section_at(int s)
+{
+    return map + loaded->sections[s].offset;
+}
+
+static char* bir_load_string(uint32_t offset)
+{
+    if(offset == BIR_NONE) return 0;
+    if(offset >= loaded->sections[BIR_STRINGS].count) bir_corrupt();
+    return (char*) bir_section_at(BIR_STRINGS) + offset;
+}
+
+static type_info* bir_load_type(bir_type type)
+{
+    if(type.base == BIR_NONE) return 0;
+    if(type.base > ULONG_T || type.ptr_layers > BIR_MAX_PTR_LAYERS) bir_corrupt();
+    return type_get(type.base, type.ptr_layers);
+}
+
+// every var record turns into one ir_var, which all its uses share
+static ir_var** vars;
+
+static ir_var* bir_load_var(uint32_t index)
+{
+    if(index == BIR_NONE) return 0;
+    if(index >= loaded->sections[BIR_VARS].count) bir_corrupt();
+    return vars[index];
+}
+
+static ir_value* bir_load_value(bir_value v)
+{
+    if(v.kind == BIR_ABSENT) return 0;
+    if(v.kind == IR_LIT) return ir_value_lit(v.lit);
+    if(v.kind == IR_VAR) return ir_value_var(bir_load_var(v.var));
+    if(v.kind != IR_NONE) bir_corrupt();
+    ir_value* value = calloc(1, sizeof(ir_value));
+    value->type = IR_NONE;
+    return value;
+}
+
+// what the backend can compute with, a var or a literal
+static ir_value* bir_load_operand(bir_value v)
+{
+    ir_value* value = bir_load_value(v);
+    if(!value || value->type == IR_NONE) bir_corrupt();
+    return value;
+}
+
+static ir_var* bir_load_dst(uint32_t index)
+{
+    ir_var* var = bir_load_var(index);
+    if(!var) bir_corrupt();
+    return var;
+}
+
+// the ops the backend has code for, the && and || of a bin are turned into jumps before it
+static ir_op bir_load_op(uint8_t op, int binary)
+{
+    int ok = binary ? (op >= IR_ADD && op <= IR_NOT_EQUAL) || op == IR_LOGICAL_AND || op == IR_LOGICAL_OR
+                    : op == IR_MINUS || op == IR_LOGICAL_NOT || op == IR_BINARY_NOT || op == IR_CAST ||
+                      op == IR_DEREFERENCE || op == IR_REFERENCE;
+    if(!ok) bir_corrupt();
+    return op;
+}
+
+static char* bir_load_callee(uint32_t offset)
+{
+    char* label = bir_load_string(offset);
+    if(!label || strncmp(label, "fn.", 3)) bir_corrupt();
+    return label;
+}
+
+static vector_ir_value* bir_load_args(bir_insn* r)
+{
+    if((uint64_t) r->args + r->n_args > loaded->sections[BIR_ARGS].count) bir_corrupt();
+    bir_value* args = bir_section_at(BIR_ARGS);
+    vector_ir_value* v = vector_ir_value_new();
+    for(uint32_t i = 0; i < r->n_args; i++) vector_ir_value_add(v, bir_load_operand(args[r->args + i]));
+    return v;
+}
+
+static ast_fn* bir_load_fn(uint32_t index)
+{
+    if(index >= program->n_values) bir_corrupt();
+    return program->values[index];
+}
+
+static void bir_load_address(struct ir_ptr_stuff* addr, bir_insn* r)
+{
+    if(r->scale != 0 && r->scale != 1 && r->scale != 2 && r->scale != 4 && r->scale != 8) bir_corrupt();
+    addr->index = bir_load_var(r->index);
+    addr->scale = r->scale;
+    addr->disp = r->disp;
+    type_info* type = bir_load_type(r->type);
+    if(type) addr->type = *type;
+}
+
+static int* label_at; // the label made for the string at an offset, so each one is looked up once
+static uint8_t* label_uses; // and whether it's defined and jumped to, see bir_check_labels
+#define BIR_DEFINED 1
+#define BIR_JUMPED 2
+
+// fn. labels are the entries of the functions loaded before the code, the rest are interned by their text
+static int bir_load_label(uint32_t offset)
+{
+    char* name = bir_load_string(offset);
+    if(!name) return 0;
+    if(label_at[offset]) return label_at[offset];
+
+    if(strncmp(name, "fn.", 3)) {
+        ir_reserve_name(name);
+        return label_at[offset] = ir_named_label(name);
+    }
+    for(int i = 0; i < program->n_values; i++)
+        if(strcmp(program->values[i]->name, name + 3) == 0) return label_at[offset] = ir_fn_label(program->values[i]);
+    bir_corrupt();
+}
+
+static int bir_load_target(uint32_t offset)
+{
+    if(offset == BIR_NONE) bir_corrupt();
+    int label = bir_load_label(offset);
+    label_uses[offset] |= BIR_JUMPED;
+    return label;
+}
+
+// every jump has to go to a label some instruction has
+static void bir_check_labels(void)
+{
+    for(uint64_t i = 0; i < loaded->sections[BIR_STRINGS].count; i++)
+        if(label_uses[i] == BIR_JUMPED) bir_corrupt();
+}
+
+static ir_insn* bir_load_insn(bir_insn* r)
+{
+    ir_insn* insn = calloc(1, sizeof(ir_insn));
+    insn->type = r->kind;
+    insn->label = bir_load_label(r->label);
+    if(insn->label) label_uses[r->label] |= BIR_DEFINED;
+
+    switch(insn->type) {
+        case IR_NOP: break;
+
+        case IR_UN:
+        insn->content.un.result = bir_load_dst(r->dst);
+        insn->content.un.op = bir_load_op(r->op, 0);
+        insn->content.un.operand = bir_load_operand(r->a);
+        insn->content.un.type = bir_load_type(r->type);
+        break;
+
+        case IR_BIN:
+        insn->content.bin.result = bir_load_dst(r->dst);
+        insn->content.bin.left = bir_load_operand(r->a);
+        insn->content.bin.op = bir_load_op(r->op, 1);
+        insn->content.bin.right = bir_load_operand(r->b);
+        insn->content.bin.type = bir_load_type(r->type);
+        break;
+
+        case IR_COPY:
+        insn->content.copy.dst = bir_load_dst(r->dst);
+        insn->content.copy.src = bir_load_operand(r->a);
+        break;
+
+        case IR_GOTO:
+        insn->content.jmp.dst = bir_load_target(r->target);
+        break;
+
+        case IR_IF:
+        // an else label isn't something the passes or the backend know about, the text reader makes it a goto
+        if(r->target2 != BIR_NONE) bir_corrupt();
+        insn->content.condjmp.cond = bir_load_operand(r->a);
+        insn->content.condjmp.if_true = bir_load_target(r->target);
+        break;
+
+        case IR_FN_CALL:
+        insn->content.fn_call.result = bir_load_dst(r->dst);
+        insn->content.fn_call.fn_label = bir_load_callee(r->target);
+        insn->content.fn_call.ast_fn = bir_load_fn(r->fn);
+        insn->content.fn_call.is_tail = r->is_tail;
+        insn->content.fn_call.args = bir_load_args(r);
+        break;
+
+        case IR_PROC_CALL:
+        insn->content.proc_call.fn_label = bir_load_callee(r->target);
+        insn->content.proc_call.is_tail = r->is_tail;
+        insn->content.proc_call.args = bir_load_args(r);
+        break;
+
+        case IR_RETURN:
+        insn->content.ret.fn = bir_load_string(r->target);
+        if(!insn->content.ret.fn) bir_corrupt();
+        insn->content.ret.value = bir_load_value(r->a);
+        if(insn->content.ret.value && insn->content.ret.value->type == IR_NONE) bir_corrupt();
+        break;
+
+        case IR_ASSIGN_REF:
+        case IR_ASSIGN_DEREF:
+        insn->content.assign_deref.dst = bir_load_dst(r->dst);
+        insn->content.assign_deref.src = bir_load_operand(r->a);
+        if(insn->type == IR_ASSIGN_REF && insn->content.assign_ref.src->type != IR_VAR) bir_corrupt();
+        bir_load_address(&insn->content.assign_deref, r);
+        break;
+
+        case IR_DEREF_ASSIGN:;
+        ir_value* ptr = bir_load_value(r->a);
+        if(!ptr || ptr->type != IR_VAR) bir_corrupt();
+        insn->content.deref_assign.dst = ptr->content.var;
+        insn->content.deref_assign.src = bir_load_operand(r->b);
+        bir_load_address(&insn->content.deref_assign, r);
+        free(ptr);
+        break;
+
+        case IR_SELECT:
+        insn->content.select.result = bir_load_dst(r->dst);
+        insn->content.select.cond = bir_load_operand(r->a);
+        insn->content.select.if_true = bir_load_operand(r->b);
+        insn->content.select.if_false = bir_load_operand(r->c);
+        break;
+
+        default: bir_corrupt();
+    }
+    return insn;
+}
+
+static void bir_load_fns(void)
+{
+    bir_fn* fns = bir_section_at(BIR_FNS);
+    bir_var* params = bir_section_at(BIR_PARAMS);
+    uint32_t* symtable = bir_section_at(BIR_SYMTABLE);
+
+    for(uint64_t i = 0; i < loaded->sections[BIR_FNS].count; i++) {
+        bir_fn* r = &fns[i];
+        ast_fn* fn = calloc(1, sizeof(ast_fn));
+        fn->name = bir_load_string(r->name);
+        fn->ret_type = bir_load_type(r->ret);
+        if(!fn->name || (uint64_t) r->params + r->n_params > loaded->sections[BIR_PARAMS].count) bir_corrupt();
+
+        fn->params = vector_ast_var_new();
+        for(uint32_t p = 0; p < r->n_params; p++) {
+            ast_var* param = calloc(1, sizeof(ast_var));
+            param->name = bir_load_string(params[r->params + p].name);
+            param->type = bir_load_type(params[r->params + p].type);
+            if(!param->name) bir_corrupt();
+            vector_ast_var_add(fn->params, param);
+        }
+        vector_ast_fn_add(program, fn);
+
+        if(r->n_vars == BIR_NONE) continue;
+        if((uint64_t) r->vars + r->n_vars > loaded->sections[BIR_SYMTABLE].count) bir_corrupt();
+        vector_ir_var* v = vector_ir_var_new();
+        for(uint32_t p = 0; p < r->n_vars; p++) vector_ir_var_add(v, bir_load_var(symtable[r->vars + p]));
+        hashmap_ast_fn_vector_ir_var_add(fn_symtable, fn, v);
+    }
+}
+
+// maps the file and builds the IR from it, returns 0 if it isn't binary IR
+int ir_load(char* file)
+{
+    load_file = file;
+    int fd = open(file, O_RDONLY);
+    if(fd == -1) return 0;
+    struct stat st;
+    char magic[4] = {0};
+    if(fstat(fd, &st) || read(fd, magic, 4) != 4 || memcmp(magic, BIR_MAGIC, 4)) {
+        close(fd);
+        return 0;
+    }
+    map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED || st.st_size < sizeof(bir_header)) bir_corrupt();
+
+    loaded = (bir_header*) map;
+    if(loaded->version != BIR_VERSION) {
+        printf("imc: %s: binary IR version %u, expected %u\n", file, loaded->version, BIR_VERSION);
+        exit(1);
+    }
+    for(int s = 0; s < BIR_N_SECTIONS; s++) {
+        bir_section* section = &loaded->sections[s];
+        if(section->offset % 8 || section->offset > st.st_size || section->count > (st.st_size - section->offset) / record_sizes[s])
+            bir_corrupt();
+    }
+    uint64_t n_strings = loaded->sections[BIR_STRINGS].count;
+    if(n_strings && map[loaded->sections[BIR_STRINGS].offset + n_strings - 1]) bir_corrupt();
+
+    ir = vector_ir_insn_new();
+    program = vector_ast_fn_new();
+    fn_symtable = hashmap_ast_fn_vector_ir_var_new();
+
+    bir_var* var_records = bir_section_at(BIR_VARS);
+    uint64_t n_vars = loaded->sections[BIR_VARS].count;
+    vars = malloc(n_vars * sizeof(ir_var*) + 1);
+    for(uint64_t i = 0; i < n_vars; i++) {
+        vars[i] = malloc(sizeof(ir_var));
+        vars[i]->name = bir_load_string(var_records[i].name);
+        vars[i]->type = bir_load_type(var_records[i].type);
+        if(!vars[i]->name) bir_corrupt();
+        ir_reserve_name(vars[i]->name);
+    }
+
+    bir_load_fns();
+    label_at = calloc(n_strings + 1, sizeof(int));
+    label_uses = calloc(n_strings + 1, 1);
+    bir_insn* insns = bir_section_at(BIR_INSNS);
+    for(uint64_t i = 0; i < loaded->sections[BIR_INSNS].count; i++) vector_ir_insn_add(ir, bir_load_insn(&insns[i]));
+    // only the initializers of globals come before the first function, the backend reads them as data
+    uint64_t i = 0;
+    while(i < ir->n_values && !ir_is_fn_label(ir->values[i])) {
+        ir_insn* insn = ir->values[i++];
+        if(insn->type != IR_COPY || insn->label || insn->content.copy.src->type != IR_LIT) bir_corrupt();
+    }
+    if(ir->n_values && i == ir->n_values) bir_corrupt();
+    bir_check_labels();
+    free(label_at);
+    free(label_uses);
+    return 1;
+}
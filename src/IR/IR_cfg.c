@@ -0,0 +1,553 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <IR/IR.h>
+#include <IR/IR_cfg.h>
+#include <templates/vector.h>
+
+// variables are identified by their names throughout the compiler,
+// so the CFG keeps a small string table to avoid strcmp'ing its way through every lookup,
+// and one from label numbers to the blocks they start
+
+static uint32_t hash_str(char* s)
+{
+    uint32_t h = 5381;
+    while(*s) h = h * 33 + (unsigned char) *s++;
+    return h;
+}
+
+// returns the slot for name in map, which is either empty (-1) or holds the matching entry
+static int map_slot(int* map, int size, char* name, char* (*name_of)(ir_cfg*, int), ir_cfg* cfg)
+{
+    int slot = hash_str(name) & (size - 1);
+    while(map[slot] != -1 && strcmp(name_of(cfg, map[slot]), name)) slot = (slot + 1) & (size - 1);
+    return slot;
+}
+
+static char* var_name_of(ir_cfg* cfg, int i) { return cfg->vars->values[i]->name; }
+
+// the label table holds pairs of label and block, with a label of 0 for an empty slot
+static int label_slot(ir_cfg* cfg, int label)
+{
+    int slot = ((uint32_t) label * 2654435761u) & (cfg->label_map_size - 1);
+    while(cfg->label_map[2 * slot] && cfg->label_map[2 * slot] != label) slot = (slot + 1) & (cfg->label_map_size - 1);
+    return slot;
+}
+
+static int* map_new(int n, int* size)
+{
+    *size = 16;
+    while(*size < 2 * n) *size *= 2;
+    int* map = malloc(*size * sizeof(int));
+    memset(map, -1, *size * sizeof(int));
+    return map;
+}
+
+int ir_is_fn_label(ir_insn* insn)
+{
+    return ir_label_fn(insn->label) != 0;
+}
+
+// finds the first function that starts at or after from and sets start and end to its boundaries
+// returns 0 if there are no more functions
+// deleted (null) instructions are skipped, so passes can iterate while marking instructions for removal
+int ir_next_fn(int from, int* start, int* end)
+{
+    int i = from;
+    while(i < ir->n_values && !(ir->values[i] && ir_is_fn_label(ir->values[i]))) i++;
+    if(i >= ir->n_values) return 0;
+    *start = i++;
+
+    while(i < ir->n_values && !(ir->values[i] && ir_is_fn_label(ir->values[i]))) i++;
+    *end = i;
+    return 1;
+}
+
+// returns the variable written to by the given instruction, or null if it doesn't write to one
+ir_var* ir_insn_def(ir_insn* insn)
+{
+    switch(insn->type) {
+        case IR_UN: return insn->content.un.result;
+        case IR_BIN: return insn->content.bin.result;
+        case IR_COPY: return insn->content.copy.dst;
+        case IR_FN_CALL: return insn->content.fn_call.result;
+        case IR_ASSIGN_REF: return insn->content.assign_ref.dst;
+        case IR_ASSIGN_DEREF: return insn->content.assign_deref.dst;
+        case IR_SELECT: return insn->content.select.result;
+        default: return 0;
+    }
+}
+
+#define use_value(value) if((value) && (value)->type == IR_VAR) vector_ir_var_add(uses, (value)->content.var)
+
+// fills uses with the variables read by the given instruction
+void ir_insn_uses(ir_insn* insn, var_vector* uses)
+{
+    uses->n_values = 0;
+
+    switch(insn->type) {
+        case IR_UN: use_value(insn->content.un.operand); break;
+
+        case IR_BIN:
+        use_value(insn->content.bin.left);
+        use_value(insn->content.bin.right);
+        break;
+
+        case IR_COPY: use_value(insn->content.copy.src); break;
+        case IR_IF: use_value(insn->content.condjmp.cond); break;
+        case IR_RETURN: use_value(insn->content.ret.value); break;
+
+        case IR_FN_CALL:
+        for(int i = 0; i < insn->content.fn_call.args->n_values; i++)
+            use_value(insn->content.fn_call.args->values[i]);
+        break;
+
+        case IR_PROC_CALL:
+        for(int i = 0; i < insn->content.proc_call.args->n_values; i++)
+            use_value(insn->content.proc_call.args->values[i]);
+        break;
+
+        case IR_ASSIGN_REF: use_value(insn->content.assign_ref.src); break;
+        case IR_ASSIGN_DEREF:
+        use_value(insn->content.assign_deref.src);
+        if(insn->content.assign_deref.index) vector_ir_var_add(uses, insn->content.assign_deref.index);
+        break;
+
+        case IR_SELECT:
+        use_value(insn->content.select.cond);
+        use_value(insn->content.select.if_true);
+        use_value(insn->content.select.if_false);
+        break;
+
+        case IR_DEREF_ASSIGN:
+        // the pointer is read, not written to
+        vector_ir_var_add(uses, insn->content.deref_assign.dst);
+        if(insn->content.deref_assign.index) vector_ir_var_add(uses, insn->content.deref_assign.index);
+        use_value(insn->content.deref_assign.src);
+        break;
+
+        default: break;
+    }
+}
+#undef use_value
+
+// returns 1 if an instruction of this type does nothing besides computing its result
+int ir_op_is_pure(int op)
+{
+    switch(op) {
+        case IR_UN:
+        case IR_BIN:
+        case IR_COPY:
+        case IR_ASSIGN_REF:
+        case IR_SELECT:
+        return 1;
+
+        default: return 0;
+    }
+}
+
+int ir_insn_is_pure(ir_insn* insn)
+{
+    return ir_op_is_pure(insn->type);
+}
+
+static int ends_block(ir_insn* insn)
+{
+    return insn->type == IR_IF || insn->type == IR_GOTO || insn->type == IR_RETURN;
+}
+
+static void add_block(ir_cfg* cfg, int start, int end)
+{
+    ir_block* b = calloc(1, sizeof(ir_block));
+    b->start = start;
+    b->end = end;
+    b->succs = vector_int_new();
+    b->preds = vector_int_new();
+    b->dom_children = vector_int_new();
+    b->idom = -1;
+    b->rpo = -1;
+    vector_ir_block_add(cfg->blocks, b);
+}
+
+static void add_edge(ir_cfg* cfg, int from, int to)
+{
+    if(to < 0 || vector_int_contains(cfg->blocks->values[from]->succs, to)) return;
+    vector_int_add(cfg->blocks->values[from]->succs, to);
+    vector_int_add(cfg->blocks->values[to]->preds, from);
+}
+
+// splits the function in [start, end) into basic blocks and links them
+ir_cfg* ir_cfg_build(int start, int end)
+{
+    ir_cfg* cfg = calloc(1, sizeof(ir_cfg));
+    cfg->start = start;
+    cfg->end = end;
+    cfg->blocks = vector_ir_block_new();
+
+    int block_start = start;
+    for(int i = start; i < end; i++) {
+        ir_insn* insn = ir->values[i];
+        if(insn->label && i > block_start) {
+            add_block(cfg, block_start, i);
+            block_start = i;
+        }
+        if(ends_block(insn)) {
+            add_block(cfg, block_start, i + 1);
+            block_start = i + 1;
+        }
+    }
+    if(block_start < end) add_block(cfg, block_start, end);
+
+    cfg->label_map_size = 16;
+    while(cfg->label_map_size < 2 * cfg->blocks->n_values) cfg->label_map_size *= 2;
+    cfg->label_map = calloc(2 * cfg->label_map_size, sizeof(int));
+    for(int i = 0; i < cfg->blocks->n_values; i++) {
+        int label = ir->values[cfg->blocks->values[i]->start]->label;
+        if(!label) continue;
+        int slot = label_slot(cfg, label);
+        cfg->label_map[2 * slot] = label;
+        cfg->label_map[2 * slot + 1] = i;
+    }
+
+    for(int i = 0; i < cfg->blocks->n_values; i++) {
+        ir_block* b = cfg->blocks->values[i];
+        ir_insn* last = ir->values[b->end - 1];
+        int has_next = i + 1 < cfg->blocks->n_values;
+
+        switch(last->type) {
+            case IR_GOTO:
+            add_edge(cfg, i, ir_cfg_label_block(cfg, last->content.jmp.dst));
+            break;
+
+            case IR_IF:
+            add_edge(cfg, i, ir_cfg_label_block(cfg, last->content.condjmp.if_true));
+            if(has_next) add_edge(cfg, i, i + 1);
+            break;
+
+            case IR_RETURN: break;
+
+            default:
+            if(has_next) add_edge(cfg, i, i + 1);
+            break;
+        }
+    }
+
+    return cfg;
+}
+
+void ir_cfg_free(ir_cfg* cfg)
+{
+    for(int i = 0; i < cfg->blocks->n_values; i++) {
+        ir_block* b = cfg->blocks->values[i];
+        vector_int_free(b->succs);
+        vector_int_free(b->preds);
+        vector_int_free(b->dom_children);
+        free(b->use);
+        free(b->def);
+        free(b->live_in);
+        free(b->live_out);
+        free(b);
+    }
+    vector_ir_block_free(cfg->blocks);
+    if(cfg->rpo) vector_int_free(cfg->rpo);
+    if(cfg->vars) vector_ir_var_free(cfg->vars);
+    free(cfg->var_map);
+    free(cfg->label_map);
+    free(cfg->ops);
+    free(cfg->defs);
+    free(cfg->use_start);
+    free(cfg->uses);
+    free(cfg);
+}
+
+// returns a bitset of the vars that something other than this function's own assignments can change or read:
+// globals, and vars whose address is taken; requires liveness for the var numbering
+uint64_t* ir_cfg_exposed_vars(ir_cfg* cfg)
+{
+    uint64_t* exposed = bitset_new(cfg->n_words);
+    for(int i = 0; i < cfg->vars->n_values; i++)
+        if(ir_is_global(cfg->vars->values[i])) bitset_set(exposed, i);
+
+    for(int i = cfg->start; i < cfg->end; i++) {
+        ir_insn* insn = ir->values[i];
+        ir_value* addressed = 0;
+        if(insn->type == IR_UN && insn->content.un.op == IR_REFERENCE) addressed = insn->content.un.operand;
+        if(insn->type == IR_ASSIGN_REF) addressed = insn->content.assign_ref.src;
+        if(addressed && addressed->type == IR_VAR)
+            bitset_set(exposed, ir_cfg_var_index(cfg, addressed->content.var));
+    }
+    return exposed;
+}
+
+// returns the block that starts with the given label, or -1 if there's none in this function
+int ir_cfg_label_block(ir_cfg* cfg, int label)
+{
+    int slot = label_slot(cfg, label);
+    return cfg->label_map[2 * slot] ? cfg->label_map[2 * slot + 1] : -1;
+}
+
+// returns the block that contains the instruction at ir[index]
+int ir_cfg_block_of(ir_cfg* cfg, int index)
+{
+    int low = 0, high = cfg->blocks->n_values - 1;
+    while(low < high) {
+        int mid = (low + high + 1) / 2;
+        if(cfg->blocks->values[mid]->start <= index) low = mid;
+        else high = mid - 1;
+    }
+    return low;
+}
+
+// returns the position of var in cfg->vars, or -1 if it's not used in the function
+int ir_cfg_var_index(ir_cfg* cfg, ir_var* var)
+{
+    return cfg->var_map[map_slot(cfg->var_map, cfg->var_map_size, var->name, var_name_of, cfg)];
+}
+
+static int intern_var(ir_cfg* cfg, ir_var* var)
+{
+    int slot = map_slot(cfg->var_map, cfg->var_map_size, var->name, var_name_of, cfg);
+    if(cfg->var_map[slot] != -1) return cfg->var_map[slot];
+    cfg->var_map[slot] = cfg->vars->n_values;
+    vector_ir_var_add(cfg->vars, var);
+    return cfg->var_map[slot];
+}
+
+// numbers the variables and lays the function out in cfg->ops, defs, use_start and uses
+// the operands are collected first, so the var table can be sized before anything goes into it
+static void dense_build(ir_cfg* cfg)
+{
+    int n = cfg->end - cfg->start;
+    var_vector* refs = vector_ir_var_new(); // every var read, in order
+    var_vector* uses = vector_ir_var_new();
+    cfg->ops = malloc((n ? n : 1) * sizeof(uint8_t));
+    cfg->defs = malloc((n ? n : 1) * sizeof(int));
+    cfg->use_start = malloc((n + 1) * sizeof(int));
+
+    for(int i = 0; i < n; i++) {
+        ir_insn* insn = ir->values[cfg->start + i];
+        cfg->ops[i] = insn->type;
+        cfg->use_start[i] = refs->n_values;
+        ir_insn_uses(insn, uses);
+        for(int j = 0; j < uses->n_values; j++) vector_ir_var_add(refs, uses->values[j]);
+    }
+    cfg->use_start[n] = refs->n_values;
+
+    cfg->vars = vector_ir_var_new();
+    cfg->var_map = map_new(refs->n_values + n, &cfg->var_map_size);
+    cfg->uses = malloc((refs->n_values ? refs->n_values : 1) * sizeof(int));
+    for(int i = 0; i < n; i++) {
+        for(int j = cfg->use_start[i]; j < cfg->use_start[i + 1]; j++) cfg->uses[j] = intern_var(cfg, refs->values[j]);
+        ir_var* def = ir_insn_def(ir->values[cfg->start + i]);
+        cfg->defs[i] = def ? intern_var(cfg, def) : -1;
+    }
+    cfg->n_words = bitset_words(cfg->vars->n_values);
+
+    vector_ir_var_free(refs);
+    vector_ir_var_free(uses);
+}
+
+// computes live_in and live_out for every block in the function
+// a var is live at a point if its current value may be read afterwards
+// globals are tracked like everything else, so anyone who cares about calls and returns reading them
+// needs to check for them separately
+void ir_cfg_liveness(ir_cfg* cfg)
+{
+    dense_build(cfg);
+
+    // local use and def sets
+    for(int i = 0; i < cfg->blocks->n_values; i++) {
+        ir_block* b = cfg->blocks->values[i];
+        b->use = bitset_new(cfg->n_words);
+        b->def = bitset_new(cfg->n_words);
+        b->live_in = bitset_new(cfg->n_words);
+        b->live_out = bitset_new(cfg->n_words);
+
+        for(int ip = b->start; ip < b->end; ip++) {
+            for(int* v = ir_cfg_uses_begin(cfg, ip); v < ir_cfg_uses_end(cfg, ip); v++)
+                if(!bitset_test(b->def, *v)) bitset_set(b->use, *v);
+            if(ir_cfg_def(cfg, ip) != -1) bitset_set(b->def, ir_cfg_def(cfg, ip));
+        }
+    }
+
+    // and iterate until nothing changes, going backwards since that converges faster
+    uint64_t* in = bitset_new(cfg->n_words);
+    int changed = 1;
+    while(changed) {
+        changed = 0;
+        for(int i = cfg->blocks->n_values - 1; i >= 0; i--) {
+            ir_block* b = cfg->blocks->values[i];
+            for(int j = 0; j < b->succs->n_values; j++)
+                bitset_union(b->live_out, cfg->blocks->values[b->succs->values[j]]->live_in, cfg->n_words);
+
+            // live_in = use | (live_out & ~def)
+            for(int w = 0; w < cfg->n_words; w++) in[w] = b->use[w] | (b->live_out[w] & ~b->def[w]);
+            changed |= bitset_union(b->live_in, in, cfg->n_words);
+        }
+    }
+
+    free(in);
+}
+
+// walks up the dominator tree from both blocks until they meet
+static int intersect(ir_cfg* cfg, int a, int b)
+{
+    while(a != b) {
+        while(cfg->blocks->values[a]->rpo > cfg->blocks->values[b]->rpo) a = cfg->blocks->values[a]->idom;
+        while(cfg->blocks->values[b]->rpo > cfg->blocks->values[a]->rpo) b = cfg->blocks->values[b]->idom;
+    }
+    return a;
+}
+
+// computes the dominator tree, following Cooper, Harvey and Kennedy's "A Simple, Fast Dominance Algorithm"
+// block a dominates block b if every path from the entry to b goes through a
+void ir_cfg_dominators(ir_cfg* cfg)
+{
+    int n = cfg->blocks->n_values;
+
+    // iterative DFS for the postorder, generated functions can nest deeply enough to make recursion a bad idea
+    int* stack = malloc(n * sizeof(int));
+    int* next_succ = calloc(n, sizeof(int));
+    char* visited = calloc(n, 1);
+    vector_int* postorder = vector_int_new();
+    int top = 0;
+    stack[top++] = 0;
+    visited[0] = 1;
+    while(top) {
+        ir_block* b = cfg->blocks->values[stack[top-1]];
+        if(next_succ[stack[top-1]] < b->succs->n_values) {
+            int succ = b->succs->values[next_succ[stack[top-1]]++];
+            if(visited[succ]) continue;
+            visited[succ] = 1;
+            stack[top++] = succ;
+            continue;
+        }
+        vector_int_add(postorder, stack[--top]);
+    }
+
+    cfg->rpo = vector_int_new();
+    for(int i = postorder->n_values - 1; i >= 0; i--) {
+        cfg->blocks->values[postorder->values[i]]->rpo = cfg->rpo->n_values;
+        vector_int_add(cfg->rpo, postorder->values[i]);
+    }
+
+    // the entry is its own idom while iterating, which makes intersect stop there
+    cfg->blocks->values[0]->idom = 0;
+    int changed = 1;
+    while(changed) {
+        changed = 0;
+        for(int i = 1; i < cfg->rpo->n_values; i++) {
+            ir_block* b = cfg->blocks->values[cfg->rpo->values[i]];
+            int new_idom = -1;
+            for(int j = 0; j < b->preds->n_values; j++) {
+                int pred = b->preds->values[j];
+                if(cfg->blocks->values[pred]->idom == -1) continue; // not processed yet, or unreachable
+                new_idom = new_idom == -1 ? pred : intersect(cfg, pred, new_idom);
+            }
+            if(b->idom != new_idom) {
+                b->idom = new_idom;
+                changed = 1;
+            }
+        }
+    }
+    cfg->blocks->values[0]->idom = -1;
+
+    for(int i = 1; i < cfg->rpo->n_values; i++) {
+        int b = cfg->rpo->values[i];
+        vector_int_add(cfg->blocks->values[cfg->blocks->values[b]->idom]->dom_children, b);
+    }
+
+    vector_int_free(postorder);
+    free(visited);
+    free(next_succ);
+    free(stack);
+}
+
+// returns 1 if block a dominates block b, every block dominates itself
+int ir_cfg_dominates(ir_cfg* cfg, int a, int b)
+{
+    if(cfg->blocks->values[b]->rpo == -1) return 0;
+    while(b != -1) {
+        if(a == b) return 1;
+        b = cfg->blocks->values[b]->idom;
+    }
+    return 0;
+}
+
+// finds the natural loops of the function, requires dominators
+// an edge from b to h is a back edge if h dominates b, and the loop is h plus everything that reaches b without going through h
+// loops are sorted by size, so inner loops come before the loops that contain them
+vector_ir_loop* ir_cfg_loops(ir_cfg* cfg)
+{
+    vector_ir_loop* loops = vector_ir_loop_new();
+    int n = cfg->blocks->n_values;
+    int n_words = bitset_words(n);
+    int* worklist = malloc(n * sizeof(int));
+
+    for(int h = 0; h < n; h++) {
+        ir_block* header = cfg->blocks->values[h];
+        ir_loop* loop = 0;
+
+        for(int i = 0; i < header->preds->n_values; i++) {
+            int latch = header->preds->values[i];
+            if(!ir_cfg_dominates(cfg, h, latch)) continue;
+
+            if(!loop) {
+                loop = calloc(1, sizeof(ir_loop));
+                loop->header = h;
+                loop->blocks = bitset_new(n_words);
+                loop->body = vector_int_new();
+                loop->exits = vector_int_new();
+                bitset_set(loop->blocks, h);
+                vector_int_add(loop->body, h);
+            }
+
+            int top = 0;
+            if(!bitset_test(loop->blocks, latch)) {
+                bitset_set(loop->blocks, latch);
+                vector_int_add(loop->body, latch);
+                worklist[top++] = latch;
+            }
+            while(top) {
+                ir_block* b = cfg->blocks->values[worklist[--top]];
+                for(int j = 0; j < b->preds->n_values; j++) {
+                    int pred = b->preds->values[j];
+                    if(bitset_test(loop->blocks, pred) || cfg->blocks->values[pred]->rpo == -1) continue;
+                    bitset_set(loop->blocks, pred);
+                    vector_int_add(loop->body, pred);
+                    worklist[top++] = pred;
+                }
+            }
+        }
+        if(!loop) continue;
+
+        for(int i = 0; i < loop->body->n_values; i++) {
+            ir_block* b = cfg->blocks->values[loop->body->values[i]];
+            int leaves = ir->values[b->end - 1]->type == IR_RETURN;
+            for(int j = 0; j < b->succs->n_values; j++)
+                if(!bitset_test(loop->blocks, b->succs->values[j])) leaves = 1;
+            if(leaves) vector_int_add(loop->exits, loop->body->values[i]);
+        }
+
+        // insertion sort by size, there are never many loops in one function
+        vector_ir_loop_add(loops, loop);
+        for(int i = loops->n_values - 1; i > 0 && loops->values[i-1]->body->n_values > loop->body->n_values; i--) {
+            loops->values[i] = loops->values[i-1];
+            loops->values[i-1] = loop;
+        }
+    }
+
+    free(worklist);
+    return loops;
+}
+
+void ir_loops_free(vector_ir_loop* loops)
+{
+    for(int i = 0; i < loops->n_values; i++) {
+        free(loops->values[i]->blocks);
+        vector_int_free(loops->values[i]->body);
+        vector_int_free(loops->values[i]->exits);
+        free(loops->values[i]);
+    }
+    vector_ir_loop_free(loops);
+}
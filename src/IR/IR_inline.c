@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <IR/IR.h>
+#include <IR/IR_cfg.h>
+#include <IR/IR_optimize.h>
+#include <templates/vector.h>
+
+// function inlining
+// a call to a small function is replaced by a copy of its body, with its params and local vars renamed
+// so they can't clash with the caller's, its labels replaced by fresh ones, and every return turned
+// into a copy to the call's result and a jump past the inlined code
+// this runs before value numbering, so that constant arguments get folded into the inlined body
+//
+// the call graph is split into strongly connected components, which are handled callees first,
+// so a function's body already has its own calls inlined by the time it's inlined somewhere else
+// calls within a component are recursive and stay as they are
+//
+// the cost of inlining a call is the size of the callee's body minus what the call itself costs:
+// moving each argument into its register, the call and the return, plus one for every literal
+// argument, whose uses will likely fold away
+
+int inline_threshold = 16;
+
+typedef struct {
+    int label;
+    ast_fn* ast;
+    vector_ir_insn* body; // from the label on, with the calls it makes inlined by the time it's done
+    vector_int* callees; // indices of the functions called from it that have a body
+    int index; // for finding the components, -1 until visited
+    int low;
+    int on_stack;
+    int scc; // the component it belongs to
+} inline_fn;
+
+ptr_vector(inline_fn);
+
+static vector_inline_fn* fns;
+static int* fn_map; // open addressing table, function name -> index in fns
+static int fn_map_size;
+int n_inlined = 0; // for naming the inlined vars, every inlined call gets its own number
+
+static uint32_t hash_str(char* s)
+{
+    uint32_t h = 5381;
+    while(*s) h = h * 33 + (unsigned char) *s++;
+    return h;
+}
+
+static int fn_slot(char* name)
+{
+    int slot = hash_str(name) & (fn_map_size - 1);
+    while(fn_map[slot] != -1 && strcmp(fns->values[fn_map[slot]]->ast->name, name)) slot = (slot + 1) & (fn_map_size - 1);
+    return slot;
+}
+
+// the function called by the given label, -1 if it has no body
+static int inline_find(char* label)
+{
+    return fn_map[fn_slot(label + 3)]; // go past `fn.`
+}
+
+static char* call_label(ir_insn* insn)
+{
+    if(insn->type == IR_FN_CALL) return insn->content.fn_call.fn_label;
+    if(insn->type == IR_PROC_CALL) return insn->content.proc_call.fn_label;
+    return 0;
+}
+
+static vector_ir_value* call_args(ir_insn* insn)
+{
+    return insn->type == IR_FN_CALL ? insn->content.fn_call.args : insn->content.proc_call.args;
+}
+
+// splits ir into the functions, everything before the first one stays where it is
+static void inline_split(void)
+{
+    fns = vector_inline_fn_new();
+    int start, end = 0;
+
+    while(ir_next_fn(end, &start, &end)) {
+        inline_fn* fn = calloc(1, sizeof(inline_fn));
+        fn->label = ir->values[start]->label;
+        fn->ast = ir_label_fn(fn->label);
+        fn->body = vector_ir_insn_new();
+        for(int i = start; i < end; i++) vector_ir_insn_add(fn->body, ir->values[i]);
+        fn->callees = vector_int_new();
+        fn->index = -1;
+        vector_inline_fn_add(fns, fn);
+    }
+
+    fn_map_size = 16;
+    while(fn_map_size < 2 * fns->n_values) fn_map_size *= 2;
+    fn_map = malloc(fn_map_size * sizeof(int));
+    memset(fn_map, -1, fn_map_size * sizeof(int));
+    for(int f = 0; f < fns->n_values; f++) fn_map[fn_slot(fns->values[f]->ast->name)] = f;
+
+    for(int f = 0; f < fns->n_values; f++) {
+        inline_fn* fn = fns->values[f];
+        for(int i = 0; i < fn->body->n_values; i++) {
+            char* label = call_label(fn->body->values[i]);
+            int callee = label ? inline_find(label) : -1;
+            if(callee != -1) vector_int_add(fn->callees, callee);
+        }
+    }
+}
+
+// puts the functions back together in their original order
+static void inline_join(void)
+{
+    int n = 0;
+    while(n < ir->n_values && !ir_is_fn_label(ir->values[n])) n++;
+    ir->n_values = n;
+
+    for(int f = 0; f < fns->n_values; f++) {
+        inline_fn* fn = fns->values[f];
+        for(int i = 0; i < fn->body->n_values; i++) vector_ir_insn_add(ir, fn->body->values[i]);
+        vector_ir_insn_free(fn->body);
+        vector_int_free(fn->callees);
+        free(fn);
+    }
+    vector_inline_fn_free(fns);
+    free(fn_map);
+}
+
+// x.l turns into x.n.l, a param f_x.p into the local f_x.n.l, and globals stay as they are
+static ir_var* inline_var(ir_var* var, int n)
+{
+    if(!var) return 0;
+    ir_var* new = malloc(sizeof(ir_var));
+    new->type = var->type;
+    if(ir_is_global(var)) new->name = var->name;
+    else {
+        int base = strlen(var->name) - 2;
+        new->name = malloc(base + 16);
+        sprintf(new->name, "%.*s.%d.l", base, var->name, n);
+    }
+    return new;
+}
+
+static ir_value* inline_value(ir_value* value, int n)
+{
+    if(!value) return 0;
+    ir_value* new = malloc(sizeof(ir_value));
+    *new = *value;
+    if(value->type == IR_VAR) new->content.var = inline_var(value->content.var, n);
+    return new;
+}
+
+static vector_ir_value* inline_args(vector_ir_value* args, int n)
+{
+    vector_ir_value* new = vector_ir_value_new();
+    for(int i = 0; i < args->n_values; i++) vector_ir_value_add(new, inline_value(args->values[i], n));
+    return new;
+}
+
+// the callee's labels and the fresh ones they're renamed to
+typedef struct {
+    int* from;
+    int* to;
+    int n;
+} inline_labels;
+
+static int inline_label(inline_labels* labels, int label)
+{
+    if(!label) return 0;
+    for(int i = 0; i < labels->n; i++) if(labels->from[i] == label) return labels->to[i];
+    return label;
+}
+
+// a copy of insn with its vars and labels renamed
+static ir_insn* inline_insn(ir_insn* insn, int n, inline_labels* labels)
+{
+    ir_insn* new = malloc(sizeof(ir_insn));
+    *new = *insn;
+    new->label = inline_label(labels, insn->label);
+
+    switch(insn->type) {
+        case IR_UN:
+        new->content.un.result = inline_var(insn->content.un.result, n);
+        new->content.un.operand = inline_value(insn->content.un.operand, n);
+        break;
+
+        case IR_BIN:
+        new->content.bin.result = inline_var(insn->content.bin.result, n);
+        new->content.bin.left = inline_value(insn->content.bin.left, n);
+        new->content.bin.right = inline_value(insn->content.bin.right, n);
+        break;
+
+        case IR_COPY:
+        new->content.copy.dst = inline_var(insn->content.copy.dst, n);
+        new->content.copy.src = inline_value(insn->content.copy.src, n);
+        break;
+
+        case IR_GOTO:
+        new->content.jmp.dst = inline_label(labels, insn->content.jmp.dst);
+        break;
+
+        case IR_IF:
+        new->content.condjmp.cond = inline_value(insn->content.condjmp.cond, n);
+        new->content.condjmp.if_true = inline_label(labels, insn->content.condjmp.if_true);
+        new->content.condjmp.if_false = inline_label(labels, insn->content.condjmp.if_false);
+        break;
+
+        // a tail call of the callee is followed by the rest of the caller once it's inlined,
+        // which can be the case with IR read back in, where the calls are already marked
+        case IR_FN_CALL:
+        new->content.fn_call.result = inline_var(insn->content.fn_call.result, n);
+        new->content.fn_call.args = inline_args(insn->content.fn_call.args, n);
+        new->content.fn_call.is_tail = 0;
+        break;
+
+        case IR_PROC_CALL:
+        new->content.proc_call.args = inline_args(insn->content.proc_call.args, n);
+        new->content.proc_call.is_tail = 0;
+        break;
+
+        case IR_RETURN:
+        new->content.ret.value = inline_value(insn->content.ret.value, n);
+        break;
+
+        case IR_ASSIGN_REF:
+        case IR_ASSIGN_DEREF:
+        case IR_DEREF_ASSIGN:
+        new->content.assign_ref.dst = inline_var(insn->content.assign_ref.dst, n);
+        new->content.assign_ref.src = inline_value(insn->content.assign_ref.src, n);
+        new->content.assign_ref.index = inline_var(insn->content.assign_ref.index, n);
+        break;
+
+        case IR_SELECT:
+        new->content.select.result = inline_var(insn->content.select.result, n);
+        new->content.select.cond = inline_value(insn->content.select.cond, n);
+        new->content.select.if_true = inline_value(insn->content.select.if_true, n);
+        new->content.select.if_false = inline_value(insn->content.select.if_false, n);
+        break;
+
+        case IR_NOP: break;
+    }
+
+    return new;
+}
+
+static ir_insn* inline_nop(int label)
+{
+    ir_insn* nop = calloc(1, sizeof(ir_insn));
+    nop->type = IR_NOP;
+    nop->label = label;
+    return nop;
+}
+
+static int inline_size(inline_fn* fn)
+{
+    int size = 0;
+    for(int i = 1; i < fn->body->n_values; i++) if(fn->body->values[i]->type != IR_NOP) size++;
+    return size;
+}
+
+static int inline_cost(inline_fn* callee, ir_insn* call)
+{
+    vector_ir_value* args = call_args(call);
+    int benefit = args->n_values + 2;
+    for(int i = 0; i < args->n_values; i++) if(args->values[i]->type == IR_LIT) benefit++;
+    return inline_size(callee) - benefit;
+}
+
+// appends the body of callee to code in place of call
+static void inline_call(vector_ir_insn* code, inline_fn* callee, ir_insn* call)
+{
+    int n = n_inlined++;
+    ast_fn* ast = callee->ast;
+    vector_ir_value* args = call_args(call);
+    ir_var* result = call->type == IR_FN_CALL ? call->content.fn_call.result : 0;
+
+    if(call->label) vector_ir_insn_add(code, inline_nop(call->label));
+
+    // the params are locals of the caller now, and get the arguments converted to their types
+    for(int i = 0; i < args->n_values; i++) {
+        ir_var* param = malloc(sizeof(ir_var));
+        param->name = malloc(strlen(ast->name) + strlen(ast->params->values[i]->name) + 16);
+        sprintf(param->name, "%s_%s.%d.l", ast->name, ast->params->values[i]->name, n);
+        param->type = ast->params->values[i]->type;
+
+        ir_insn* copy = calloc(1, sizeof(ir_insn));
+        copy->type = IR_COPY;
+        copy->content.copy.dst = param;
+        copy->content.copy.src = args->values[i];
+        vector_ir_insn_add(code, copy);
+    }
+
+    inline_labels labels = { malloc(callee->body->n_values * sizeof(int)), malloc(callee->body->n_values * sizeof(int)), 0 };
+    for(int i = 1; i < callee->body->n_values; i++) {
+        if(!callee->body->values[i]->label) continue;
+        labels.from[labels.n] = callee->body->values[i]->label;
+        labels.to[labels.n++] = ir_autolabel();
+    }
+
+    int after = 0;
+    for(int i = 1; i < callee->body->n_values; i++) {
+        ir_insn* insn = inline_insn(callee->body->values[i], n, &labels);
+        if(insn->type != IR_RETURN) {
+            vector_ir_insn_add(code, insn);
+            continue;
+        }
+
+        // the return turns into result = value; goto after, or nothing at all at the end of the body
+        int label = insn->label;
+        if(result && insn->content.ret.value) {
+            ir_insn* copy = calloc(1, sizeof(ir_insn));
+            copy->type = IR_COPY;
+            copy->label = label;
+            copy->content.copy.dst = result;
+            copy->content.copy.src = insn->content.ret.value;
+            vector_ir_insn_add(code, copy);
+            label = 0;
+        }
+        if(i < callee->body->n_values - 1) {
+            if(!after) after = ir_autolabel();
+            ir_insn* jmp = calloc(1, sizeof(ir_insn));
+            jmp->type = IR_GOTO;
+            jmp->label = label;
+            jmp->content.jmp.dst = after;
+            vector_ir_insn_add(code, jmp);
+        }
+        else if(label) vector_ir_insn_add(code, inline_nop(label));
+        free(insn);
+    }
+    if(after) vector_ir_insn_add(code, inline_nop(after));
+
+    free(labels.from);
+    free(labels.to);
+}
+
+// inlines the calls fn makes to functions in other components, which are done by now
+static void inline_calls(inline_fn* fn)
+{
+    vector_ir_insn* code = vector_ir_insn_new();
+
+    for(int i = 0; i < fn->body->n_values; i++) {
+        ir_insn* insn = fn->body->values[i];
+        char* label = call_label(insn);
+        int c = label ? inline_find(label) : -1;
+        inline_fn* callee = c == -1 ? 0 : fns->values[c];
+
+        if(!callee || callee->scc == fn->scc || !callee->ast || !callee->ast->params ||
+           callee->ast->params->n_values != call_args(insn)->n_values || inline_cost(callee, insn) > inline_threshold) {
+            vector_ir_insn_add(code, insn);
+            continue;
+        }
+
+        inline_call(code, callee, insn);
+    }
+
+    vector_ir_insn_free(fn->body);
+    fn->body = code;
+}
+
+// Tarjan's algorithm, without recursion since call chains in generated code can be long
+// it finishes the components callees first, and each one is inlined into as soon as it's finished
+static void inline_components(void)
+{
+    vector_int* stack = vector_int_new(); // the functions of unfinished components
+    vector_int* path = vector_int_new(); // the DFS, as pairs of function and the next callee to look at
+    int index = 0;
+    int n_sccs = 0;
+
+    for(int root = 0; root < fns->n_values; root++) {
+        if(fns->values[root]->index != -1) continue;
+        vector_int_add(path, root);
+        vector_int_add(path, 0);
+
+        while(path->n_values) {
+            int f = path->values[path->n_values - 2];
+            int* next = &path->values[path->n_values - 1];
+            inline_fn* fn = fns->values[f];
+
+            if(fn->index == -1) {
+                fn->index = fn->low = index++;
+                fn->on_stack = 1;
+                vector_int_add(stack, f);
+            }
+
+            if(*next < fn->callees->n_values) {
+                int c = fn->callees->values[(*next)++];
+                inline_fn* callee = fns->values[c];
+                if(callee->index == -1) {
+                    vector_int_add(path, c);
+                    vector_int_add(path, 0);
+                }
+                else if(callee->on_stack && callee->index < fn->low) fn->low = callee->index;
+                continue;
+            }
+
+            path->n_values -= 2;
+            if(path->n_values) {
+                inline_fn* caller = fns->values[path->values[path->n_values - 2]];
+                if(fn->low < caller->low) caller->low = fn->low;
+            }
+            if(fn->low != fn->index) continue;
+
+            // fn is the root of a component, which is everything above it on the stack
+            int first = stack->n_values - 1;
+            while(stack->values[first] != f) first--;
+            for(int i = first; i < stack->n_values; i++) {
+                fns->values[stack->values[i]]->on_stack = 0;
+                fns->values[stack->values[i]]->scc = n_sccs;
+            }
+            for(int i = first; i < stack->n_values; i++) inline_calls(fns->values[stack->values[i]]);
+            stack->n_values = first;
+            n_sccs++;
+        }
+    }
+
+    vector_int_free(stack);
+    vector_int_free(path);
+}
+
+void ir_inline_functions(void)
+{
+    if(inline_threshold <= 0) return;
+    inline_split();
+    inline_components();
+    inline_join();
+}
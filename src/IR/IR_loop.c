@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <IR/IR.h>
+#include <IR/IR_cfg.h>
+#include <IR/IR_optimize.h>
+#include <templates/vector.h>
+#include <templates/set.h>
+
+type_set(ir_insn);
+
+// loop optimizations
+// they all work on the natural loops found by ir_cfg_loops, and put whatever they take out of a loop
+// into a preheader: a new block that runs once right before the loop is entered.
+// the IR changes shape every time that happens, so the passes rebuild the CFG after each loop they touch.
+
+// returns the last instruction of the block that hasn't been taken out, or null if there's none
+static ir_insn* last_insn(ir_block* b)
+{
+    for(int ip = b->end - 1; ip >= b->start; ip--) if(ir->values[ip]) return ir->values[ip];
+    return 0;
+}
+
+static int falls_through(ir_insn* insn)
+{
+    return !insn || (insn->type != IR_GOTO && insn->type != IR_RETURN);
+}
+
+// inserts a preheader for the loop holding the given instructions, which the caller has already taken out of ir
+// every jump into the header from outside the loop is redirected to it, and the cfg is stale afterwards
+// the preheader is queued in front of the header and goes in at the next ir_compact
+// returns the number of queued instructions
+int ir_loop_insert_preheader(ir_cfg* cfg, ir_loop* loop, ir_insn** insns, int n)
+{
+    ir_block* header = cfg->blocks->values[loop->header];
+    int header_label = ir->values[header->start]->label;
+    int label = ir_autolabel();
+
+    for(int i = 0; i < cfg->blocks->n_values; i++) {
+        if(bitset_test(loop->blocks, i)) continue;
+        ir_insn* last = last_insn(cfg->blocks->values[i]);
+        if(!last) continue;
+        if(last->type == IR_GOTO && last->content.jmp.dst == header_label) last->content.jmp.dst = label;
+        if(last->type == IR_IF && last->content.condjmp.if_true == header_label) last->content.condjmp.if_true = label;
+    }
+
+    ir_insn** code = malloc((n + 2) * sizeof(ir_insn*));
+    int k = 0;
+
+    // the block laid out right before the header used to fall into it,
+    // if it belongs to the loop it has to jump over the preheader now
+    if(loop->header > 0 && bitset_test(loop->blocks, loop->header - 1)) {
+        if(falls_through(last_insn(cfg->blocks->values[loop->header - 1]))) {
+            ir_insn* jmp = calloc(1, sizeof(ir_insn));
+            jmp->type = IR_GOTO;
+            jmp->content.jmp.dst = header_label;
+            code[k++] = jmp;
+        }
+    }
+
+    ir_insn* nop = calloc(1, sizeof(ir_insn));
+    nop->type = IR_NOP;
+    nop->label = label;
+    code[k++] = nop;
+    for(int i = 0; i < n; i++) code[k++] = insns[i];
+
+    ir_insert_many(header->start, code, k);
+    free(code);
+    return k;
+}
+
+// state of the loop being looked at
+typedef struct {
+    ir_cfg* cfg;
+    ir_loop* loop;
+    int* defs; // per var, definitions inside the loop that are still there
+    uint64_t* exposed; // global or address-taken
+    int writes_memory; // the loop stores through a pointer or calls something
+} loop_state;
+
+static loop_state loop_state_new(ir_cfg* cfg, ir_loop* loop, uint64_t* exposed)
+{
+    loop_state l = { cfg, loop, calloc(cfg->vars->n_values, sizeof(int)), exposed, 0 };
+
+    for(int i = 0; i < loop->body->n_values; i++) {
+        ir_block* b = cfg->blocks->values[loop->body->values[i]];
+        for(int ip = b->start; ip < b->end; ip++) {
+            ir_insn* insn = ir->values[ip];
+            ir_var* def = ir_insn_def(insn);
+            if(def) l.defs[ir_cfg_var_index(cfg, def)]++;
+            if(ir_insn_is(insn, 3, IR_DEREF_ASSIGN, IR_FN_CALL, IR_PROC_CALL)) l.writes_memory = 1;
+        }
+    }
+    return l;
+}
+
+static int loop_invariant(loop_state* l, ir_value* value)
+{
+    if(value->type == IR_LIT) return 1;
+    int x = ir_cfg_var_index(l->cfg, value->content.var);
+    return l->defs[x] == 0 && !(bitset_test(l->exposed, x) && l->writes_memory);
+}
+
+// returns 1 if the block runs on every trip through the loop that leaves it
+static int loop_dominates_exits(loop_state* l, int b)
+{
+    for(int i = 0; i < l->loop->exits->n_values; i++)
+        if(!ir_cfg_dominates(l->cfg, b, l->loop->exits->values[i])) return 0;
+    return 1;
+}
+
+// returns 1 if the var is read after leaving the loop
+static int loop_live_after(loop_state* l, int x)
+{
+    ir_loop* loop = l->loop;
+    for(int i = 0; i < loop->exits->n_values; i++) {
+        ir_block* b = l->cfg->blocks->values[loop->exits->values[i]];
+        for(int j = 0; j < b->succs->n_values; j++) {
+            int succ = b->succs->values[j];
+            if(!bitset_test(loop->blocks, succ) && bitset_test(l->cfg->blocks->values[succ]->live_in, x)) return 1;
+        }
+    }
+    return 0;
+}
+
+// a pure computation can be moved into the preheader when its operands don't change inside the loop
+// and when nobody can tell the difference, which means that:
+// it's the only definition of its var in the loop, the var isn't read in the loop before it's assigned,
+// and either the var isn't read after the loop, or the computation would have run on every way out anyway.
+// loads need memory to stay the same for the whole loop, and since they can fault, they have to run on every way out,
+// and so does division, unless it's by a constant that can't trap.
+static int licm_can_hoist(loop_state* l, int b, ir_insn* insn)
+{
+    if(insn->label || !ir_insn_is(insn, 2, IR_UN, IR_BIN)) return 0;
+
+    ir_var* result = ir_insn_def(insn);
+    int x = ir_cfg_var_index(l->cfg, result);
+    if(l->defs[x] != 1 || bitset_test(l->exposed, x)) return 0;
+    if(bitset_test(l->cfg->blocks->values[l->loop->header]->live_in, x)) return 0;
+
+    int must_run = 0;
+    if(insn->type == IR_UN) {
+        ir_un* un = &insn->content.un;
+        if(un->op == IR_REFERENCE || !loop_invariant(l, un->operand)) return 0;
+        if(un->op == IR_DEREFERENCE) {
+            if(l->writes_memory) return 0;
+            must_run = 1;
+        }
+    }
+    else {
+        ir_bin* bin = &insn->content.bin;
+        if(!loop_invariant(l, bin->left) || !loop_invariant(l, bin->right)) return 0;
+        if((bin->op == IR_DIVIDE || bin->op == IR_MODULO) && !(bin->right->type == IR_LIT &&
+        bin->right->content.lit.i != 0 && bin->right->content.lit.i != -1)) must_run = 1;
+    }
+
+    if(must_run || loop_live_after(l, x)) return loop_dominates_exits(l, b);
+    return 1;
+}
+
+// hoists what it can out of the loop, returns 1 if anything was moved
+static int licm_loop_hoist(ir_cfg* cfg, ir_loop* loop, uint64_t* exposed)
+{
+    loop_state l = loop_state_new(cfg, loop, exposed);
+
+    // hoisting one computation can make the ones using its result invariant,
+    // and the preheader gets them in the order they were found, so definitions come before uses
+    vector_ir_insn* hoisted = vector_ir_insn_new();
+    int found = 1;
+    while(found) {
+        found = 0;
+        for(int i = 0; i < loop->body->n_values; i++) {
+            ir_block* b = cfg->blocks->values[loop->body->values[i]];
+            for(int ip = b->start; ip < b->end; ip++) {
+                ir_insn* insn = ir->values[ip];
+                if(!insn || !licm_can_hoist(&l, loop->body->values[i], insn)) continue;
+                l.defs[ir_cfg_var_index(cfg, ir_insn_def(insn))]--;
+                vector_ir_insn_add(hoisted, insn);
+                ir->values[ip] = 0;
+                found = 1;
+            }
+        }
+    }
+
+    int moved = hoisted->n_values > 0;
+    if(moved) {
+        ir_loop_insert_preheader(cfg, loop, hoisted->values, hoisted->n_values);
+        ir_compact();
+    }
+
+    vector_ir_insn_free(hoisted);
+    free(l.defs);
+    return moved;
+}
+
+typedef int (*loop_transform)(ir_cfg* cfg, ir_loop* loop, uint64_t* exposed);
+
+// runs the transform on each loop of the function in ir from the innermost out,
+// rebuilding the cfg whenever the transform reports that it changed something
+static void for_each_loop_in_fn(void* arg)
+{
+    loop_transform transform = *(loop_transform*) arg;
+    int start, end;
+    if(!ir_next_fn(0, &start, &end)) return;
+    vector_ir_insn* done = vector_ir_insn_new(); // headers of loops already handled, by their first instruction
+
+    for(;;) {
+        ir_cfg* cfg = ir_cfg_build(start, end);
+        ir_cfg_liveness(cfg);
+        ir_cfg_dominators(cfg);
+        vector_ir_loop* loops = ir_cfg_loops(cfg);
+        uint64_t* exposed = ir_cfg_exposed_vars(cfg);
+
+        int changed = 0;
+        for(int i = 0; i < loops->n_values && !changed; i++) {
+            ir_loop* loop = loops->values[i];
+            ir_insn* header = ir->values[cfg->blocks->values[loop->header]->start];
+            if(loop->header == 0 || vector_ir_insn_contains(done, header)) continue;
+            vector_ir_insn_add(done, header);
+            changed = transform(cfg, loop, exposed);
+        }
+
+        free(exposed);
+        ir_loops_free(loops);
+        ir_cfg_free(cfg);
+        if(!changed) break;
+
+        // the function changed size, find its end again
+        ir_next_fn(start, &start, &end);
+    }
+
+    vector_ir_insn_free(done);
+}
+
+// ir only holds the one function while its loops are transformed,
+// since that's rebuilt and compacted after every loop that changes
+static void for_each_loop(loop_transform transform)
+{
+    ir_for_each_fn(for_each_loop_in_fn, &transform);
+}
+
+// loop-invariant code motion
+// going from the innermost loop out means that code hoisted out of an inner loop
+// lands in a preheader inside the outer loop, where it gets another chance to be hoisted further
+void ir_hoist_loop_invariants(void)
+{
+    for_each_loop(licm_loop_hoist);
+}
+
+// induction variables
+// a basic induction variable is assigned once per iteration as i = i + c,
+// a derived one is assigned j = a * i + b + d, where a and d are constants and b is loop-invariant.
+// strength reduction gives each derived variable its own var s, set to a * i + b in the preheader
+// and bumped by a * c right after every update of i, so that j's computation turns into j = s.
+// an exit test of i == n or i != n is then rewritten in terms of s, which usually leaves i with nothing to do.
+
+typedef struct {
+    int iv; // var index of the basic induction variable, -1 if this var isn't a derived one
+    int64_t scale;
+    ir_value* base; // loop-invariant var, or null
+    int64_t disp;
+    int ip; // the defining instruction
+    ir_var* reduced; // the var that replaces it, null if nothing outside the derived vars reads it
+} iv_derived;
+
+static ir_insn* iv_bin(ir_var* result, ir_value* left, ir_op op, ir_value* right)
+{
+    ir_insn* insn = calloc(1, sizeof(ir_insn));
+    insn->type = IR_BIN;
+    insn->content.bin.result = result;
+    insn->content.bin.left = left;
+    insn->content.bin.op = op;
+    insn->content.bin.right = right;
+    return insn;
+}
+
+// emits dst = x * scale + base + disp
+static void iv_linear(vector_ir_insn* code, ir_var* dst, ir_value* x, int64_t scale, ir_value* base, int64_t disp)
+{
+    ir_value* sum = x;
+    if(scale != 1) {
+        vector_ir_insn_add(code, iv_bin(dst, sum, IR_MULTIPLY, ir_value_lit(scale)));
+        sum = ir_value_var(dst);
+    }
+    if(base) {
+        vector_ir_insn_add(code, iv_bin(dst, sum, IR_ADD, base));
+        sum = ir_value_var(dst);
+    }
+    if(disp || sum == x) vector_ir_insn_add(code, iv_bin(dst, sum, IR_ADD, ir_value_lit(disp)));
+}
+
+// removes an instruction that the caller has already replaced or made useless
+static void iv_remove(int ip)
+{
+    if(ir->values[ip]->label) ir->values[ip]->type = IR_NOP;
+    else ir->values[ip] = 0;
+}
+
+// whether a test of i against a loop-invariant bound can become a test of s against a * bound + b + d
+// either side may wrap around, which keeps them equal or not equal when a is odd and nothing gets truncated,
+// but says nothing about which one is smaller, so the other comparisons stay on i
+static int iv_test_replaceable(ir_op op, ir_var* iv, ir_value* bound, iv_derived* rep)
+{
+    type_info* type = rep->reduced->type;
+    if(!(op == IR_EQUAL || op == IR_NOT_EQUAL) || !(rep->scale & 1) || ir_type_size(type) != ir_type_size(iv->type)) return 0;
+    if(bound->type == IR_LIT) return ir_canonical(type, bound->content.lit.i) == bound->content.lit.i;
+    return ir_type_size(bound->content.var->type) <= ir_type_size(type);
+}
+
+// finds a derived induction variable computed by the instruction, returns 0 if it isn't one
+static int iv_classify(loop_state* l, int* update, iv_derived* derived, int ip, iv_derived* out)
+{
+    ir_insn* insn = ir->values[ip];
+    if(insn->type != IR_BIN) return 0;
+    ir_bin* bin = &insn->content.bin;
+    int j = ir_cfg_var_index(l->cfg, bin->result);
+    if(l->defs[j] != 1 || bitset_test(l->exposed, j) || update[j] != -1 || derived[j].iv != -1) return 0;
+    if(bitset_test(l->cfg->blocks->values[l->loop->header]->live_in, j)) return 0;
+
+    // try both operand orders for the commutative ones
+    for(int swap = 0; swap < 2; swap++) {
+        ir_value* k_value = swap ? bin->right : bin->left;
+        ir_value* other = swap ? bin->left : bin->right;
+        if(k_value->type != IR_VAR) continue;
+        if(swap && bin->op == IR_SUBTRACT) break;
+
+        int k = ir_cfg_var_index(l->cfg, k_value->content.var);
+        iv_derived from;
+        if(update[k] != -1) from = (iv_derived) { k, 1, 0, 0, -1, 0 };
+        else if(derived[k].iv != -1) from = derived[k];
+        else continue;
+
+        *out = (iv_derived) { from.iv, from.scale, from.base, from.disp, ip, 0 };
+        // constants wrap around like they would at run time
+        uint64_t c = other->type == IR_LIT ? other->content.lit.i : 0;
+
+        if(bin->op == IR_MULTIPLY && other->type == IR_LIT && !from.base) {
+            out->scale = (int64_t) ((uint64_t) from.scale * c);
+            out->disp = (int64_t) ((uint64_t) from.disp * c);
+            return out->scale != 0;
+        }
+        if(bin->op == IR_ADD && other->type == IR_LIT) {
+            out->disp = (int64_t) ((uint64_t) from.disp + c);
+            return 1;
+        }
+        if(bin->op == IR_ADD && !from.base && loop_invariant(l, other)) {
+            out->base = other;
+            return 1;
+        }
+        if(bin->op == IR_SUBTRACT && other->type == IR_LIT) {
+            out->disp = (int64_t) ((uint64_t) from.disp - c);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// the instructions to put right after an update of a basic induction variable
+typedef struct {
+    int ip;
+    ir_insn* insn;
+} iv_bump;
+
+static int iv_reduce(ir_cfg* cfg, ir_loop* loop, uint64_t* exposed)
+{
+    loop_state l = loop_state_new(cfg, loop, exposed);
+    int n = cfg->vars->n_values;
+    int* update = malloc(n * sizeof(int)); // per var, the update if it's a basic induction variable
+    int64_t* step = calloc(n, sizeof(int64_t));
+    iv_derived* derived = malloc(n * sizeof(iv_derived));
+    for(int i = 0; i < n; i++) {
+        update[i] = -1;
+        derived[i].iv = -1;
+    }
+
+    // the update has to run exactly once per iteration, so its block has to dominate every back edge
+    ir_block* header = cfg->blocks->values[loop->header];
+    for(int i = 0; i < loop->body->n_values; i++) {
+        int b = loop->body->values[i];
+        int every_iteration = 1;
+        for(int j = 0; j < header->preds->n_values; j++) {
+            int pred = header->preds->values[j];
+            if(bitset_test(loop->blocks, pred) && !ir_cfg_dominates(cfg, b, pred)) every_iteration = 0;
+        }
+        if(!every_iteration) continue;
+
+        for(int ip = cfg->blocks->values[b]->start; ip < cfg->blocks->values[b]->end; ip++) {
+            ir_insn* insn = ir->values[ip];
+            if(insn->type != IR_BIN || !(insn->content.bin.op == IR_ADD || insn->content.bin.op == IR_SUBTRACT)) continue;
+            ir_bin* bin = &insn->content.bin;
+            int x = ir_cfg_var_index(cfg, bin->result);
+            if(l.defs[x] != 1 || bitset_test(exposed, x)) continue;
+
+            ir_value* self = bin->left;
+            ir_value* c = bin->right;
+            if(bin->op == IR_ADD && c->type == IR_VAR) {
+                self = bin->right;
+                c = bin->left;
+            }
+            if(c->type != IR_LIT || self->type != IR_VAR || strcmp(self->content.var->name, bin->result->name)) continue;
+            update[x] = ip;
+            step[x] = bin->op == IR_ADD ? c->content.lit.i : (int64_t) -(uint64_t) c->content.lit.i;
+        }
+    }
+
+    // derived ones can be derived from each other, so this goes until nothing new turns up
+    int found = 1;
+    while(found) {
+        found = 0;
+        for(int i = 0; i < loop->body->n_values; i++) {
+            ir_block* b = cfg->blocks->values[loop->body->values[i]];
+            for(int ip = b->start; ip < b->end; ip++) {
+                iv_derived d;
+                if(!iv_classify(&l, update, derived, ip, &d)) continue;
+                derived[ir_cfg_var_index(cfg, ir_insn_def(ir->values[ip]))] = d;
+                found = 1;
+            }
+        }
+    }
+
+    // a derived var only needs replacing if something other than another derived var's computation reads it,
+    // the ones that only feed others are simply dropped
+    char* needed = calloc(n, 1);
+    var_vector* uses = vector_ir_var_new();
+    for(int i = 0; i < loop->body->n_values; i++) {
+        ir_block* b = cfg->blocks->values[loop->body->values[i]];
+        for(int ip = b->start; ip < b->end; ip++) {
+            ir_var* def = ir_insn_def(ir->values[ip]);
+            if(def && derived[ir_cfg_var_index(cfg, def)].iv != -1 && derived[ir_cfg_var_index(cfg, def)].ip == ip) continue;
+            ir_insn_uses(ir->values[ip], uses);
+            for(int u = 0; u < uses->n_values; u++) needed[ir_cfg_var_index(cfg, uses->values[u])] = 1;
+        }
+    }
+
+    vector_ir_insn* pre = vector_ir_insn_new();
+    iv_bump* bumps = malloc(n * sizeof(iv_bump));
+    int n_bumps = 0;
+
+    for(int j = 0; j < n; j++) {
+        iv_derived* d = &derived[j];
+        if(d->iv == -1) continue;
+        ir_insn* insn = ir->values[d->ip];
+
+        if(!needed[j] && !loop_live_after(&l, j)) {
+            iv_remove(d->ip);
+            continue;
+        }
+
+        ir_var* dst = insn->content.bin.result;
+        d->reduced = ir_temp(dst->type);
+        iv_linear(pre, d->reduced, ir_value_var(cfg->vars->values[d->iv]), d->scale, d->base, d->disp);
+        insn->type = IR_COPY;
+        insn->content.copy.dst = dst;
+        insn->content.copy.src = ir_value_var(d->reduced);
+
+        int64_t bump = (int64_t) ((uint64_t) d->scale * step[d->iv]);
+        bumps[n_bumps++] = (iv_bump) { update[d->iv], iv_bin(d->reduced, ir_value_var(d->reduced), IR_ADD, ir_value_lit(bump)) };
+    }
+
+    // linear function test replacement: i != n becomes s != a * n + b,
+    // and i goes away if nothing else in or after the loop reads it
+    for(int i = 0; i < n; i++) {
+        if(update[i] == -1 || loop_live_after(&l, i)) continue;
+
+        iv_derived* rep = 0;
+        for(int j = 0; j < n && !rep; j++) if(derived[j].iv == i && derived[j].reduced) rep = &derived[j];
+        if(!rep) continue;
+
+        vector_int* tests = vector_int_new();
+        int only_tests = 1;
+        for(int b = 0; b < loop->body->n_values && only_tests; b++) {
+            ir_block* block = cfg->blocks->values[loop->body->values[b]];
+            for(int ip = block->start; ip < block->end && only_tests; ip++) {
+                ir_insn* insn = ir->values[ip];
+                if(!insn || ip == update[i]) continue;
+                ir_insn_uses(insn, uses);
+                int reads = 0;
+                for(int u = 0; u < uses->n_values; u++) reads |= ir_cfg_var_index(cfg, uses->values[u]) == i;
+                if(!reads) continue;
+
+                ir_bin* bin = &insn->content.bin;
+                int is_test = insn->type == IR_BIN &&
+                ((bin->left->type == IR_VAR && ir_cfg_var_index(cfg, bin->left->content.var) == i && loop_invariant(&l, bin->right) &&
+                iv_test_replaceable(bin->op, cfg->vars->values[i], bin->right, rep)) ||
+                (bin->right->type == IR_VAR && ir_cfg_var_index(cfg, bin->right->content.var) == i && loop_invariant(&l, bin->left) &&
+                iv_test_replaceable(bin->op, cfg->vars->values[i], bin->left, rep)));
+                if(is_test) vector_int_add(tests, ip);
+                else only_tests = 0;
+            }
+        }
+
+        if(only_tests) {
+            for(int t = 0; t < tests->n_values; t++) {
+                ir_bin* bin = &ir->values[tests->values[t]]->content.bin;
+                int i_left = bin->left->type == IR_VAR && ir_cfg_var_index(cfg, bin->left->content.var) == i;
+                ir_value** bound = i_left ? &bin->right : &bin->left;
+                ir_value** counter = i_left ? &bin->left : &bin->right;
+
+                ir_var* limit = ir_temp(rep->reduced->type);
+                iv_linear(pre, limit, *bound, rep->scale, rep->base, rep->disp);
+                *bound = ir_value_var(limit);
+                *counter = ir_value_var(rep->reduced);
+            }
+            iv_remove(update[i]);
+        }
+        vector_int_free(tests);
+    }
+
+    int changed = pre->n_values > 0;
+    if(changed) {
+        // the bumps are queued first, one right after an update at the end of the block before the header
+        // has to stay ahead of the preheader
+        for(int i = 0; i < n_bumps; i++) ir_insert_before(bumps[i].ip + 1, bumps[i].insn);
+        ir_loop_insert_preheader(cfg, loop, pre->values, pre->n_values);
+        ir_compact();
+    }
+
+    vector_ir_insn_free(pre);
+    vector_ir_var_free(uses);
+    free(bumps);
+    free(needed);
+    free(derived);
+    free(step);
+    free(update);
+    free(l.defs);
+    return changed;
+}
+
+// induction variable strength reduction
+void ir_reduce_induction_variables(void)
+{
+    for_each_loop(iv_reduce);
+}
@@ -6,6 +6,7 @@
 #include <IR/IR.h>
 #include <IR/IR_print.h>
 #include <IR/IR_optimize.h>
+#include <IR/IR_cfg.h>
 #include <templates/vector.h>
 #include <templates/graph.h>
 #include <templates/set.h>
@@ -24,14 +25,14 @@ var_vector* global_vars = 0;
 int ir_code_start(void)
 {
     global_vars = vector_ir_var_new();
-    char c[64] = {0};
+    char c[256] = {0};
     int i = 0;
-    while(ir->values[i]->type == IR_COPY) {
+    while(ir->values[i]->type == IR_COPY && !ir_is_fn_label(ir->values[i])) {
         if(ir_out) {
             FILE* ir_f = fopen(ir_out, "a");
             ir_print_instr(ir->values[i], c);
             fprintf(ir_f, "%s", c);
-            memset(c, 0, 64);
+            memset(c, 0, 256);
             fclose(ir_f);
         }
         vector_ir_var_add(global_vars, ir->values[i]->content.copy.dst);
@@ -52,7 +53,8 @@ int ir_get_block(int* start, int* end)
     if(i >= ir->n_values) return 0;
     *start = i;
 
-    for(ir_insn* insn = ir->values[i]; !ir_insn_is(insn, 5, 
+    // the last function can run off its end, so the last block doesn't have to end in a jump
+    for(ir_insn* insn = ir->values[i]; i + 1 < ir->n_values && !ir_insn_is(insn, 5, 
     IR_IF, IR_GOTO, IR_FN_CALL, IR_PROC_CALL, IR_RETURN) && !insn->label; insn = ir->values[++i]);
 
     *end = ++i; // include the jump instruction and increment the index past it for the next call
@@ -107,11 +109,20 @@ var_vector* ir_get_vars(int start, int end)
             case IR_ASSIGN_DEREF:
             value_add(insn->content.assign_deref.src);
             var_add(insn->content.assign_deref.dst);
+            if(insn->content.assign_deref.index) var_add(insn->content.assign_deref.index);
             break;
 
             case IR_DEREF_ASSIGN:
             value_add(insn->content.deref_assign.src);
             var_add(insn->content.deref_assign.dst);
+            if(insn->content.deref_assign.index) var_add(insn->content.deref_assign.index);
+            break;
+
+            case IR_SELECT:
+            var_add(insn->content.select.result);
+            value_add(insn->content.select.cond);
+            value_add(insn->content.select.if_true);
+            value_add(insn->content.select.if_false);
             break;
 
             default: break;
@@ -164,17 +175,16 @@ var_vector* ir_get_local_vars(char* fn)
 {
     int fn_start = 0;
     int fn_end = 0;
-    char fn_name[64];
-    sprintf(fn_name, "fn.%s", fn);
 
     for(int i = 0; i < ir->n_values; i++) {
-        if(ir->values[i]->label && strcmp(ir->values[i]->label, fn_name) == 0) {
+        ast_fn* label_fn = ir_label_fn(ir->values[i]->label);
+        if(label_fn && strcmp(label_fn->name, fn) == 0) {
             fn_start = i;
             break;
         }
     }
     for(int i = fn_start + 1; i < ir->n_values; i++) {
-        if(ir->values[i]->label && strncmp(ir->values[i]->label, "fn.", 3) == 0) {
+        if(ir_is_fn_label(ir->values[i])) {
             fn_end = i-1; // found the start of another function
             break;
         }
@@ -211,51 +221,80 @@ ast_fn* ir_get_ast_fn(char* fn_name)
     return 0;
 }
 
-// this function removes unused assignment instrs on used vars
-void ir_block_remove_unused_assignments(int start, int end)
+// this function removes assignments in the given block whose values are never read
+// an assignment is dead if its var isn't live after it, which also covers vars reassigned before use;
+// only pure instructions are removed, and never ones that write to pinned vars (globals and such)
+// returns the number of removed instructions
+int ir_block_remove_unused_assignments(ir_cfg* cfg, ir_block* b, uint64_t* pinned)
 {
-    // for each var, check if all its value assignments are used and remove ones that aren't
-    // except if it's the last, then it may be used outside the block being considered
-    // this optimization is not that important rn
-
-    /*for(int i = start; i < end; i++) {
-        ir_instr* instr = ir->values[i];
-        if(ir_instr_is(instr, 3, IR_UN, IR_BIN, IR_COPY, IR_FN_CALL))
-    }*/
+    int removed = 0;
+    uint64_t* live = bitset_new(cfg->n_words);
+    bitset_copy(live, b->live_out, cfg->n_words);
+
+    for(int ip = b->end - 1; ip >= b->start; ip--) {
+        int v = ir_cfg_def(cfg, ip);
+
+        if(v != -1) {
+            if(ir_op_is_pure(cfg->ops[ip - cfg->start]) && !bitset_test(live, v) && !bitset_test(pinned, v)
+               && !ir->values[ip]->label) {
+                free(ir->values[ip]);
+                ir->values[ip] = 0;
+                removed++;
+                continue;
+            }
+            bitset_unset(live, v);
+        }
+
+        for(int* u = ir_cfg_uses_begin(cfg, ip); u < ir_cfg_uses_end(cfg, ip); u++) bitset_set(live, *u);
+    }
+
+    free(live);
+    return removed;
 }
 
-// this function moves the instruction at ir[src] to right after ir[dst]
-void ir_move_instr_after(int src, int dst)
-{
-    if(src < dst || dst >= ir->n_values || src >= ir->n_values) goto bad_args;
-    if(src == dst) return; // same ordering
+// insertions are queued and spliced in by the next ir_compact, together with the deletions,
+// so a pass can make any number of edits for the cost of one sweep over the IR,
+// and the indices it's working with keep referring to the same instructions until then
+typedef struct {
+    int index; // goes in before what's at ir[index] now
+    int order; // instructions queued for the same index keep their order
+    ir_insn* insn;
+} ir_pending;
 
-    ir_insn* insn = ir->values[src];
-    for(int i = src; i > dst; i--) {
-        ir->values[i] = ir->values[i-1];
-    }
+static ir_pending* pending = 0;
+static int n_pending = 0;
+static int max_pending = 0;
 
-    ir->values[dst+1] = insn;
-    return;
+void ir_insert_before(int index, ir_insn* insn)
+{
+    if(n_pending == max_pending) {
+        max_pending = max_pending ? 2 * max_pending : 64;
+        pending = realloc(pending, max_pending * sizeof(ir_pending));
+    }
+    pending[n_pending] = (ir_pending) { index, n_pending, insn };
+    n_pending++;
+}
 
-    bad_args:
-    printf("ir_move_instr_after: instructions can only be moved upwards\n");
+// moves the instruction at ir[src] to right after ir[dst], once ir_compact runs
+void ir_move_instr_after(int src, int dst)
+{
+    if(src == dst) return;
+    ir_insert_before(dst + 1, ir->values[src]);
+    ir->values[src] = 0;
 }
 
 void ir_add_instr_after(ir_insn* instr, int index)
 {
-    vector_ir_insn_add(ir, instr);
-    ir_move_instr_after(ir->n_values - 1, index);
+    ir_insert_before(index + 1, instr);
 }
 
-// this function deletes an instruction and frees its memory
+// deletes an instruction and frees its memory, it's dropped from ir by the next ir_compact
 void ir_remove_instruction(ir_insn* instr)
 {
     int i = 0;
     for(; ir->values[i] != instr; i++);
     free(ir->values[i]); // I know there can be memory leaks here but I cba
-    for(; i < ir->n_values - 1; i++) ir->values[i] = ir->values[i+1];
-    ir->n_values--;
+    ir->values[i] = 0;
 }
 
 // this function reorders instructions to optimize the given block
@@ -276,23 +315,294 @@ void ir_block_reorder_instructions(int start, int end)
     }
 }
 
+// whether computing the result straight into dst gives what truncating it to temp and then copying would
+// only the parser's temporaries qualify, a named var can still be read after the copy
+// and an unsigned temp narrower than dst wraps around where dst wouldn't, the rest only differ on overflow
+static int ir_coalescable(ir_insn* insn, ir_var* temp, ir_var* dst)
+{
+    if(temp->name[0] != '.') return 0;
+    if(insn->type == IR_UN && insn->content.un.op == IR_DEREFERENCE) return 1;
+    return ir_type_size(dst->type) <= ir_type_size(temp->type) || !ir_is_unsigned(temp->type);
+}
+
 // result = a + b * c turns into:
 // t0 = b * c;
 // t1 = a + t0;
 // result = t1
 // this pass optimizes t1 out and turns it into
 // result = a + t0
+
+// the instructions that stay are packed to the front as it goes, so the pass is one sweep however many it removes
 void ir_remove_redundant_assignments(void)
 {
+    int n = ir->n_values ? 1 : 0;
     for(int i = 1; i < ir->n_values; i++) {
-        if(ir->values[i]->type == IR_COPY && ir->values[i]->content.copy.src->type == IR_VAR && 
-        ir_insn_is(ir->values[i-1], 2, IR_UN, IR_BIN) && 
-        strcmp(((ir_un*) ir->values[i-1])->result->name, 
-        ir->values[i]->content.copy.src->content.var->name) == 0) {
-            ((ir_un*) ir->values[i-1])->result = ir->values[i]->content.copy.dst;
-            ir_remove_instruction(ir->values[i]);
-            i--;
+        ir_insn* prev = ir->values[n-1];
+        ir_insn* insn = ir->values[i];
+        if(insn->type == IR_COPY && insn->content.copy.src->type == IR_VAR &&
+        ir_insn_is(prev, 2, IR_UN, IR_BIN) &&
+        strcmp(((ir_un*) prev)->result->name, insn->content.copy.src->content.var->name) == 0 &&
+        ir_coalescable(prev, ((ir_un*) prev)->result, insn->content.copy.dst)) {
+            ((ir_un*) prev)->result = insn->content.copy.dst;
+            free(insn);
+            continue;
+        }
+        ir->values[n++] = insn;
+    }
+    ir->n_values = n;
+}
+
+// queues the given instructions so that the first one ends up where ir[index] is now
+void ir_insert_many(int index, ir_insn** insns, int n)
+{
+    for(int i = 0; i < n; i++) ir_insert_before(index, insns[i]);
+}
+
+static int ir_compare_pending(const void* a, const void* b)
+{
+    const ir_pending* x = a;
+    const ir_pending* y = b;
+    if(x->index != y->index) return x->index - y->index;
+    return x->order - y->order;
+}
+
+// drops the instructions that passes have deleted by setting them to null and splices in the queued ones
+// passes mark instead of removing right away so that a whole pass costs one sweep over the IR
+void ir_compact(void)
+{
+    if(!n_pending) {
+        int n = 0;
+        for(int i = 0; i < ir->n_values; i++) if(ir->values[i]) ir->values[n++] = ir->values[i];
+        ir->n_values = n;
+        return;
+    }
+
+    qsort(pending, n_pending, sizeof(ir_pending), ir_compare_pending);
+    int size = ir->n_values + n_pending + 1;
+    ir_insn** values = malloc(size * sizeof(ir_insn*));
+    int n = 0, p = 0;
+    for(int i = 0; i <= ir->n_values; i++) {
+        while(p < n_pending && pending[p].index <= i) values[n++] = pending[p++].insn;
+        if(i < ir->n_values && ir->values[i]) values[n++] = ir->values[i];
+    }
+    while(p < n_pending) values[n++] = pending[p++].insn;
+
+    free(ir->values);
+    ir->values = values;
+    ir->n_values = n;
+    ir->max_values = size;
+    n_pending = 0;
+}
+
+// runs pass on every function by itself, with ir holding nothing but that function while it runs,
+// so edits and compactions inside one function don't move the rest of the program around
+// the program is put back together in one sweep as it goes
+void ir_for_each_fn(void (*pass)(void* arg), void* arg)
+{
+    vector_ir_insn* program = ir;
+    vector_ir_insn* out = vector_ir_insn_new();
+    vector_ir_insn* fn = vector_ir_insn_new();
+    int start, end = 0;
+
+    int first = ir_next_fn(0, &start, &end) ? start : program->n_values;
+    for(int i = 0; i < first; i++) if(program->values[i]) vector_ir_insn_add(out, program->values[i]);
+
+    end = first;
+    while(ir_next_fn(end, &start, &end)) {
+        fn->n_values = 0;
+        for(int i = start; i < end; i++) if(program->values[i]) vector_ir_insn_add(fn, program->values[i]);
+
+        ir = fn;
+        pass(arg);
+        ir_compact();
+        for(int i = 0; i < fn->n_values; i++) vector_ir_insn_add(out, fn->values[i]);
+        ir = program;
+    }
+
+    vector_ir_insn_free(fn);
+    free(program->values);
+    *program = *out;
+    free(out);
+}
+
+static void ir_delete(int index)
+{
+    free(ir->values[index]);
+    ir->values[index] = 0;
+}
+
+// removes all blocks that can't be reached from their function's entry
+// returns the number of removed instructions
+int ir_remove_unreachable_code(void)
+{
+    int removed = 0;
+    int start, end = 0;
+
+    while(ir_next_fn(end, &start, &end)) {
+        ir_cfg* cfg = ir_cfg_build(start, end);
+        int n = cfg->blocks->n_values;
+        char* reachable = calloc(n, 1);
+        int* worklist = malloc(n * sizeof(int));
+        int top = 0;
+
+        reachable[0] = 1;
+        worklist[top++] = 0;
+        while(top) {
+            ir_block* b = cfg->blocks->values[worklist[--top]];
+            for(int i = 0; i < b->succs->n_values; i++) {
+                int succ = b->succs->values[i];
+                if(reachable[succ]) continue;
+                reachable[succ] = 1;
+                worklist[top++] = succ;
+            }
+        }
+
+        for(int i = 1; i < n; i++) {
+            if(reachable[i]) continue;
+            ir_block* b = cfg->blocks->values[i];
+            for(int ip = b->start; ip < b->end; ip++) ir_delete(ip);
+            removed += b->end - b->start;
+        }
+
+        free(worklist);
+        free(reachable);
+        ir_cfg_free(cfg);
+    }
+
+    ir_compact();
+    return removed;
+}
+
+static int* ir_jump_target(ir_insn* insn)
+{
+    if(insn->type == IR_GOTO) return &insn->content.jmp.dst;
+    if(insn->type == IR_IF) return &insn->content.condjmp.if_true;
+    return 0;
+}
+
+// follows the given label through empty blocks and unconditional jumps
+// and returns the label that the jump should go to instead
+static int ir_resolve_label(ir_cfg* cfg, int label)
+{
+    for(int hops = 0; hops < cfg->blocks->n_values; hops++) {
+        int b = ir_cfg_label_block(cfg, label);
+        if(b == -1) return label;
+
+        // skip the run of labels, falling through empty blocks
+        int ip = cfg->blocks->values[b]->start;
+        while(ip < cfg->end && ir->values[ip]->type == IR_NOP) ip++;
+
+        if(ip < cfg->end && ir->values[ip]->type == IR_GOTO && ir->values[ip]->content.jmp.dst != label) {
+            label = ir->values[ip]->content.jmp.dst;
+            continue;
+        }
+
+        // every label in the run is equivalent, pick the first one so they all collapse into it
+        int first = ip;
+        while(first > cfg->start && ir->values[first - 1]->type == IR_NOP) first--;
+        for(; first < ip; first++) {
+            int candidate = ir->values[first]->label;
+            if(candidate && !ir_label_fn(candidate)) return candidate;
+        }
+        return label;
+    }
+
+    return label; // a loop made of nothing but jumps, leave it be
+}
+
+// redirects jumps to jumps, collapses runs of labels into one,
+// removes jumps to the very next instruction, and finally removes labels nobody jumps to
+// returns the number of removed instructions
+int ir_thread_jumps(void)
+{
+    int removed = 0;
+    int start, end = 0;
+
+    while(ir_next_fn(end, &start, &end)) {
+        ir_cfg* cfg = ir_cfg_build(start, end);
+
+        for(int i = start; i < end; i++) {
+            int* target = ir_jump_target(ir->values[i]);
+            if(target) *target = ir_resolve_label(cfg, *target);
+        }
+
+        // going backwards lets `if x goto L; goto L; L:` disappear entirely
+        char* dead = calloc(end - start, 1);
+        for(int i = end - 1; i >= start; i--) {
+            int* target = ir_jump_target(ir->values[i]);
+            if(!target) continue;
+
+            for(int j = i + 1; j < end; j++) {
+                if(dead[j - start]) continue;
+                if(ir->values[j]->type != IR_NOP) break;
+                if(ir->values[j]->label == *target) {
+                    dead[i - start] = 1;
+                    break;
+                }
+            }
         }
+
+        int* refs = calloc(cfg->blocks->n_values, sizeof(int));
+        for(int i = start; i < end; i++) {
+            int* target = ir_jump_target(ir->values[i]);
+            if(!target || dead[i - start]) continue;
+            int b = ir_cfg_label_block(cfg, *target);
+            if(b != -1) refs[b]++;
+        }
+        for(int i = 0; i < cfg->blocks->n_values; i++) {
+            ir_insn* first = ir->values[cfg->blocks->values[i]->start];
+            if(refs[i] || !first->label || ir_is_fn_label(first)) continue;
+            if(first->type == IR_NOP) dead[cfg->blocks->values[i]->start - start] = 1;
+            else first->label = 0;
+        }
+
+        for(int i = start; i < end; i++) {
+            if(!dead[i - start]) continue;
+            ir_delete(i);
+            removed++;
+        }
+
+        free(refs);
+        free(dead);
+        ir_cfg_free(cfg);
+    }
+
+    ir_compact();
+    return removed;
+}
+
+// runs the control flow cleanups until none of them finds anything else to do
+void ir_simplify_cfg(void)
+{
+    while(ir_remove_unreachable_code() + ir_thread_jumps());
+}
+
+// liveness-based dead code elimination
+// removing an instruction can make the ones computing its operands dead too, so this goes until a fixpoint
+void ir_remove_dead_code(void)
+{
+    int removed = 1;
+
+    while(removed) {
+        removed = 0;
+        int start, end = 0;
+
+        while(ir_next_fn(end, &start, &end)) {
+            ir_cfg* cfg = ir_cfg_build(start, end);
+            ir_cfg_liveness(cfg);
+
+            // assignments to globals are always visible to someone,
+            // and so are assignments to vars whose address is taken
+            uint64_t* pinned = ir_cfg_exposed_vars(cfg);
+
+            for(int i = 0; i < cfg->blocks->n_values; i++)
+                removed += ir_block_remove_unused_assignments(cfg, cfg->blocks->values[i], pinned);
+
+            free(pinned);
+            ir_cfg_free(cfg);
+        }
+
+        ir_compact();
     }
 }
 
@@ -313,9 +623,9 @@ ir_value* ir_short_circuit(ast_expr* e)
     // after: (... other code)
 
     if(e->content.bin.op == O_LOGICAL_AND) {
-        char* l_evaluate_second = ir_autolabel();
-        char* l_after = ir_autolabel();
-        char* l_true = ir_autolabel();
+        int l_evaluate_second = ir_autolabel();
+        int l_after = ir_autolabel();
+        int l_true = ir_autolabel();
         ir_var* res = ir_temp(e->content.bin.type);
 
         ir_insn* res_equals_0 = calloc(1, sizeof(ir_insn));
@@ -383,7 +693,7 @@ ir_value* ir_short_circuit(ast_expr* e)
         // res = 0;
         // after: (... other code)
 
-        char* l_after = ir_autolabel();
+        int l_after = ir_autolabel();
         ir_var* res = ir_temp(e->content.bin.type);
 
         ir_insn* res_equals_1 = calloc(1, sizeof(ir_insn));
@@ -453,7 +763,7 @@ var_graph* ir_get_interference_graph(var_vector* vars, int start, int end)
         ir_insn* insn = ir->values[ip];
         
         if(ir_out) {
-            char s[128] = {0};
+            char s[256] = {0};
             ir_print_instr(ir->values[ip], s);
             FILE* ir_f = fopen(ir_out, "a");
             fprintf(ir_f, "%s", s);
@@ -531,10 +841,29 @@ var_graph* ir_get_interference_graph(var_vector* vars, int start, int end)
             case IR_DEREF_ASSIGN: {
                 int dst_pos = ir_find_var(vars, insn->content.assign_ref.dst);
                 int src_pos = ir_find_maybe_var(vars, insn->content.assign_ref.src);
+                int index_pos = insn->content.assign_ref.index ? ir_find_var(vars, insn->content.assign_ref.index) : -1;
                 if(life_start[dst_pos] == -1) life_start[dst_pos] = ip;
-                if(life_start[src_pos] == -1) life_start[src_pos] = ip;
+                if(src_pos != -1 && life_start[src_pos] == -1) life_start[src_pos] = ip;
+                if(index_pos != -1 && life_start[index_pos] == -1) life_start[index_pos] = ip;
                 life_end[dst_pos] = ip;
-                life_end[src_pos] = ip;
+                if(src_pos != -1) life_end[src_pos] = ip;
+                if(index_pos != -1) life_end[index_pos] = ip;
+            }
+            break;
+
+            // the result starts living together with the operands, so it never gets one of their registers
+            case IR_SELECT: {
+                int pos[4] = {
+                    ir_find_var(vars, insn->content.select.result),
+                    ir_find_maybe_var(vars, insn->content.select.cond),
+                    ir_find_maybe_var(vars, insn->content.select.if_true),
+                    ir_find_maybe_var(vars, insn->content.select.if_false)
+                };
+                for(int i = 0; i < 4; i++) {
+                    if(pos[i] == -1) continue;
+                    if(life_start[pos[i]] == -1) life_start[pos[i]] = ip;
+                    life_end[pos[i]] = ip;
+                }
             }
             break;
 
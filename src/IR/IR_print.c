@@ -1,13 +1,33 @@
 #include <IR/IR.h>
+#include <IR/IR_print.h>
 #include <stdio.h>
 #include <string.h>
 
+// the IR printed here can be read back with --from-ir, see IR_read.c
+// so everything the backend needs goes into it, like the types of the vars that aren't longs
+
+static char* type_names[] = { "void", "char", "uchar", "int", "uint", "long", "ulong" };
+
+void ir_print_type(type_info* type, char* ir_output)
+{
+    strcat(ir_output, type_names[type->base]);
+    for(int i = 0; i < type->ptr_layers; i++) strcat(ir_output, "*");
+}
+
+static int ir_print_is_long(type_info* type)
+{
+    return !type || (type->base == LONG_T && !type->ptr_layers);
+}
+
 void ir_print_var(ir_var* var, char* ir_output)
 {
     if(!var) return;
-    char buffer[64];
-    sprintf(buffer, "%s ", var->name);
-    strcat(ir_output, buffer);
+    strcat(ir_output, var->name);
+    if(!ir_print_is_long(var->type)) {
+        strcat(ir_output, ":");
+        ir_print_type(var->type, ir_output);
+    }
+    strcat(ir_output, " ");
 }
 
 void ir_print_value(ir_value* value, char* ir_output)
@@ -31,26 +51,82 @@ void ir_print_value(ir_value* value, char* ir_output)
     }
 }
 
+// the address of a load or store, (ptr + index * scale + disp) if anything was folded into it
+static void ir_print_address(ir_value* ptr, struct ir_ptr_stuff* addr, char* ir_output)
+{
+    char buffer[64];
+
+    if(!addr->index && !addr->disp) {
+        ir_print_value(ptr, ir_output);
+        return;
+    }
+
+    strcat(ir_output, "(");
+    ir_print_value(ptr, ir_output);
+    if(addr->index) {
+        strcat(ir_output, "+ ");
+        ir_print_var(addr->index, ir_output);
+        if(addr->scale != 1) {
+            sprintf(buffer, "* %d ", addr->scale);
+            strcat(ir_output, buffer);
+        }
+    }
+    if(addr->disp) {
+        sprintf(buffer, "%c %ld", addr->disp < 0 ? '-' : '+', addr->disp < 0 ? -addr->disp : addr->disp);
+        strcat(ir_output, buffer);
+    }
+    else ir_output[strlen(ir_output) - 1] = 0;
+    strcat(ir_output, ") ");
+}
+
+// the type of the value a load or store accesses, after the * unless it's a long
+static void ir_print_memory_type(type_info* type, char* ir_output)
+{
+    if(ir_print_is_long(type)) return;
+    strcat(ir_output, ":");
+    ir_print_type(type, ir_output);
+    strcat(ir_output, " ");
+}
+
+static void ir_print_args(vector_ir_value* args, char* ir_output)
+{
+    strcat(ir_output, "(");
+    for(int i = 0; args && i < args->n_values; i++) {
+        if(i) strcat(ir_output, ", ");
+        ir_print_value(args->values[i], ir_output);
+        ir_output[strlen(ir_output) - 1] = 0;
+    }
+    strcat(ir_output, ")\n");
+}
+
 void ir_print_op(ir_op op, char* ir_output)
 {
     char buffer[64];
     switch(op) {
         case IR_NO_OP:          sprintf(buffer, "(NO_OP)"); break;
-        case IR_MINUS:          sprintf(buffer, "-");       break;
-        case IR_LOGICAL_NOT:    sprintf(buffer, "!");       break;
-        case IR_BINARY_NOT:     sprintf(buffer, "~");       break;
+        case IR_MINUS:          sprintf(buffer, "- ");      break;
+        case IR_LOGICAL_NOT:    sprintf(buffer, "! ");      break;
+        case IR_BINARY_NOT:     sprintf(buffer, "~ ");      break;
         case IR_CAST:           sprintf(buffer, "(cast) "); break;
+        case IR_DEREFERENCE:    sprintf(buffer, "* ");      break;
+        case IR_REFERENCE:      sprintf(buffer, "& ");      break;
         case IR_ADD:            sprintf(buffer, "+ ");      break;
         case IR_SUBTRACT:       sprintf(buffer, "- ");      break;
         case IR_MULTIPLY:       sprintf(buffer, "* ");      break;
         case IR_DIVIDE:         sprintf(buffer, "/ ");      break;
+        case IR_MODULO:         sprintf(buffer, "%% ");     break;
+        case IR_LSHIFT:         sprintf(buffer, "<< ");     break;
+        case IR_RSHIFT:         sprintf(buffer, ">> ");     break;
         case IR_LESSER:         sprintf(buffer, "< ");      break;
         case IR_LESSER_EQUAL:   sprintf(buffer, "<= ");     break;
         case IR_GREATER:        sprintf(buffer, "> ");      break;
         case IR_GREATER_EQUAL:  sprintf(buffer, ">= ");     break;
         case IR_EQUAL:          sprintf(buffer, "== ");     break;
+        case IR_NOT_EQUAL:      sprintf(buffer, "!= ");     break;
         case IR_LOGICAL_AND:    sprintf(buffer, "&& ");     break;
         case IR_LOGICAL_OR:     sprintf(buffer, "|| ");     break;
+        case IR_BINARY_AND:     sprintf(buffer, "& ");      break;
+        case IR_BINARY_OR:      sprintf(buffer, "| ");      break;
         default:                sprintf(buffer, "?");       break;
     }
     strcat(ir_output, buffer);
@@ -60,14 +136,15 @@ void ir_print_instr(ir_insn* instr, char* ir_output)
 {
     if(!instr) goto unknown;
     char buffer[128];
+    // a label is on a line of its own when it's on a nop, and in front of the instruction otherwise
     if(instr->label) {
-        sprintf(buffer, "%s:\n", instr->label);
+        sprintf(buffer, instr->type == IR_NOP ? "%s:\n" : "%s: ", ir_label_name(instr->label));
         strcat(ir_output, buffer);
     }
 
     switch(instr->type) {
         case IR_NOP: 
-        if(!instr->label) goto unknown;
+        if(!instr->label) strcat(ir_output, "nop\n");
         break;
 
         case IR_UN:
@@ -95,15 +172,20 @@ void ir_print_instr(ir_insn* instr, char* ir_output)
         break;
 
         case IR_GOTO:
-        sprintf(buffer, "goto %s\n", instr->content.jmp.dst);
+        sprintf(buffer, "goto %s\n", ir_label_name(instr->content.jmp.dst));
         strcat(ir_output, buffer);
         break;
 
         case IR_IF:
         strcat(ir_output, "if ");
         ir_print_value(instr->content.condjmp.cond, ir_output);
-        sprintf(buffer, "goto %s\n", instr->content.condjmp.if_true);
+        sprintf(buffer, "goto %s", ir_label_name(instr->content.condjmp.if_true));
         strcat(ir_output, buffer);
+        if(instr->content.condjmp.if_false) {
+            sprintf(buffer, " else %s", ir_label_name(instr->content.condjmp.if_false));
+            strcat(ir_output, buffer);
+        }
+        strcat(ir_output, "\n");
         break;
 
         case IR_FN_CALL:
@@ -111,13 +193,15 @@ void ir_print_instr(ir_insn* instr, char* ir_output)
             ir_print_var(instr->content.fn_call.result, ir_output);
             strcat(ir_output, "= ");
         }
-        sprintf(buffer, "call %s\n", instr->content.fn_call.fn_label);
+        sprintf(buffer, "%scall %s", instr->content.fn_call.is_tail ? "tail " : "", instr->content.fn_call.fn_label);
         strcat(ir_output, buffer);
+        ir_print_args(instr->content.fn_call.args, ir_output);
         break;
 
         case IR_PROC_CALL:
-        sprintf(buffer, "call %s\n", instr->content.proc_call.fn_label);
+        sprintf(buffer, "%scall %s", instr->content.proc_call.is_tail ? "tail " : "", instr->content.proc_call.fn_label);
         strcat(ir_output, buffer);
+        ir_print_args(instr->content.proc_call.args, ir_output);
         break;
 
         case IR_RETURN:
@@ -136,19 +220,52 @@ void ir_print_instr(ir_insn* instr, char* ir_output)
         case IR_ASSIGN_DEREF:
         ir_print_var(instr->content.assign_deref.dst, ir_output);
         strcat(ir_output, "= *");
-        ir_print_value(instr->content.assign_deref.src, ir_output);
+        ir_print_memory_type(&instr->content.assign_deref.type, ir_output);
+        ir_print_address(instr->content.assign_deref.src, &instr->content.assign_deref, ir_output);
         strcat(ir_output, "\n");
         break;
 
-        case IR_DEREF_ASSIGN:
+        case IR_DEREF_ASSIGN:;
+        ir_value ptr = { .content.var = instr->content.deref_assign.dst, .type = IR_VAR };
         strcat(ir_output, "*");
-        ir_print_var(instr->content.deref_assign.dst, ir_output);
+        ir_print_memory_type(&instr->content.deref_assign.type, ir_output);
+        ir_print_address(&ptr, &instr->content.deref_assign, ir_output);
         strcat(ir_output, "= ");
         ir_print_value(instr->content.deref_assign.src, ir_output);
         strcat(ir_output, "\n");
         break;
 
+        case IR_SELECT:
+        ir_print_var(instr->content.select.result, ir_output);
+        strcat(ir_output, "= ");
+        ir_print_value(instr->content.select.cond, ir_output);
+        strcat(ir_output, "? ");
+        ir_print_value(instr->content.select.if_true, ir_output);
+        strcat(ir_output, ": ");
+        ir_print_value(instr->content.select.if_false, ir_output);
+        strcat(ir_output, "\n");
+        break;
+
         default: unknown:
-        strcat(ir_output, "(invalid instruction)");
+        strcat(ir_output, "(invalid instruction)\n");
+    }
+}
+
+// a line for every function, declared or defined, with the types and names of its parameters
+void ir_print_decls(FILE* f)
+{
+    for(int i = 0; i < program->n_values; i++) {
+        ast_fn* fn = program->values[i];
+        char decl[1024] = "declare ";
+        ir_print_type(fn->ret_type, decl);
+        sprintf(decl + strlen(decl), " fn.%s(", fn->name);
+        for(int p = 0; fn->params && p < fn->params->n_values; p++) {
+            ast_var* param = fn->params->values[p];
+            if(p) strcat(decl, ", ");
+            if(param->type) ir_print_type(param->type, decl);
+            else strcat(decl, "long");
+            sprintf(decl + strlen(decl), " %s", param->name);
+        }
+        fprintf(f, "%s)\n", decl);
     }
-}
\ No newline at end of file
+}
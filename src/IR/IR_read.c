@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <imperivm.h>
+#include <IR/IR.h>
+#include <frontend/parser.h>
+
+// reads the IR back from the text --ir writes, for --from-ir
+// so the optimizer and the backend can run on IR that never went through the frontend, handwritten or dumped
+// the file starts with a line for every function, like
+//   declare long fn.f(long a, int* b)
+// which is all the backend and the passes need of the AST, and then come the instructions, one per line,
+// in the format of ir_print_instr
+// the globals are the copies before the first function label, as they are in the IR itself
+
+static char* p; // where the current line is at
+static int line;
+static ast_fn* read_fn; // the function the instructions being read belong to
+
+static int* label_lines; // by label, the line it's defined on and otherwise minus the line of the first jump to it
+static int n_label_lines;
+
+static char* type_names[] = { "void", "char", "uchar", "int", "uint", "long", "ulong" };
+
+static void skip(void)
+{
+    while(*p == ' ' || *p == '\t') p++;
+}
+
+static int is_name_char(char c)
+{
+    return isalnum(c) || c == '_' || c == '.';
+}
+
+static int accept(char* s)
+{
+    skip();
+    if(strncmp(p, s, strlen(s))) return 0;
+    p += strlen(s);
+    return 1;
+}
+
+// like accept, but not if s is only the start of a name, the way return is of returned.l
+static int accept_word(char* s)
+{
+    skip();
+    if(strncmp(p, s, strlen(s)) || is_name_char(p[strlen(s)])) return 0;
+    p += strlen(s);
+    return 1;
+}
+
+static void expect(char* s)
+{
+    if(accept(s)) return;
+    char message[128];
+    snprintf(message, sizeof(message), "IR: expected %s", s);
+    report_error(line, message);
+}
+
+static char* read_name(void)
+{
+    skip();
+    char* start = p;
+    while(is_name_char(*p)) p++;
+    if(p == start) report_error(line, "IR: expected a name");
+    return strndup(start, p - start);
+}
+
+// the numbers in the names that were read are taken, so the passes have to name what they make past them
+// also used by IR_binary.c
+void ir_reserve_name(char* name)
+{
+    for(char* c = name; *c; c++) {
+        if(!isdigit(*c) || (c > name && isdigit(c[-1]))) continue;
+        int n = atoi(c);
+        if(c == name + 2 && strncmp(name, ".t", 2) == 0 && n >= n_temps) n_temps = n + 1;
+        if(c == name + 2 && strncmp(name, "L.", 2) == 0 && n >= n_labels) n_labels = n + 1;
+        if(n >= n_inlined) n_inlined = n + 1;
+    }
+}
+
+static type_info* read_type(void)
+{
+    skip();
+    int base = 0;
+    while(base < 7 && (strncmp(p, type_names[base], strlen(type_names[base])) ||
+          is_name_char(p[strlen(type_names[base])]))) base++;
+    if(base == 7) report_error(line, "IR: expected a type");
+    p += strlen(type_names[base]);
+    uint64_t ptr_layers = 0;
+    while(*p == '*') {
+        ptr_layers++;
+        p++;
+    }
+    return type_get(base, ptr_layers);
+}
+
+// a var is its name, and :type after it unless it's a long
+static ir_var* read_var(void)
+{
+    ir_var* var = malloc(sizeof(ir_var));
+    var->name = read_name();
+    ir_reserve_name(var->name);
+    if(*p == ':' && isalpha(p[1])) {
+        p++;
+        var->type = read_type();
+    }
+    else var->type = type_get(LONG_T, 0);
+    return var;
+}
+
+static ir_value* read_value(void)
+{
+    skip();
+    if(accept("(none)")) {
+        ir_value* value = calloc(1, sizeof(ir_value));
+        value->type = IR_NONE;
+        return value;
+    }
+    if(isdigit(*p) || (*p == '-' && isdigit(p[1]))) return ir_value_lit(strtoll(p, &p, 10));
+    return ir_value_var(read_var());
+}
+
+static int64_t read_number(void)
+{
+    skip();
+    if(!isdigit(*p)) report_error(line, "IR: expected a number");
+    return strtoll(p, &p, 10);
+}
+
+// (ptr + index * scale + disp) with any of the parts after ptr missing, or just ptr
+static ir_value* read_address(struct ir_ptr_stuff* addr)
+{
+    addr->scale = 1;
+    skip();
+    if(*p != '(') return read_value();
+    p++;
+    ir_value* ptr = read_value();
+    skip();
+    char* q = p + 1;
+    while(*q == ' ') q++;
+    if(*p == '+' && !isdigit(*q)) {
+        p++;
+        addr->index = read_var();
+        if(accept("*")) addr->scale = read_number();
+    }
+    if(accept("+")) addr->disp = read_number();
+    else if(accept("-")) addr->disp = -read_number();
+    expect(")");
+    return ptr;
+}
+
+// the type of the value in memory, after the * of a load or store
+static type_info read_memory_type(void)
+{
+    if(*p != ':') return (type_info) { LONG_T, 0 };
+    p++;
+    return *read_type();
+}
+
+static vector_ir_value* read_args(void)
+{
+    vector_ir_value* args = vector_ir_value_new();
+    expect("(");
+    if(accept(")")) return args;
+    do vector_ir_value_add(args, read_value()); while(accept(","));
+    expect(")");
+    return args;
+}
+
+static ast_fn* read_find_fn(char* label)
+{
+    for(int i = 0; i < program->n_values; i++)
+        if(strcmp(program->values[i]->name, label + 3) == 0) return program->values[i];
+    report_error(line, "IR: call to an undeclared function");
+}
+
+static int* read_label_line(int label)
+{
+    if(label >= n_label_lines) {
+        int n = 2 * label + 64;
+        label_lines = realloc(label_lines, n * sizeof(int));
+        memset(label_lines + n_label_lines, 0, (n - n_label_lines) * sizeof(int));
+        n_label_lines = n;
+    }
+    return &label_lines[label];
+}
+
+static void read_define_label(int label)
+{
+    int* at = read_label_line(label);
+    if(*at > 0) report_error(line, "IR: label defined twice");
+    *at = line;
+}
+
+// a jump target, the same text always gives the same label
+static int read_label(void)
+{
+    char* name = read_name();
+    ir_reserve_name(name);
+    int label = ir_named_label(name);
+    free(name);
+    int* at = read_label_line(label);
+    if(!*at) *at = -line;
+    return label;
+}
+
+static int read_call(ir_insn* insn, ir_var* result)
+{
+    int is_tail = accept("tail call ");
+    if(!is_tail && !accept("call ")) return 0;
+    char* label = read_name();
+    if(result) {
+        insn->type = IR_FN_CALL;
+        insn->content.fn_call.fn_label = label;
+        insn->content.fn_call.result = result;
+        insn->content.fn_call.ast_fn = read_find_fn(label);
+        insn->content.fn_call.args = read_args();
+        insn->content.fn_call.is_tail = is_tail;
+    }
+    else {
+        insn->type = IR_PROC_CALL;
+        read_find_fn(label);
+        insn->content.proc_call.fn_label = label;
+        insn->content.proc_call.args = read_args();
+        insn->content.proc_call.is_tail = is_tail;
+    }
+    return 1;
+}
+
+static ir_op read_un_op(void)
+{
+    static struct { char* s; ir_op op; } ops[] = {
+        { "(cast) ", IR_CAST }, { "- ", IR_MINUS }, { "! ", IR_LOGICAL_NOT }, { "~ ", IR_BINARY_NOT },
+        { "* ", IR_DEREFERENCE }, { "& ", IR_REFERENCE }
+    };
+    skip();
+    for(int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) if(accept(ops[i].s)) return ops[i].op;
+    return IR_NO_OP;
+}
+
+static ir_op read_bin_op(void)
+{
+    // the longer ones first, so that < doesn't take the start of <=
+    static struct { char* s; ir_op op; } ops[] = {
+        { "<<", IR_LSHIFT }, { ">>", IR_RSHIFT }, { "<=", IR_LESSER_EQUAL }, { ">=", IR_GREATER_EQUAL },
+        { "==", IR_EQUAL }, { "!=", IR_NOT_EQUAL }, { "&&", IR_LOGICAL_AND }, { "||", IR_LOGICAL_OR },
+        { "+", IR_ADD }, { "-", IR_SUBTRACT }, { "*", IR_MULTIPLY }, { "/", IR_DIVIDE }, { "%", IR_MODULO },
+        { "<", IR_LESSER }, { ">", IR_GREATER }, { "&", IR_BINARY_AND }, { "|", IR_BINARY_OR }
+    };
+    for(int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) if(accept(ops[i].s)) return ops[i].op;
+    report_error(line, "IR: expected an operator");
+}
+
+// everything of the form x = ...
+static void read_assignment(ir_insn* insn)
+{
+    ir_var* dst = read_var();
+    expect("=");
+    if(read_call(insn, dst)) return;
+
+    skip();
+    if(*p == '&' && p[1] != ' ') {
+        p++;
+        insn->type = IR_ASSIGN_REF;
+        insn->content.assign_ref.dst = dst;
+        insn->content.assign_ref.src = read_value();
+        insn->content.assign_ref.scale = 1;
+        return;
+    }
+    if(*p == '*' && p[1] != ' ') {
+        p++;
+        insn->type = IR_ASSIGN_DEREF;
+        insn->content.assign_deref.dst = dst;
+        insn->content.assign_deref.type = read_memory_type();
+        insn->content.assign_deref.src = read_address(&insn->content.assign_deref);
+        return;
+    }
+
+    ir_op op = read_un_op();
+    if(op != IR_NO_OP) {
+        insn->type = IR_UN;
+        insn->content.un.result = dst;
+        insn->content.un.op = op;
+        insn->content.un.operand = read_value();
+        insn->content.un.type = dst->type;
+        return;
+    }
+
+    ir_value* left = read_value();
+    skip();
+    if(!*p) {
+        insn->type = IR_COPY;
+        insn->content.copy.dst = dst;
+        insn->content.copy.src = left;
+    }
+    else if(accept("?")) {
+        insn->type = IR_SELECT;
+        insn->content.select.result = dst;
+        insn->content.select.cond = left;
+        insn->content.select.if_true = read_value();
+        expect(":");
+        insn->content.select.if_false = read_value();
+    }
+    else {
+        insn->type = IR_BIN;
+        insn->content.bin.result = dst;
+        insn->content.bin.left = left;
+        insn->content.bin.op = read_bin_op();
+        insn->content.bin.right = read_value();
+        insn->content.bin.type = dst->type;
+    }
+}
+
+// declare type fn.name(type param, ...)
+static void read_decl(void)
+{
+    ast_fn* fn = calloc(1, sizeof(ast_fn));
+    fn->ret_type = read_type();
+    char* label = read_name();
+    if(strncmp(label, "fn.", 3)) report_error(line, "IR: function names start with fn.");
+    fn->name = strdup(label + 3);
+    free(label);
+
+    fn->params = vector_ast_var_new();
+    vector_ir_var* params = vector_ir_var_new();
+    expect("(");
+    while(!accept(")")) {
+        if(fn->params->n_values) expect(",");
+        ast_var* param = calloc(1, sizeof(ast_var));
+        param->type = read_type();
+        param->name = read_name();
+        vector_ast_var_add(fn->params, param);
+
+        // the same as ir_create_param
+        ir_var* var = calloc(1, sizeof(ir_var));
+        var->name = malloc(strlen(fn->name) + strlen(param->name) + 4);
+        sprintf(var->name, "%s_%s.p", fn->name, param->name);
+        vector_ir_var_add(params, var);
+    }
+    vector_ast_fn_add(program, fn);
+    hashmap_ast_fn_vector_ir_var_add(fn_symtable, fn, params);
+}
+
+static void read_insn(void)
+{
+    skip();
+    if(!*p) return;
+    if(accept("declare ")) {
+        read_decl();
+        return;
+    }
+
+    ir_insn* insn = calloc(1, sizeof(ir_insn));
+    ir_insn* else_jump = 0;
+    char* end = p;
+    while(is_name_char(*end)) end++;
+    if(end > p && *end == ':' && (end[1] == ' ' || !end[1])) {
+        char* name = strndup(p, end - p);
+        ir_reserve_name(name);
+        p = end + 1;
+        if(strncmp(name, "fn.", 3) == 0) {
+            read_fn = read_find_fn(name);
+            insn->label = ir_fn_label(read_fn);
+        }
+        else insn->label = ir_named_label(name);
+        read_define_label(insn->label);
+        free(name);
+    }
+
+    skip();
+    if(!*p && insn->label) insn->type = IR_NOP;
+    else if(accept_word("nop")) insn->type = IR_NOP;
+    else if(accept("goto ")) {
+        insn->type = IR_GOTO;
+        insn->content.jmp.dst = read_label();
+    }
+    else if(accept("if ")) {
+        insn->type = IR_IF;
+        insn->content.condjmp.cond = read_value();
+        expect("goto");
+        insn->content.condjmp.if_true = read_label();
+        // nothing after the reader looks at if_false, so the else is a goto of its own
+        if(accept_word("else")) {
+            else_jump = calloc(1, sizeof(ir_insn));
+            else_jump->type = IR_GOTO;
+            else_jump->content.jmp.dst = read_label();
+        }
+    }
+    else if(accept_word("return")) {
+        if(!read_fn) report_error(line, "IR: return outside of a function");
+        insn->type = IR_RETURN;
+        insn->content.ret.fn = strdup(read_fn->name);
+        skip();
+        if(*p) insn->content.ret.value = read_value();
+    }
+    else if(read_call(insn, 0));
+    else if(*p == '*') {
+        p++;
+        insn->type = IR_DEREF_ASSIGN;
+        insn->content.deref_assign.type = read_memory_type();
+        ir_value* ptr = read_address(&insn->content.deref_assign);
+        if(ptr->type != IR_VAR) report_error(line, "IR: storing through something that isn't a var");
+        insn->content.deref_assign.dst = ptr->content.var;
+        expect("=");
+        insn->content.deref_assign.src = read_value();
+    }
+    else read_assignment(insn);
+
+    skip();
+    if(*p) report_error(line, "IR: unexpected text at the end of the line");
+    vector_ir_insn_add(ir, insn);
+    if(else_jump) vector_ir_insn_add(ir, else_jump);
+}
+
+void ir_read(char* src)
+{
+    ir = vector_ir_insn_new();
+    program = vector_ast_fn_new();
+    fn_symtable = hashmap_ast_fn_vector_ir_var_new();
+
+    for(line = 1; *src; line++) {
+        char* nl = strchr(src, '\n');
+        if(nl) *nl = 0;
+        p = src;
+        read_insn();
+        if(!nl) break;
+        src = nl + 1;
+    }
+
+    for(int i = 0; i < n_label_lines; i++)
+        if(label_lines[i] < 0) report_error(-label_lines[i], "IR: jump to a label that's never defined");
+    free(label_lines);
+    label_lines = 0;
+    n_label_lines = 0;
+}
@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+#include <IR/IR.h>
+#include <IR/IR_cfg.h>
+#include <IR/IR_optimize.h>
+#include <templates/vector.h>
+
+// if-conversion
+// a branch on data that doesn't follow a pattern is mispredicted about half of the time, which costs
+// far more than computing both sides, so an if whose arms are a few cheap instructions like
+//   if c goto T
+//   x = b
+//   goto A
+//   T:
+//   x = a
+//   A:
+// has both arms computed into temporaries, and a select picks the right one for every var they define
+//   x.e = b
+//   x.t = a
+//   x = c ? x.t : x.e
+// which the backend emits as a cmov
+// either arm can be empty, a missing side of a select is just the var's old value
+// the arms can't have side effects or anything that can fault, so there are no calls, loads, stores or divisions
+
+#define SELECT_MAX_ARM 16
+
+int select_limit = 3; // the most instructions an arm can have
+
+typedef struct {
+    ir_insn* insns[SELECT_MAX_ARM];
+    int n_insns;
+    ir_var* vars[SELECT_MAX_ARM]; // the vars the arm defines
+    ir_var* temps[SELECT_MAX_ARM]; // and what they're renamed to
+    int n_vars;
+} select_arm;
+
+static int select_same(ir_var* a, ir_var* b)
+{
+    return strcmp(a->name, b->name) == 0;
+}
+
+static int select_cheap(ir_insn* insn)
+{
+    if(insn->label) return 0;
+    switch(insn->type) {
+        case IR_COPY: return 1;
+        case IR_BIN: return insn->content.bin.op != IR_DIVIDE && insn->content.bin.op != IR_MODULO;
+        case IR_UN: return insn->content.un.op != IR_DEREFERENCE && insn->content.un.op != IR_REFERENCE;
+        default: return 0;
+    }
+}
+
+// collects the arm starting at ip, returns the index of the first instruction past it or -1
+static int select_collect(select_arm* arm, int ip, int end)
+{
+    for(; ip < end; ip++) {
+        ir_insn* insn = ir->values[ip];
+        if(insn->type == IR_NOP && !insn->label) continue;
+        if(!select_cheap(insn)) return ip;
+        if(arm->n_insns == select_limit || arm->n_insns == SELECT_MAX_ARM) return -1;
+        arm->insns[arm->n_insns++] = insn;
+    }
+    return -1;
+}
+
+static int select_refs(int label, int start, int end)
+{
+    int n = 0;
+    for(int i = start; i < end; i++) {
+        ir_insn* insn = ir->values[i];
+        if(insn->type == IR_GOTO && insn->content.jmp.dst == label) n++;
+        if(insn->type == IR_IF && insn->content.condjmp.if_true == label) n++;
+        if(insn->type == IR_IF && insn->content.condjmp.if_false == label) n++;
+    }
+    return n;
+}
+
+static void select_rename(select_arm* arm, ir_value** value)
+{
+    if((*value)->type != IR_VAR) return;
+    for(int i = 0; i < arm->n_vars; i++)
+        if(select_same(arm->vars[i], (*value)->content.var)) *value = ir_value_var(arm->temps[i]);
+}
+
+static ir_var* select_temp(select_arm* arm, ir_var* var)
+{
+    for(int i = 0; i < arm->n_vars; i++) if(select_same(arm->vars[i], var)) return arm->temps[i];
+    return 0;
+}
+
+// moves every def of the arm into a fresh temporary, with the uses after it following along
+static void select_rename_arm(select_arm* arm, vector_ir_insn* code)
+{
+    for(int i = 0; i < arm->n_insns; i++) {
+        ir_insn* insn = arm->insns[i];
+        if(insn->type == IR_COPY) select_rename(arm, &insn->content.copy.src);
+        if(insn->type == IR_UN) select_rename(arm, &insn->content.un.operand);
+        if(insn->type == IR_BIN) {
+            select_rename(arm, &insn->content.bin.left);
+            select_rename(arm, &insn->content.bin.right);
+        }
+
+        ir_var* def = ir_insn_def(insn);
+        ir_var* temp = ir_temp(def->type);
+        int j = 0;
+        while(j < arm->n_vars && !select_same(arm->vars[j], def)) j++;
+        if(j == arm->n_vars) arm->vars[arm->n_vars++] = def;
+        arm->temps[j] = temp;
+
+        if(insn->type == IR_COPY) insn->content.copy.dst = temp;
+        if(insn->type == IR_UN) insn->content.un.result = temp;
+        if(insn->type == IR_BIN) insn->content.bin.result = temp;
+        vector_ir_insn_add(code, insn);
+    }
+}
+
+static ir_insn* select_insn(ir_var* result, ir_value* cond, ir_var* if_true, ir_var* if_false)
+{
+    ir_insn* insn = calloc(1, sizeof(ir_insn));
+    insn->type = IR_SELECT;
+    insn->content.select.result = result;
+    insn->content.select.cond = cond;
+    insn->content.select.if_true = ir_value_var(if_true ? if_true : result);
+    insn->content.select.if_false = ir_value_var(if_false ? if_false : result);
+    return insn;
+}
+
+// tries the if at ip, returns the index of the join label if it got converted and -1 otherwise
+static int select_convert(vector_ir_insn* code, int ip, int start, int end)
+{
+    ir_insn* branch = ir->values[ip];
+    if(branch->type != IR_IF || branch->content.condjmp.if_false) return -1;
+    int label = branch->content.condjmp.if_true;
+
+    select_arm then = {0}, other = {0};
+    int join = select_collect(&other, ip + 1, end);
+    if(join == -1) return -1;
+    ir_insn* next = ir->values[join];
+
+    // if c goto T; else; T:, where T is the join
+    if(next->label == label);
+    // if c goto T; else; goto A; T: then; A:
+    else if(next->type == IR_GOTO && join + 1 < end && ir->values[join + 1]->label == label) {
+        int after = next->content.jmp.dst;
+        if(select_refs(label, start, end) != 1 || ir->values[join + 1]->type != IR_NOP) return -1;
+        join = select_collect(&then, join + 2, end);
+        if(join == -1 || ir->values[join]->label != after) return -1;
+    }
+    else return -1;
+    if(!then.n_insns && !other.n_insns) return -1;
+
+    // the selects would write the condition while it's still needed, and copying it out doesn't survive
+    // the copy propagation after this, so an if that assigns its own condition stays a branch
+    ir_value* cond = branch->content.condjmp.cond;
+    for(int i = 0; cond->type == IR_VAR && i < then.n_insns + other.n_insns; i++) {
+        ir_insn* insn = i < then.n_insns ? then.insns[i] : other.insns[i - then.n_insns];
+        if(select_same(ir_insn_def(insn), cond->content.var)) return -1;
+    }
+
+    if(branch->label) {
+        ir_insn* nop = calloc(1, sizeof(ir_insn));
+        nop->type = IR_NOP;
+        nop->label = branch->label;
+        vector_ir_insn_add(code, nop);
+    }
+    select_rename_arm(&then, code);
+    select_rename_arm(&other, code);
+    for(int i = 0; i < then.n_vars; i++)
+        vector_ir_insn_add(code, select_insn(then.vars[i], cond, then.temps[i], select_temp(&other, then.vars[i])));
+    for(int i = 0; i < other.n_vars; i++)
+        if(!select_temp(&then, other.vars[i])) vector_ir_insn_add(code, select_insn(other.vars[i], cond, 0, other.temps[i]));
+
+    return join;
+}
+
+void ir_convert_ifs(void)
+{
+    if(select_limit <= 0) return;
+    vector_ir_insn* code = vector_ir_insn_new();
+    int start, end = 0, prev = 0;
+
+    while(ir_next_fn(end, &start, &end)) {
+        for(int i = prev; i < start; i++) vector_ir_insn_add(code, ir->values[i]);
+        for(int ip = start; ip < end; ip++) {
+            int join = select_convert(code, ip, start, end);
+            if(join == -1) {
+                vector_ir_insn_add(code, ir->values[ip]);
+                continue;
+            }
+            // the join label stays where it was
+            ip = join - 1;
+        }
+        prev = end;
+    }
+    for(int i = prev; i < ir->n_values; i++) vector_ir_insn_add(code, ir->values[i]);
+
+    ir->n_values = 0;
+    for(int i = 0; i < code->n_values; i++) vector_ir_insn_add(ir, code->values[i]);
+    vector_ir_insn_free(code);
+}
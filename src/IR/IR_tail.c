@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <IR/IR.h>
+#include <IR/IR_cfg.h>
+#include <IR/IR_optimize.h>
+#include <templates/vector.h>
+
+// tail calls
+// a call whose result is returned right away, like
+//   t = call fn.f
+//   return t
+// doesn't need anything from the caller's frame once the arguments are set up
+// when f calls itself like that, the arguments are copied into its params and it jumps back to its start,
+// which turns the recursion into a loop the loop passes can then work on
+// a self call whose result only goes through an addition or a multiplication before it's returned,
+// as in return n * fact(n - 1), becomes a loop too: since those are associative, the other operand
+// is collected in an accumulator instead, and every other return applies the accumulator to its value
+// any other tail call is marked with is_tail, and the backend tears down the frame and jumps to the callee
+//
+// none of this is done in a function that takes the address of one of its own vars,
+// since reusing the frame would overwrite what the pointer points to
+
+typedef struct {
+    ast_fn* ast;
+    int label;
+    int entry; // the label right after the function's own one, which the self calls jump to
+    ir_var* acc; // null if no self call needs an accumulator
+    ir_op op;
+    type_info* type; // of the accumulator
+} tail_fn;
+
+static int tail_exposes_frame(int start, int end)
+{
+    for(int i = start; i < end; i++) {
+        ir_insn* insn = ir->values[i];
+        if(insn->type != IR_ASSIGN_REF || insn->content.assign_ref.src->type != IR_VAR) continue;
+        if(!ir_is_global(insn->content.assign_ref.src->content.var)) return 1;
+    }
+    return 0;
+}
+
+static int same_var(ir_value* value, ir_var* var)
+{
+    return value && value->type == IR_VAR && strcmp(value->content.var->name, var->name) == 0;
+}
+
+// whether the call at ip has its result returned right after it, either as it is or through result op x
+// sets *bin to the instruction applying x if there's one, and returns the index of the return
+static int tail_site(int ip, int end, ir_insn** bin)
+{
+    ir_insn* call = ir->values[ip];
+    *bin = 0;
+    if(ip + 1 >= end) return -1;
+    ir_insn* next = ir->values[ip + 1];
+
+    if(call->type == IR_PROC_CALL) return next->type == IR_RETURN && !next->content.ret.value ? ip + 1 : -1;
+    if(call->type != IR_FN_CALL || !call->content.fn_call.result) return -1;
+    ir_var* result = call->content.fn_call.result;
+
+    if(next->type == IR_BIN && !next->label && ip + 2 < end) {
+        ir_bin* b = &next->content.bin;
+        ir_value* x = same_var(b->left, result) ? b->right : same_var(b->right, result) ? b->left : 0;
+        // x can't change in the call, globals aside, since nothing has the address of a local
+        if((b->op == IR_ADD || b->op == IR_MULTIPLY) && x && !same_var(x, result) && (x->type == IR_LIT || !ir_is_global(x->content.var))) {
+            *bin = next;
+            result = b->result;
+            next = ir->values[ip + 2];
+        }
+    }
+
+    return next->type == IR_RETURN && same_var(next->content.ret.value, result) ? ip + (*bin ? 2 : 1) : -1;
+}
+
+static ir_insn* tail_insn(int type, int label)
+{
+    ir_insn* insn = calloc(1, sizeof(ir_insn));
+    insn->type = type;
+    insn->label = label;
+    return insn;
+}
+
+static ir_insn* tail_copy(ir_var* dst, ir_value* src)
+{
+    ir_insn* copy = tail_insn(IR_COPY, 0);
+    copy->content.copy.dst = dst;
+    copy->content.copy.src = src;
+    return copy;
+}
+
+static ir_insn* tail_acc(tail_fn* f, ir_var* result, ir_value* value)
+{
+    ir_insn* bin = tail_insn(IR_BIN, 0);
+    bin->content.bin.result = result;
+    bin->content.bin.left = ir_value_var(f->acc);
+    bin->content.bin.op = f->op;
+    bin->content.bin.right = value;
+    bin->content.bin.type = f->type;
+    return bin;
+}
+
+static ir_var* tail_param(ast_fn* ast, int i)
+{
+    ir_var* param = malloc(sizeof(ir_var));
+    param->name = malloc(strlen(ast->name) + strlen(ast->params->values[i]->name) + 4);
+    sprintf(param->name, "%s_%s.p", ast->name, ast->params->values[i]->name);
+    param->type = ast->params->values[i]->type;
+    return param;
+}
+
+// the self call at ip turns into acc = acc op x, the params getting the args, and a jump to the entry
+static void tail_loop(tail_fn* f, vector_ir_insn* code, ir_insn* call, ir_insn* bin)
+{
+    vector_ir_value* args = call->type == IR_FN_CALL ? call->content.fn_call.args : call->content.proc_call.args;
+    if(call->label) vector_ir_insn_add(code, tail_insn(IR_NOP, call->label));
+
+    if(bin) {
+        ir_bin* b = &bin->content.bin;
+        ir_value* x = same_var(b->left, call->content.fn_call.result) ? b->right : b->left;
+        vector_ir_insn_add(code, tail_acc(f, f->acc, x));
+    }
+
+    // the args can read the params, so with more than one they all go through temporaries first
+    ir_var* temps[args->n_values];
+    for(int i = 0; i < args->n_values && args->n_values > 1; i++) {
+        temps[i] = ir_temp(f->ast->params->values[i]->type);
+        vector_ir_insn_add(code, tail_copy(temps[i], args->values[i]));
+    }
+    for(int i = 0; i < args->n_values; i++)
+        vector_ir_insn_add(code, tail_copy(tail_param(f->ast, i), args->n_values == 1 ? args->values[i] : ir_value_var(temps[i])));
+
+    ir_insn* jmp = tail_insn(IR_GOTO, 0);
+    jmp->content.jmp.dst = f->entry;
+    vector_ir_insn_add(code, jmp);
+}
+
+// whether the call at ip is a self call that can become a jump, with the op it accumulates through
+static int tail_is_loop(tail_fn* f, int ip, int end, ir_insn** bin, int* ret)
+{
+    ir_insn* insn = ir->values[ip];
+    char* label = insn->type == IR_FN_CALL ? insn->content.fn_call.fn_label : insn->type == IR_PROC_CALL ? insn->content.proc_call.fn_label : 0;
+    if(!label || strcmp(label + 3, f->ast->name)) return 0; // go past `fn.`
+
+    vector_ir_value* args = insn->type == IR_FN_CALL ? insn->content.fn_call.args : insn->content.proc_call.args;
+    int n_params = f->ast->params ? f->ast->params->n_values : 0;
+    if(args->n_values != n_params) return 0;
+
+    *ret = tail_site(ip, end, bin);
+    if(*ret == -1) return 0;
+    return !*bin || !f->acc || (*bin)->content.bin.op == f->op;
+}
+
+static void tail_function(vector_ir_insn* code, int start, int end)
+{
+    tail_fn f = {0};
+    f.label = ir->values[start]->label;
+    f.ast = ir_label_fn(f.label);
+    int exposed = tail_exposes_frame(start, end);
+
+    // the accumulator takes the op of the first self call that needs one, and the self calls
+    // with a different op stay calls; a function whose every return is a self call never returns at all
+    int n_returns = 0, n_loops = 0;
+    for(int ip = start; ip < end && !exposed; ip++) {
+        ir_insn* bin;
+        int ret;
+        if(ir->values[ip]->type == IR_RETURN) n_returns++;
+        if(!tail_is_loop(&f, ip, end, &bin, &ret)) continue;
+        n_loops++;
+        if(!ir->values[ret]->label) n_returns--;
+        if(bin && !f.acc) {
+            f.op = bin->content.bin.op;
+            f.type = bin->content.bin.type;
+            f.acc = ir_temp(f.type);
+        }
+    }
+    if(!n_loops || n_returns <= 0) f.acc = 0;
+
+    // labels go on nops, the backend ends a block at every labeled instruction
+    ir_insn* first = ir->values[start];
+    if(n_loops && n_returns > 0) {
+        f.entry = ir_autolabel();
+        vector_ir_insn_add(code, tail_insn(IR_NOP, first->label));
+        if(f.acc) vector_ir_insn_add(code, tail_copy(f.acc, ir_value_lit(f.op == IR_ADD ? 0 : 1)));
+        vector_ir_insn_add(code, tail_insn(IR_NOP, f.entry));
+        first->label = 0;
+    }
+
+    for(int ip = start; ip < end; ip++) {
+        ir_insn* insn = ir->values[ip];
+        ir_insn* bin;
+        int ret;
+
+        if(f.entry && tail_is_loop(&f, ip, end, &bin, &ret)) {
+            tail_loop(&f, code, insn, bin);
+            // a labeled return is also reached from elsewhere, so it stays
+            ip = ir->values[ret]->label ? ret - 1 : ret;
+            continue;
+        }
+
+        if(insn->type == IR_RETURN && f.acc && insn->content.ret.value) {
+            // return acc op value
+            ir_var* result = ir_temp(f.type);
+            if(insn->label) vector_ir_insn_add(code, tail_insn(IR_NOP, insn->label));
+            vector_ir_insn_add(code, tail_acc(&f, result, insn->content.ret.value));
+            insn->label = 0;
+            insn->content.ret.value = ir_value_var(result);
+        }
+        else if(!exposed && !f.acc && (insn->type == IR_FN_CALL || insn->type == IR_PROC_CALL) && tail_site(ip, end, &bin) != -1 && !bin) {
+            // only the args passed in registers leave the caller's frame free to reuse
+            if(insn->type == IR_FN_CALL && insn->content.fn_call.args->n_values <= 6) insn->content.fn_call.is_tail = 1;
+            if(insn->type == IR_PROC_CALL && insn->content.proc_call.args->n_values <= 6) insn->content.proc_call.is_tail = 1;
+        }
+
+        vector_ir_insn_add(code, insn);
+    }
+}
+
+void ir_eliminate_tail_calls(void)
+{
+    vector_ir_insn* code = vector_ir_insn_new();
+    int start, end = 0, prev = 0;
+
+    while(ir_next_fn(end, &start, &end)) {
+        for(int i = prev; i < start; i++) vector_ir_insn_add(code, ir->values[i]);
+        tail_function(code, start, end);
+        prev = end;
+    }
+    for(int i = prev; i < ir->n_values; i++) vector_ir_insn_add(code, ir->values[i]);
+
+    ir->n_values = 0;
+    for(int i = 0; i < code->n_values; i++) vector_ir_insn_add(ir, code->values[i]);
+    vector_ir_insn_free(code);
+}
@@ -0,0 +1,632 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <IR/IR.h>
+#include <IR/IR_cfg.h>
+#include <IR/IR_optimize.h>
+#include <templates/vector.h>
+
+// value numbering
+// every value computed in a function gets a number, and two computations with the same operator,
+// the same operand numbers and the same type get the same number, so the second one can become a copy
+// of whichever var still holds the first one's result.
+// it starts as the textbook local version (one basic block at a time), and then carries the table
+// down the dominator tree, which makes it a global value numbering for everything that's safe to carry:
+// since the IR isn't in SSA form, a var only keeps its value number outside of the block that assigned it
+// if it's assigned exactly once in the whole function, that single definition dominates every block that
+// inherits the table, so its value can't have changed on the way there.
+// loads are numbered too, but every store and call starts a new memory epoch which makes the old loads unreachable.
+
+typedef struct {
+    int vn; // -1 if unknown
+    int block; // block in which vn was set
+    int epoch; // memory epoch in which vn was set, only matters for vars that memory writes can reach
+} vn_var;
+
+typedef struct {
+    int op;
+    int a;
+    int b;
+    int type;
+    int epoch;
+    int vn;
+    int next; // next entry in the same bucket, or -1
+} vn_expr;
+
+// the undo log names its slots by array and index rather than by address, since the per value arrays grow
+typedef enum { UNDO_VN, UNDO_BLOCK, UNDO_EPOCH, UNDO_HOLDER } vn_slot_kind;
+
+typedef struct {
+    vn_slot_kind kind;
+    int index;
+    int old;
+} vn_undo;
+
+static struct {
+    ir_cfg* cfg;
+    vn_var* vars; // indexed like cfg->vars
+    char* stable; // assigned once, not global and not address-taken, so valid across blocks
+    uint64_t* exposed; // global or address-taken, so stores and calls can change them behind our back
+
+    // per value number
+    int n_vns;
+    int vns_size;
+    int* holder; // index of a var holding this value, or -1
+    char* is_const;
+    int64_t* consts;
+
+    // the expression table is a stack of entries chained into buckets,
+    // entries are pushed onto their bucket's head so popping them restores the buckets exactly
+    int* buckets;
+    int n_buckets;
+    vn_expr* exprs;
+    int n_exprs;
+    int exprs_size;
+
+    vn_undo* undo;
+    int n_undo;
+    int undo_size;
+
+    int block;
+    int ip;
+    int epoch;
+    int n_epochs;
+    int changed;
+} vn;
+
+// literal "expressions" use this op, which doesn't clash with any ir_op
+#define VN_LIT -1
+
+static int* vn_slot(vn_slot_kind kind, int index)
+{
+    switch(kind) {
+        case UNDO_VN: return &vn.vars[index].vn;
+        case UNDO_BLOCK: return &vn.vars[index].block;
+        case UNDO_EPOCH: return &vn.vars[index].epoch;
+        default: return &vn.holder[index];
+    }
+}
+
+static void vn_set(vn_slot_kind kind, int index, int value)
+{
+    int* slot = vn_slot(kind, index);
+    if(*slot == value) return;
+    if(vn.n_undo == vn.undo_size) {
+        vn.undo_size = vn.undo_size ? vn.undo_size * 2 : 256;
+        vn.undo = realloc(vn.undo, vn.undo_size * sizeof(vn_undo));
+    }
+    vn.undo[vn.n_undo++] = (vn_undo) { kind, index, *slot };
+    *slot = value;
+}
+
+static int vn_new(void)
+{
+    if(vn.n_vns == vn.vns_size) {
+        vn.vns_size = vn.vns_size ? vn.vns_size * 2 : 256;
+        vn.holder = realloc(vn.holder, vn.vns_size * sizeof(int));
+        vn.is_const = realloc(vn.is_const, vn.vns_size);
+        vn.consts = realloc(vn.consts, vn.vns_size * sizeof(int64_t));
+    }
+    vn.holder[vn.n_vns] = -1;
+    vn.is_const[vn.n_vns] = 0;
+    return vn.n_vns++;
+}
+
+static uint32_t vn_hash(int op, int a, int b, int type, int epoch)
+{
+    uint32_t h = 2166136261u;
+    int key[5] = { op, a, b, type, epoch };
+    for(int i = 0; i < 5; i++) h = (h ^ (uint32_t) key[i]) * 16777619u;
+    return h & (vn.n_buckets - 1);
+}
+
+// returns the value number of the given expression, or -1 if it hasn't been seen yet
+static int vn_lookup(int op, int a, int b, int type, int epoch)
+{
+    for(int i = vn.buckets[vn_hash(op, a, b, type, epoch)]; i != -1; i = vn.exprs[i].next) {
+        vn_expr* e = &vn.exprs[i];
+        if(e->op == op && e->a == a && e->b == b && e->type == type && e->epoch == epoch) return e->vn;
+    }
+    return -1;
+}
+
+static void vn_insert(int op, int a, int b, int type, int epoch, int value)
+{
+    if(vn.n_exprs == vn.exprs_size) {
+        vn.exprs_size = vn.exprs_size ? vn.exprs_size * 2 : 256;
+        vn.exprs = realloc(vn.exprs, vn.exprs_size * sizeof(vn_expr));
+    }
+    uint32_t h = vn_hash(op, a, b, type, epoch);
+    vn.exprs[vn.n_exprs] = (vn_expr) { op, a, b, type, epoch, value, vn.buckets[h] };
+    vn.buckets[h] = vn.n_exprs++;
+}
+
+// restores the tables to how they were when the marks were taken
+static void vn_rollback(int undo_mark, int expr_mark)
+{
+    while(vn.n_undo > undo_mark) {
+        vn.n_undo--;
+        *vn_slot(vn.undo[vn.n_undo].kind, vn.undo[vn.n_undo].index) = vn.undo[vn.n_undo].old;
+    }
+    while(vn.n_exprs > expr_mark) {
+        vn.n_exprs--;
+        vn_expr* e = &vn.exprs[vn.n_exprs];
+        vn.buckets[vn_hash(e->op, e->a, e->b, e->type, e->epoch)] = e->next;
+    }
+}
+
+static int vn_lit(int64_t value)
+{
+    // the 64 bit literal is split across the two operand slots
+    int lo = (int) (uint32_t) value;
+    int hi = (int) (uint32_t) ((uint64_t) value >> 32);
+    int v = vn_lookup(VN_LIT, lo, hi, 0, 0);
+    if(v != -1) return v;
+
+    v = vn_new();
+    vn.is_const[v] = 1;
+    vn.consts[v] = value;
+    vn_insert(VN_LIT, lo, hi, 0, 0, v);
+    return v;
+}
+
+static int vn_type(ir_var* var)
+{
+    if(!var->type) return LONG_T; // parameters don't carry a type
+    return (int) var->type->ptr_layers * 16 + var->type->base;
+}
+
+// returns the value number the var currently holds, or -1 if it's unknown in this block
+static int vn_var_current(int x)
+{
+    vn_var* s = &vn.vars[x];
+    if(s->vn == -1) return -1;
+    if(!vn.stable[x] && s->block != vn.block) return -1;
+    if(bitset_test(vn.exposed, x) && s->epoch != vn.epoch) return -1;
+    return s->vn;
+}
+
+static void vn_assign(int x, int value)
+{
+    vn_set(UNDO_VN, x, value);
+    vn_set(UNDO_BLOCK, x, vn.block);
+    vn_set(UNDO_EPOCH, x, vn.epoch);
+
+    int h = vn.holder[value];
+    if(h == -1 || vn_var_current(h) != value) vn_set(UNDO_HOLDER, value, x);
+}
+
+static int vn_of_var(ir_var* var)
+{
+    int x = ir_cfg_var_index(vn.cfg, var);
+    int v = vn_var_current(x);
+    if(v != -1) return v;
+
+    // first read of a value that comes from outside of what we've seen, so it gets a fresh number
+    v = vn_new();
+    vn_assign(x, v);
+    return v;
+}
+
+static int vn_of(ir_value* value)
+{
+    if(value->type == IR_LIT) return vn_lit(value->content.lit.i);
+    return vn_of_var(value->content.var);
+}
+
+// returns a var that currently holds the given value number, or -1
+static int vn_holder(int value)
+{
+    int h = vn.holder[value];
+    if(h != -1 && vn_var_current(h) == value) return h;
+    return -1;
+}
+
+// replaces the operand with a literal or with the oldest var holding the same value
+static void vn_rewrite(ir_value** operand)
+{
+    if(!*operand || (*operand)->type != IR_VAR) return;
+
+    int x = ir_cfg_var_index(vn.cfg, (*operand)->content.var);
+    int v = vn_of_var((*operand)->content.var);
+
+    if(vn.is_const[v]) {
+        *operand = ir_value_lit(vn.consts[v]);
+        vn.changed = 1;
+        return;
+    }
+
+    int h = vn_holder(v);
+    if(h != -1 && h != x) {
+        *operand = ir_value_var(vn.cfg->vars->values[h]);
+        vn.changed = 1;
+    }
+}
+
+// same as above for the pointer in a store, which has to stay a var
+static void vn_rewrite_var(ir_var** operand)
+{
+    int x = ir_cfg_var_index(vn.cfg, *operand);
+    int h = vn_holder(vn_of_var(*operand));
+    if(h != -1 && h != x) {
+        *operand = vn.cfg->vars->values[h];
+        vn.changed = 1;
+    }
+}
+
+static int is_commutative(ir_op op)
+{
+    return op == IR_ADD || op == IR_MULTIPLY || op == IR_EQUAL || op == IR_NOT_EQUAL ||
+    op == IR_BINARY_AND || op == IR_BINARY_OR;
+}
+
+// returns the operator that gives the same result with swapped operands, or IR_NO_OP
+static ir_op swapped_op(ir_op op)
+{
+    if(is_commutative(op)) return op;
+    switch(op) {
+        case IR_LESSER: return IR_GREATER;
+        case IR_GREATER: return IR_LESSER;
+        case IR_LESSER_EQUAL: return IR_GREATER_EQUAL;
+        case IR_GREATER_EQUAL: return IR_LESSER_EQUAL;
+        default: return IR_NO_OP;
+    }
+}
+
+// evaluates the operator on constants, returns 0 if it can't be done at compile time
+static int fold_bin(ir_op op, int64_t a, int64_t b, int is_unsigned, int64_t* result)
+{
+    // wrap around like the hardware does instead of invoking undefined behavior
+    uint64_t ua = a, ub = b;
+    switch(op) {
+        case IR_ADD: *result = (int64_t) (ua + ub); return 1;
+        case IR_SUBTRACT: *result = (int64_t) (ua - ub); return 1;
+        case IR_MULTIPLY: *result = (int64_t) (ua * ub); return 1;
+        case IR_DIVIDE:
+        case IR_MODULO:
+        // leave the trap to the program
+        if(b == 0 || (!is_unsigned && a == INT64_MIN && b == -1)) return 0;
+        if(is_unsigned) *result = (int64_t) (op == IR_DIVIDE ? ua / ub : ua % ub);
+        else *result = op == IR_DIVIDE ? a / b : a % b;
+        return 1;
+        // the hardware only looks at the low 6 bits of the shift count
+        case IR_LSHIFT: *result = (int64_t) (ua << (ub & 63)); return 1;
+        case IR_RSHIFT:
+        if(is_unsigned) *result = (int64_t) (ua >> (ub & 63));
+        else *result = a < 0 ? ~(~a >> (ub & 63)) : a >> (ub & 63);
+        return 1;
+        case IR_LESSER: *result = a < b; return 1;
+        case IR_GREATER: *result = a > b; return 1;
+        case IR_LESSER_EQUAL: *result = a <= b; return 1;
+        case IR_GREATER_EQUAL: *result = a >= b; return 1;
+        case IR_EQUAL: *result = a == b; return 1;
+        case IR_NOT_EQUAL: *result = a != b; return 1;
+        case IR_BINARY_AND: *result = a & b; return 1;
+        case IR_BINARY_OR: *result = a | b; return 1;
+        default: return 0;
+    }
+}
+
+static int fold_un(ir_op op, int64_t a, int64_t* result)
+{
+    switch(op) {
+        case IR_MINUS: *result = (int64_t) -(uint64_t) a; return 1;
+        case IR_LOGICAL_NOT: *result = !a; return 1;
+        case IR_BINARY_NOT: *result = ~a; return 1;
+        default: return 0;
+    }
+}
+
+// turns the instruction into dst = src, keeping its label
+static void make_copy(ir_insn* insn, ir_var* dst, ir_value* src)
+{
+    insn->type = IR_COPY;
+    insn->content.copy.dst = dst;
+    insn->content.copy.src = src;
+    vn.changed = 1;
+}
+
+// returns 1 if the value is available as a literal or in some var
+static int vn_available(int value)
+{
+    return vn.is_const[value] || vn_holder(value) != -1;
+}
+
+// dst = value, where value is already available
+static void vn_reuse(ir_insn* insn, ir_var* dst, int value)
+{
+    int x = ir_cfg_var_index(vn.cfg, dst);
+    int h = vn_holder(value);
+
+    if(vn.is_const[value]) make_copy(insn, dst, ir_value_lit(vn.consts[value]));
+    else if(h != x) make_copy(insn, dst, ir_value_var(vn.cfg->vars->values[h]));
+    else {
+        // dst already holds it
+        if(insn->label) insn->type = IR_NOP;
+        else {
+            free(insn);
+            ir->values[vn.ip] = 0;
+        }
+        vn.changed = 1;
+    }
+    vn_assign(x, value);
+}
+
+static void vn_un(ir_insn* insn)
+{
+    ir_un* un = &insn->content.un;
+    int x = ir_cfg_var_index(vn.cfg, un->result);
+
+    // &x is about x itself, not about its value
+    if(un->op == IR_REFERENCE) {
+        vn_assign(x, vn_new());
+        return;
+    }
+
+    vn_rewrite(&un->operand);
+    int a = vn_of(un->operand);
+    int64_t folded;
+    if(vn.is_const[a] && fold_un(un->op, vn.consts[a], &folded)) {
+        folded = ir_canonical(un->result->type, folded);
+        make_copy(insn, un->result, ir_value_lit(folded));
+        vn_assign(x, vn_lit(folded));
+        return;
+    }
+
+    int type = vn_type(un->result);
+    int epoch = 0;
+    if(un->op == IR_DEREFERENCE) {
+        // a load into something narrower than what's in memory doesn't give the whole value
+        if(un->type && !ir_type_contains(un->result->type, un->type)) {
+            vn_assign(x, vn_new());
+            return;
+        }
+        // key the load by the pointer's type, that's what a store through the same pointer knows about
+        type = un->operand->type == IR_VAR ? vn_type(un->operand->content.var) : 0;
+        epoch = vn.epoch;
+    }
+
+    int v = vn_lookup(un->op, a, -1, type, epoch);
+    if(v != -1 && vn_available(v)) {
+        vn_reuse(insn, un->result, v);
+        return;
+    }
+    if(v == -1) {
+        v = vn_new();
+        vn_insert(un->op, a, -1, type, epoch, v);
+    }
+    vn_assign(x, v);
+}
+
+static void vn_bin(ir_insn* insn)
+{
+    ir_bin* bin = &insn->content.bin;
+    int x = ir_cfg_var_index(vn.cfg, bin->result);
+
+    vn_rewrite(&bin->left);
+    vn_rewrite(&bin->right);
+
+    // the backend prefers the literal on the right
+    if(bin->left->type == IR_LIT && bin->right->type == IR_VAR && swapped_op(bin->op) != IR_NO_OP) {
+        ir_value* tmp = bin->left;
+        bin->left = bin->right;
+        bin->right = tmp;
+        bin->op = swapped_op(bin->op);
+        vn.changed = 1;
+    }
+
+    int a = vn_of(bin->left);
+    int b = vn_of(bin->right);
+    int64_t folded;
+
+    if(vn.is_const[a] && vn.is_const[b] && fold_bin(bin->op, vn.consts[a], vn.consts[b], ir_is_unsigned(bin->type), &folded)) {
+        folded = ir_canonical(bin->result->type, folded);
+        make_copy(insn, bin->result, ir_value_lit(folded));
+        vn_assign(x, vn_lit(folded));
+        return;
+    }
+
+    // x + 0, x - 0, x << 0, x >> 0, x * 1 and x / 1 are just x, and x * 0 and x % 1 are 0
+    // unless x has to be truncated to fit the result, or no var holds x anymore
+    if(vn.is_const[b]) {
+        int64_t c = vn.consts[b];
+        int same = bin->left->type == IR_LIT || ir_type_contains(bin->result->type, bin->left->content.var->type);
+        if(same && vn_available(a) && ((c == 0 && (bin->op == IR_ADD || bin->op == IR_SUBTRACT || bin->op == IR_LSHIFT || bin->op == IR_RSHIFT)) ||
+        (c == 1 && (bin->op == IR_MULTIPLY || bin->op == IR_DIVIDE)))) {
+            vn_reuse(insn, bin->result, a);
+            return;
+        }
+        if((c == 0 && bin->op == IR_MULTIPLY) || (c == 1 && bin->op == IR_MODULO)) {
+            make_copy(insn, bin->result, ir_value_lit(0));
+            vn_assign(x, vn_lit(0));
+            return;
+        }
+    }
+
+    int ka = a, kb = b;
+    if(is_commutative(bin->op) && ka > kb) {
+        ka = b;
+        kb = a;
+    }
+
+    int type = vn_type(bin->result);
+    int v = vn_lookup(bin->op, ka, kb, type, 0);
+    if(v != -1 && vn_available(v)) {
+        vn_reuse(insn, bin->result, v);
+        return;
+    }
+    if(v == -1) {
+        v = vn_new();
+        vn_insert(bin->op, ka, kb, type, 0, v);
+    }
+    vn_assign(x, v);
+}
+
+// memory may have been written to, so loads and exposed vars can't be trusted anymore
+static void vn_clobber(void)
+{
+    vn.epoch = ++vn.n_epochs;
+}
+
+static void vn_insn(int ip)
+{
+    ir_insn* insn = ir->values[ip];
+    vn.ip = ip;
+
+    switch(insn->type) {
+        case IR_UN: vn_un(insn); break;
+        case IR_BIN: vn_bin(insn); break;
+
+        case IR_COPY: {
+            ir_copy* copy = &insn->content.copy;
+            int x = ir_cfg_var_index(vn.cfg, copy->dst);
+            vn_rewrite(&copy->src);
+
+            if(copy->src->type == IR_LIT) {
+                int64_t lit = ir_canonical(copy->dst->type, copy->src->content.lit.i);
+                if(lit != copy->src->content.lit.i) copy->src = ir_value_lit(lit);
+            }
+            // a copy into a narrower var truncates, so the value isn't the same anymore
+            else if(!ir_type_contains(copy->dst->type, copy->src->content.var->type)) {
+                vn_assign(x, vn_new());
+                break;
+            }
+            vn_assign(x, vn_of(copy->src));
+            break;
+        }
+
+        case IR_IF:
+        vn_rewrite(&insn->content.condjmp.cond);
+        if(insn->content.condjmp.cond->type != IR_LIT) break;
+        // the branch is decided at compile time, the cfg cleanup will take care of the dead side
+        if(insn->content.condjmp.cond->content.lit.i) {
+            int target = insn->content.condjmp.if_true;
+            insn->type = IR_GOTO;
+            insn->content.jmp.dst = target;
+        }
+        else if(insn->label) insn->type = IR_NOP;
+        else {
+            free(insn);
+            ir->values[ip] = 0;
+        }
+        vn.changed = 1;
+        break;
+
+        case IR_RETURN: vn_rewrite(&insn->content.ret.value); break;
+
+        case IR_FN_CALL:
+        for(int i = 0; i < insn->content.fn_call.args->n_values; i++)
+            vn_rewrite(&insn->content.fn_call.args->values[i]);
+        vn_clobber();
+        vn_assign(ir_cfg_var_index(vn.cfg, insn->content.fn_call.result), vn_new());
+        break;
+
+        case IR_PROC_CALL:
+        for(int i = 0; i < insn->content.proc_call.args->n_values; i++)
+            vn_rewrite(&insn->content.proc_call.args->values[i]);
+        vn_clobber();
+        break;
+
+        case IR_DEREF_ASSIGN: {
+            ir_deref_assign* store = &insn->content.deref_assign;
+            vn_rewrite_var(&store->dst);
+            vn_rewrite(&store->src);
+            int ptr = vn_of_var(store->dst);
+            int value = vn_of(store->src);
+            vn_clobber();
+            // a load through the same pointer right after this gets the stored value, if it fits in memory as it is
+            int fits = store->src->type == IR_LIT ? ir_canonical(&store->type, store->src->content.lit.i) == store->src->content.lit.i :
+            ir_type_contains(&store->type, store->src->content.var->type);
+            if(fits && !store->index && !store->disp) vn_insert(IR_DEREFERENCE, ptr, -1, vn_type(store->dst), vn.epoch, value);
+            break;
+        }
+
+        case IR_SELECT: {
+            ir_select* select = &insn->content.select;
+            vn_rewrite(&select->cond);
+            vn_rewrite(&select->if_true);
+            vn_rewrite(&select->if_false);
+            // a known condition or the same value on both sides leaves nothing to pick
+            if(select->cond->type == IR_LIT || vn_of(select->if_true) == vn_of(select->if_false)) {
+                int pick = select->cond->type != IR_LIT || select->cond->content.lit.i;
+                make_copy(insn, select->result, pick ? select->if_true : select->if_false);
+                vn_insn(ip);
+                break;
+            }
+            vn_assign(ir_cfg_var_index(vn.cfg, select->result), vn_new());
+            break;
+        }
+
+        case IR_ASSIGN_REF:
+        case IR_ASSIGN_DEREF:
+        vn_assign(ir_cfg_var_index(vn.cfg, ir_insn_def(insn)), vn_new());
+        break;
+
+        default: break;
+    }
+}
+
+// numbers the block and then everything it dominates, undoing its own entries on the way out
+static void vn_walk(int b)
+{
+    int undo_mark = vn.n_undo;
+    int expr_mark = vn.n_exprs;
+
+    vn.block = b;
+    vn_clobber(); // loads and exposed vars don't survive across blocks
+    ir_block* block = vn.cfg->blocks->values[b];
+    for(int ip = block->start; ip < block->end; ip++) if(ir->values[ip]) vn_insn(ip);
+
+    for(int i = 0; i < block->dom_children->n_values; i++) vn_walk(block->dom_children->values[i]);
+    vn_rollback(undo_mark, expr_mark);
+}
+
+static void vn_function(int start, int end)
+{
+    ir_cfg* cfg = ir_cfg_build(start, end);
+    ir_cfg_liveness(cfg); // for the var numbering
+    ir_cfg_dominators(cfg);
+    int n = cfg->vars->n_values;
+
+    vn.cfg = cfg;
+    vn.vars = malloc(n * sizeof(vn_var));
+    for(int i = 0; i < n; i++) vn.vars[i] = (vn_var) { -1, -1, -1 };
+    vn.exposed = ir_cfg_exposed_vars(cfg);
+    vn.stable = calloc(n, 1);
+
+    // count the definitions, parameters are defined once on entry
+    int* defs = calloc(n, sizeof(int));
+    for(int i = 0; i < n; i++) {
+        ir_var* var = cfg->vars->values[i];
+        if(var->name[strlen(var->name)-1] == 'p') defs[i]++;
+    }
+    for(int i = 0; i < end - start; i++) if(cfg->defs[i] != -1) defs[cfg->defs[i]]++;
+    for(int i = 0; i < n; i++) vn.stable[i] = defs[i] == 1 && !bitset_test(vn.exposed, i);
+
+    vn.n_buckets = 64;
+    while(vn.n_buckets < 4 * (end - start)) vn.n_buckets *= 2;
+    vn.buckets = malloc(vn.n_buckets * sizeof(int));
+    memset(vn.buckets, -1, vn.n_buckets * sizeof(int));
+    vn.n_vns = 0;
+    vn.n_exprs = 0;
+    vn.n_undo = 0;
+
+    vn_walk(0);
+
+    free(vn.buckets);
+    free(defs);
+    free(vn.stable);
+    free(vn.exposed);
+    free(vn.vars);
+    ir_cfg_free(cfg);
+}
+
+// returns 1 if anything was changed
+int ir_number_values(void)
+{
+    vn.changed = 0;
+    int start, end = 0;
+    while(ir_next_fn(end, &start, &end)) vn_function(start, end);
+    ir_compact();
+    return vn.changed;
+}
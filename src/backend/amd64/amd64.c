@@ -3,6 +3,7 @@
 #include <IR/IR.h>
 #include <IR/IR_print.h>
 #include <IR/IR_optimize.h>
+#include <IR/IR_cfg.h>
 #include <backend/amd64/amd64.h>
 #include <backend/amd64/amd64_asm.h>
 #include <templates/vector.h>
@@ -18,6 +19,10 @@ asm_vector* amd64_asm = 0;
 ir_var** reg_status = 0;
 stack_vector* stack_status = 0;
 ast_fn* amd64_current_fn = 0;
+int amd64_ip = 0; // the IR instruction being translated
+static char* exit_label = 0; // the current function's epilogue, which all of its returns jump to
+static int n_returns = 0;
+static int n_spilled = 0; // vars the last coloring had to take out of the graph
 
 void reset_graph(var_graph* g)
 {
@@ -47,9 +52,15 @@ int safe_coloring(var_graph* g, int node, int color)
     return 1;
 }
 
+// the search backtracks, which takes exponential time on a big block that just doesn't fit in n_colors
+// so it gives up after this many steps, and the caller then tries more colors or spills a var
+#define COLOR_STEPS 100000
+static int color_steps;
+
 int color_node(var_graph* g, int node, int n_colors)
 {
     if(node == g->nodes->n_values) return 1;
+    if(--color_steps < 0) return 0;
 
     for(int color = 0; color < n_colors; color++) {
         if(safe_coloring(g, node, color)) {
@@ -64,6 +75,7 @@ int color_node(var_graph* g, int node, int n_colors)
 
 int color_graph(var_graph* g, int n_colors)
 {
+    color_steps = COLOR_STEPS;
     return color_node(g, 0, n_colors);
 }
 
@@ -75,52 +87,61 @@ int color_graph(var_graph* g, int n_colors)
 // the callee saves RBX, RBP, R12, R13, R14 and R15
 // function/procedure calls pass the first six integer/ptr args through RDI, RSI, RDX, RCX, R8 and R9
 
-// if the graph is not N_REGS-colorable, this will mark vars for spilling so that it will be N_REGS-colorable
-// this function returns the final graph, where only the vars and colors are important
+// how many times each node is read or written in [start, end)
+static void count_uses(var_graph* g, int start, int end, int* uses)
+{
+    var_vector* vars = vector_ir_var_new();
+    memset(uses, 0, g->nodes->n_values * sizeof(int));
+
+    for(int ip = start; ip < end; ip++) {
+        vars->n_values = 0;
+        ir_insn_uses(ir->values[ip], vars);
+        ir_var* def = ir_insn_def(ir->values[ip]);
+        if(def) vector_ir_var_add(vars, def);
+
+        for(int i = 0; i < vars->n_values; i++)
+            for(int j = 0; j < g->nodes->n_values; j++)
+                if(strcmp(vars->values[i]->name, g->nodes->values[j]->name) == 0) uses[j]++;
+    }
+
+    vector_ir_var_free(vars);
+}
+
+// takes a node out of the graph, the var is then kept in memory
+static void remove_node(var_graph* g, int node)
+{
+    int n = g->nodes->n_values;
+    var_vector_remove(g->nodes, node);
+    free(g->matrix[node]);
+    memmove(&g->matrix[node], &g->matrix[node + 1], (n - node - 1) * sizeof(int*));
+    for(int i = 0; i < n - 1; i++) memmove(&g->matrix[i][node], &g->matrix[i][node + 1], (n - node - 1) * sizeof(int));
+}
+
+// if the graph is not N_REGS-colorable, this will take vars out of it so that it will be N_REGS-colorable
+// this modifies the graph in place, where only the vars and colors are important afterwards
 void amd64_color_registers(var_graph* g, int start, int end)
 {
     int i = 1;
+    n_spilled = 0;
     g->colors = malloc(g->nodes->n_values * sizeof(int));
-    for(reset_graph(g); !color_graph(g, i); i++, reset_graph(g));
+    for(reset_graph(g); i <= N_REGS - 3 && !color_graph(g, i); i++, reset_graph(g));
     if(i <= N_REGS - 3) return; 
 
     // I need to aim for N_REGS-3 to save RSP, RBP and another one (arbitrarily R15)
-    // remove variables from consideration for coloring by LFU
-
-    ir_output = malloc(65536);
-    for(int ip = start; ip < end; ip++) 
-        ir_print_instr(ir->values[ip], ir_output[strlen(ir_output)]);
-
-    var_graph* graph = g;
-
-    remove_one: {
-        int uses[g->nodes->n_values];
-        memset(uses, 0, graph->nodes->n_values * sizeof(int));
-        for(int i = 0; i < graph->nodes->n_values; i++) {    
-            char* current;
-            while((current = strstr(ir_output, graph->nodes->values[i]->name))) {
-                current++;
-                uses[i]++;
-            }
-        }
+    // remove variables from consideration for coloring by LFU, the least used one goes to memory
+    int* uses = malloc(g->nodes->n_values * sizeof(int));
+    count_uses(g, start, end, uses);
 
-        // now find the one with the least uses
-        uint32_t min = (uint32_t) -1;
+    do {
         int min_index = 0;
-        for(int i = 0; i < graph->nodes->n_values; i++) if(uses[i] < min) {
-            min = uses[i];
-            min_index = i;
-        }
-        var_vector_remove(graph->nodes, min_index);
-        var_graph* new_graph = graph_ir_var_new(graph->nodes);
-        for(int i = 0; i < graph->nodes->n_values; i++) free(graph->matrix[i]);
-        free(graph->matrix);
-        free(graph->colors);
-        free(graph);
-        graph = new_graph;
-    }
-
-    if(!color_graph(graph, N_REGS - 3)) goto remove_one;
+        for(int i = 1; i < g->nodes->n_values; i++) if(uses[i] < uses[min_index]) min_index = i;
+        memmove(&uses[min_index], &uses[min_index + 1], (g->nodes->n_values - min_index - 1) * sizeof(int));
+        remove_node(g, min_index);
+        n_spilled++;
+        reset_graph(g);
+    } while(!color_graph(g, N_REGS - 3));
+
+    free(uses);
 }
 
 void amd64_translate(var_graph* graph, int start, int end)
@@ -136,9 +157,10 @@ void amd64_translate(var_graph* graph, int start, int end)
 
     for(int ip = start; ip < end; ip++) {
         ir_insn* insn = ir->values[ip];
+        amd64_ip = ip;
 
         if(verbose_asm) {
-            char* s = calloc(1, 64);
+            char* s = calloc(1, 256);
             ir_print_instr(insn, s);
             printf("--- IR:\n%s\n", s);
             free(s);
@@ -146,16 +168,23 @@ void amd64_translate(var_graph* graph, int start, int end)
 
         if(insn->label) {
             spill_all();
-            amd64_label(insn->label);
-            if(strncmp(insn->label, "fn.", 3) == 0) {
-                amd64_current_fn = ir_get_ast_fn(insn->label);
+            ast_fn* fn = ir_label_fn(insn->label);
+            amd64_label(fn ? fn->name : ir_label_name(insn->label));
+            if(fn) {
+                amd64_current_fn = fn;
+                // the emitted code points at the name until it's written out, so the label table keeps it
+                char name[strlen(fn->name) + 8];
+                sprintf(name, ".L%s.ret", fn->name);
+                exit_label = ir_label_name(ir_named_label(name));
+                n_returns = 0;
+                amd64_stats_begin(ip);
                 amd64_prologue();
             }
         }
 
         switch(insn->type) {
             case IR_NOP:
-            asm_add("nop\n");
+            amd64_emit0("nop");
             break;
 
             case IR_UN:;
@@ -169,23 +198,8 @@ void amd64_translate(var_graph* graph, int start, int end)
             else amd64_un_mm(un);
             break;
 
-            case IR_BIN:;
-            ir_bin* bin = &insn->content.bin;
-
-            int _1 = has_reg(bin->result);
-            int _2 = bin->left->type == IR_VAR;
-            int _3 = bin->right->type == IR_VAR;
-            int _4 = _2 && has_reg(bin->left->content.var);
-            int _5 = _3 && has_reg(bin->right->content.var);
-
-            if(_1 && _4 && _5)       amd64_bin_rrr(bin);
-            else if(_1 && _4 && !_5) amd64_bin_rrm(bin);
-            else if(_1 && !_4 && _5) amd64_bin_rmr(bin);
-            else if(_1)              amd64_bin_rmm(bin);
-            else if(_4 && _5)        amd64_bin_mrr(bin);
-            else if(_4 && !_5)       amd64_bin_mrm(bin);
-            else if(!_4 && _5)       amd64_bin_mmr(bin);
-            else                     amd64_bin_mmm(bin);
+            case IR_BIN:
+            amd64_bin(&insn->content.bin);
             break;
 
             case IR_COPY:;
@@ -198,13 +212,21 @@ void amd64_translate(var_graph* graph, int start, int end)
             else amd64_copy_mm(copy);
             break;
 
+            case IR_ASSIGN_DEREF:
+            amd64_assign_deref(&insn->content.assign_deref);
+            break;
+
             case IR_DEREF_ASSIGN:
             amd64_deref_assign(&insn->content.deref_assign);
             break;
 
+            case IR_SELECT:
+            amd64_select(&insn->content.select);
+            break;
+
             case IR_GOTO:
             spill_all();
-            amd64_jmp(insn->content.jmp.dst);
+            amd64_jmp(ir_label_name(insn->content.jmp.dst));
             break;
 
             case IR_IF:
@@ -224,11 +246,10 @@ void amd64_translate(var_graph* graph, int start, int end)
             else if(v)
                 amd64_mov_rv(RAX, insn->content.ret.value);
             
-            // emit code for clearing the stack frame
-            amd64_epilogue();
-
-            // and internally clear the stack frame if this is the last return in the function
-            if(insn->content.ret.is_last) stackframe_clean();
+            // the code clearing the stack frame comes once, at the end of the function
+            // a return right before it falls through, the peephole pass removes the jump
+            amd64_jmp(exit_label);
+            n_returns++;
             break;
 
             case IR_FN_CALL:
@@ -243,6 +264,112 @@ void amd64_translate(var_graph* graph, int start, int end)
 
             default: asm_add("not implemented yet\n"); break;
         }
+
+        // emit the epilogue and lay out the stack frame once the whole function is translated
+        // a function that runs off its end returns there as well, main with 0
+        if(ip + 1 == ir->n_values || ir_is_fn_label(ir->values[ip + 1])) {
+            int falls_off = insn->type != IR_RETURN && insn->type != IR_GOTO;
+            if(falls_off) {
+                spill_globals();
+                if(strcmp(amd64_current_fn->name, "main") == 0) amd64_xor_rr(RAX);
+            }
+            if(n_returns || falls_off) {
+                amd64_label(exit_label);
+                amd64_epilogue();
+            }
+            // nothing in a register outlives the function, and the next one's label would spill it into this frame
+            memset(reg_status, 0, g->nodes->n_values * sizeof(ir_var*));
+            amd64_frame_end();
+        }
+    }
+
+    amd64_stats_block(graph, n_spilled);
+}
+
+void amd64_add(amd64_insn* insn)
+{
+    vector_amd64_insn_add(amd64_asm, insn);
+
+    if(verbose_asm) {
+        char buffer[128];
+        amd64_format(insn, buffer);
+        printf("%s", buffer);
+    }
+}
+
+static char* amd64_sized_reg_name(int reg, int size)
+{
+    if(size == 1) return amd64_reg8_name(reg);
+    if(size == 4) return amd64_reg32_name(reg);
+    return amd64_reg_name(reg);
+}
+
+static void amd64_format_arg(amd64_arg* arg, char* buffer)
+{
+    switch(arg->type) {
+        case AMD64_ARG_REG:
+        sprintf(buffer, "%%%s", amd64_sized_reg_name(arg->reg, arg->size));
+        break;
+
+        case AMD64_ARG_IMM:
+        sprintf(buffer, "$%ld", arg->imm);
+        break;
+
+        case AMD64_ARG_SYM:
+        sprintf(buffer, "%s", arg->sym);
+        break;
+
+        case AMD64_ARG_MEM:
+        if(arg->sym) {
+            sprintf(buffer, "%s(%%rip)", arg->sym);
+            break;
+        }
+        // --verbose-asm prints the instructions before their function's frame is laid out
+        if(arg->var) {
+            sprintf(buffer, "%s(%%rsp)", arg->var->name);
+            break;
+        }
+        buffer += arg->imm ? sprintf(buffer, "%ld", arg->imm) : 0;
+        if(arg->index == -1) sprintf(buffer, "(%%%s)", amd64_reg_name(arg->reg));
+        else sprintf(buffer, "(%%%s,%%%s,%d)", amd64_reg_name(arg->reg), amd64_reg_name(arg->index), arg->scale);
+        break;
+    }
+}
+
+// turns the record into a line of AT&T syntax assembly
+void amd64_format(amd64_insn* insn, char* buffer)
+{
+    switch(insn->type) {
+        case AMD64_INSN:
+        buffer += sprintf(buffer, "%s", insn->op);
+        for(int i = 0; i < insn->n_args; i++) {
+            buffer += sprintf(buffer, i ? ", " : " ");
+            amd64_format_arg(&insn->args[i], buffer);
+            buffer += strlen(buffer);
+        }
+        sprintf(buffer, "\n");
+        break;
+
+        case AMD64_LABEL:
+        sprintf(buffer, "%s:\n", insn->op);
+        break;
+
+        case AMD64_RAW:
+        sprintf(buffer, "%s", insn->op);
+        break;
+
+        case AMD64_DELETED:
+        buffer[0] = 0;
+        break;
+    }
+}
+
+void amd64_print(FILE* f)
+{
+    char buffer[256];
+    for(int i = 0; i < amd64_asm->n_values; i++) {
+        amd64_format(amd64_asm->values[i], buffer);
+        fprintf(f, "%s", buffer);
     }
 }
 
@@ -250,7 +377,7 @@ void amd64_global_vars(void)
 {
     ir_insn* insn = ir->values[0];
     int i = 0;
-    while(insn->type == IR_COPY) {
+    while(insn->type == IR_COPY && !ir_is_fn_label(insn)) {
         amd64_global_var(insn->content.copy.dst, insn->content.copy.src->content.lit.i);
         insn = ir->values[++i];
     }
@@ -259,7 +386,7 @@ void amd64_global_vars(void)
 
 void amd64_init(void)
 {
-    amd64_asm = vector_char_new();
+    amd64_asm = vector_amd64_insn_new();
     stack_status = vector_vector_ir_var_new();
     asm_add(".data\n");
     amd64_global_vars();
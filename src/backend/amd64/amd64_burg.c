@@ -0,0 +1,337 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// turns the instruction selection patterns in amd64_bin.rules into the tables amd64_bin() works from
+// usage: amd64_burg amd64_bin.rules amd64_bin_rules.h
+//
+// every rule becomes a cost function (its condition and cost) and an emit function (its action),
+// and every combination of its alternatives becomes an entry in the rule table
+// the rules are also listed by op, so the selector only looks at the ones that can match
+
+#define MAX_RULES 256
+#define MAX_ALTS 16
+
+typedef struct {
+    int line;
+    int is_chain;
+    char* ops[MAX_ALTS]; // empty for chain rules
+    int n_ops;
+    char left[MAX_ALTS]; // for a chain rule, what it starts from
+    int n_left;
+    char right[MAX_ALTS];
+    int n_right;
+    char to; // what a chain rule produces
+    char* cond; // 0 if there's none
+    char* cost;
+    char* action;
+    char* pattern;
+} burg_rule;
+
+static burg_rule rules[MAX_RULES];
+static int n_rules;
+static char* commutative[MAX_ALTS * 2];
+static int n_commutative;
+
+static char* src;
+static char* pos;
+static char* file_name;
+
+static int line_of(char* p)
+{
+    int line = 1;
+    for(char* c = src; c < p; c++) if(*c == '\n') line++;
+    return line;
+}
+
+static void __attribute__((noreturn)) error(char* p, char* message)
+{
+    fprintf(stderr, "%s:%d: %s\n", file_name, line_of(p), message);
+    exit(1);
+}
+
+// spaces and tabs only, a rule ends at the end of its line unless a bracket is still open
+static void skip_blank(void)
+{
+    while(*pos == ' ' || *pos == '\t') pos++;
+}
+
+static char* copy(char* start, char* end)
+{
+    char* s = malloc(end - start + 1);
+    if(!s) error(pos, "malloc failed");
+    memcpy(s, start, end - start);
+    s[end - start] = 0;
+    return s;
+}
+
+// copy() without the surrounding whitespace
+static char* copy_trimmed(char* start, char* end)
+{
+    while(start < end && isspace(*start)) start++;
+    while(end > start && isspace(end[-1])) end--;
+    return copy(start, end);
+}
+
+static char* read_ident(void)
+{
+    skip_blank();
+    char* start = pos;
+    while(isalnum(*pos) || *pos == '_') pos++;
+    if(pos == start) error(pos, "expected a name");
+    return copy(start, pos);
+}
+
+// everything between open and its matching close, which can span lines
+static char* read_balanced(char open, char close)
+{
+    skip_blank();
+    if(*pos != open) return 0;
+
+    char* start = ++pos;
+    int depth = 1;
+    for(; *pos; pos++) {
+        if(*pos == open) depth++;
+        else if(*pos == close && --depth == 0) break;
+    }
+    if(!*pos) error(start, "unterminated bracket");
+
+    return copy_trimmed(start, pos++);
+}
+
+static int is_nonterminal(char c)
+{
+    return c == 'r' || c == 'm' || c == 'i' || c == 'd';
+}
+
+// r|m|i
+static int read_nonterminals(char* alts)
+{
+    int n = 0;
+
+    do {
+        skip_blank();
+        if(!is_nonterminal(*pos)) error(pos, "expected one of r, m, i or d");
+        if(n == MAX_ALTS) error(pos, "too many alternatives");
+        alts[n++] = *pos++;
+        skip_blank();
+    } while(*pos == '|' && pos++);
+
+    return n;
+}
+
+static void read_rest(burg_rule* rule)
+{
+    rule->cond = read_balanced('[', ']');
+
+    skip_blank();
+    if(*pos == '(') rule->cost = read_balanced('(', ')');
+    else {
+        char* start = pos;
+        while(isdigit(*pos)) pos++;
+        if(pos == start) error(pos, "expected a cost");
+        rule->cost = copy(start, pos);
+    }
+
+    rule->action = read_balanced('{', '}');
+    if(!rule->action) error(pos, "expected an action");
+
+    skip_blank();
+    if(*pos && *pos != '\n' && *pos != '#') error(pos, "junk after the action");
+}
+
+static void read_rule(void)
+{
+    if(n_rules == MAX_RULES) error(pos, "too many rules");
+    burg_rule* rule = &rules[n_rules++];
+    char* start = pos;
+    rule->line = line_of(pos);
+
+    // d <- r|m
+    if(is_nonterminal(*pos) && !isalnum(pos[1]) && pos[1] != '_') {
+        rule->is_chain = 1;
+        rule->to = *pos++;
+        skip_blank();
+        if(strncmp(pos, "<-", 2)) error(pos, "expected <-");
+        pos += 2;
+        rule->n_left = read_nonterminals(rule->left);
+        for(int i = 0; i < rule->n_left; i++)
+            if(rule->left[i] == 'd' || rule->to != 'd') error(start, "chain rules can only produce d from r, m or i");
+        rule->pattern = copy_trimmed(start, pos);
+        read_rest(rule);
+        return;
+    }
+
+    // ADD|SUBTRACT(d, r|m)
+    do {
+        if(rule->n_ops == MAX_ALTS) error(pos, "too many alternatives");
+        rule->ops[rule->n_ops++] = read_ident();
+        skip_blank();
+    } while(*pos == '|' && pos++);
+
+    if(*pos++ != '(') error(pos - 1, "expected (");
+    rule->n_left = read_nonterminals(rule->left);
+    if(*pos++ != ',') error(pos - 1, "expected ,");
+    rule->n_right = read_nonterminals(rule->right);
+    if(*pos++ != ')') error(pos - 1, "expected )");
+
+    for(int i = 0; i < rule->n_right; i++)
+        if(rule->right[i] == 'd') error(start, "d can only be the left operand");
+
+    rule->pattern = copy_trimmed(start, pos);
+    read_rest(rule);
+}
+
+static void parse(void)
+{
+    for(pos = src; *pos;) {
+        while(isspace(*pos)) pos++;
+        if(!*pos) break;
+
+        if(*pos == '#') {
+            while(*pos && *pos != '\n') pos++;
+            continue;
+        }
+
+        if(*pos == '%') {
+            pos++;
+            if(strcmp(read_ident(), "commutative")) error(pos, "unknown directive");
+            for(skip_blank(); *pos && *pos != '\n'; skip_blank()) {
+                if(n_commutative == MAX_ALTS * 2) error(pos, "too many commutative ops");
+                commutative[n_commutative++] = read_ident();
+            }
+            continue;
+        }
+
+        read_rule();
+    }
+}
+
+static void emit_functions(FILE* f, burg_rule* rule, int n)
+{
+    fprintf(f, "// %s, line %d\n", rule->pattern, rule->line);
+    fprintf(f, "static int amd64_bin_cost_%d(AMD64_BIN_ARGS)\n{\n", n);
+    if(rule->cond) fprintf(f, "    if(!(%s)) return -1;\n", rule->cond);
+    fprintf(f, "    return %s;\n}\n\n", rule->cost);
+
+    fprintf(f, "static int amd64_bin_emit_%d(AMD64_BIN_ARGS)\n{\n", n);
+    fprintf(f, "    %s\n    return dst;\n}\n\n", rule->action);
+}
+
+static char* nonterminal_name(char c)
+{
+    switch(c) {
+        case 'r': return "AMD64_NT_R";
+        case 'm': return "AMD64_NT_M";
+        case 'i': return "AMD64_NT_I";
+        default:  return "AMD64_NT_D";
+    }
+}
+
+static void lower(char* dst, char* s)
+{
+    for(; *s; s++) *dst++ = tolower(*s);
+    *dst = 0;
+}
+
+static void emit(FILE* f)
+{
+    fprintf(f, "// generated by amd64_burg from %s, edit that instead\n\n", file_name);
+
+    for(int i = 0; i < n_rules; i++) emit_functions(f, &rules[i], i);
+
+    fprintf(f, "static amd64_chain_rule amd64_chain_rules[] = {\n");
+    for(int i = 0; i < n_rules; i++) {
+        if(!rules[i].is_chain) continue;
+        for(int l = 0; l < rules[i].n_left; l++)
+            fprintf(f, "    { %s, %s, amd64_bin_cost_%d, amd64_bin_emit_%d },\n", nonterminal_name(rules[i].to), nonterminal_name(rules[i].left[l]), i, i);
+    }
+    fprintf(f, "};\n\n#define AMD64_N_CHAIN_RULES (sizeof(amd64_chain_rules) / sizeof(amd64_chain_rules[0]))\n\n");
+
+    // one table entry for every op, left and right the rule stands for, in the order of the rules file
+    // so that the earlier one wins between two of the same cost
+    char* ops[MAX_RULES];
+    int n_ops = 0;
+    int n_entries = 0;
+    static char* entry_op[MAX_RULES * MAX_ALTS];
+
+    fprintf(f, "static amd64_bin_rule amd64_bin_rules[] = {\n");
+    for(int i = 0; i < n_rules; i++) {
+        burg_rule* rule = &rules[i];
+        for(int o = 0; o < rule->n_ops; o++) {
+            int seen = 0;
+            for(int j = 0; j < n_ops; j++) if(!strcmp(ops[j], rule->ops[o])) seen = 1;
+            if(!seen) ops[n_ops++] = rule->ops[o];
+
+            for(int l = 0; l < rule->n_left; l++) {
+                for(int r = 0; r < rule->n_right; r++) {
+                    if(n_entries == MAX_RULES * MAX_ALTS) error(src, "too many rules");
+                    fprintf(f, "    { IR_%s, %s, %s, amd64_bin_cost_%d, amd64_bin_emit_%d, \"%s\" },\n", rule->ops[o],
+                            nonterminal_name(rule->left[l]), nonterminal_name(rule->right[r]), i, i, rule->pattern);
+                    entry_op[n_entries++] = rule->ops[o];
+                }
+            }
+        }
+    }
+    fprintf(f, "};\n\n");
+
+    // the rules for each op, terminated by -1
+    char name[256];
+    for(int o = 0; o < n_ops; o++) {
+        lower(name, ops[o]);
+        fprintf(f, "static int amd64_bin_rules_%s[] = {", name);
+        for(int e = 0; e < n_entries; e++) if(!strcmp(entry_op[e], ops[o])) fprintf(f, " %d,", e);
+        fprintf(f, " -1 };\n");
+    }
+    fprintf(f, "static int amd64_bin_rules_none[] = { -1 };\n\n");
+
+    fprintf(f, "static int* amd64_bin_rules_for(ir_op op)\n{\n    switch(op) {\n");
+    for(int o = 0; o < n_ops; o++) {
+        lower(name, ops[o]);
+        fprintf(f, "        case IR_%s: return amd64_bin_rules_%s;\n", ops[o], name);
+    }
+    fprintf(f, "        default: return amd64_bin_rules_none;\n    }\n}\n\n");
+
+    fprintf(f, "static int amd64_bin_commutative(ir_op op)\n{\n    switch(op) {\n");
+    for(int i = 0; i < n_commutative; i++) fprintf(f, "        case IR_%s:\n", commutative[i]);
+    fprintf(f, "        return 1;\n        default: return 0;\n    }\n}\n");
+
+}
+
+int main(int argc, char** argv)
+{
+    if(argc != 3) {
+        fprintf(stderr, "usage: amd64_burg rules output\n");
+        return 1;
+    }
+
+    file_name = argv[1];
+    FILE* in = fopen(argv[1], "r");
+    if(!in) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    rewind(in);
+    src = calloc(1, size + 1);
+    if(!src || fread(src, 1, size, in) != size) {
+        fprintf(stderr, "%s: read failed\n", argv[1]);
+        return 1;
+    }
+    fclose(in);
+
+    parse();
+
+    FILE* out = fopen(argv[2], "w");
+    if(!out) {
+        perror(argv[2]);
+        return 1;
+    }
+    emit(out);
+    fclose(out);
+
+    return 0;
+}
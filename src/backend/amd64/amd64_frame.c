@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <IR/IR.h>
+#include <IR/IR_cfg.h>
+#include <backend/amd64/amd64.h>
+#include <backend/amd64/amd64_asm.h>
+#include <util/bitset.h>
+
+// stack frame layout
+// a variable only gets a slot once an instruction actually reads or writes it in memory,
+// so the temporaries that stay in a register from their definition to their last use take up no space,
+// and spills of values nothing reads anymore are skipped altogether
+// slots are shared between variables that are never live at the same time, going by liveness over the
+// whole function, so the frame can only be laid out once the function has been translated
+// until then memory operands on the frame refer to their variable, and their displacements,
+// along with the size of the frame in the prologue and epilogues, are patched in at the end
+
+typedef struct {
+    int var; // index in cfg->vars
+    int first; // the instructions over which the var's slot holds a value that may still be read, inclusive
+    int last;
+} frame_range;
+
+typedef struct {
+    int size;
+    int last; // the last instruction any of its vars is live at
+    vector_int* vars;
+} frame_slot;
+
+ptr_vector(frame_slot);
+
+static struct {
+    ir_cfg* cfg;
+    frame_range* ranges; // sorted by var, then by first
+    int n_ranges;
+    int max_ranges;
+    int* var_ranges; // where each var's ranges begin, with one more entry for the end of the last one
+    uint64_t* exposed; // globals and vars whose address is taken, their memory can be read at any time
+    var_vector* vars; // the vars referenced in memory, in the order they first were
+    uint64_t* referenced;
+    int asm_start; // the function's first record in amd64_asm
+    vector_amd64_insn* adjusts; // the instructions allocating and freeing the frame
+    char* fn;
+} frame;
+
+// for --stats, the frame size of every function with a slot for each of its vars and with the slots shared
+typedef struct {
+    char* fn;
+    int unshared;
+    int size;
+    int slots;
+    int vars;
+} frame_stat;
+
+static frame_stat* frame_stats = 0;
+static int n_frame_stats = 0;
+
+static void frame_add_range(int var, int first, int last)
+{
+    if(frame.n_ranges == frame.max_ranges) {
+        frame.max_ranges = frame.max_ranges ? frame.max_ranges * 2 : 64;
+        frame.ranges = realloc(frame.ranges, frame.max_ranges * sizeof(frame_range));
+    }
+    frame.ranges[frame.n_ranges++] = (frame_range) { var, first, last };
+}
+
+static int frame_range_cmp(const void* a, const void* b)
+{
+    const frame_range* x = a;
+    const frame_range* y = b;
+    if(x->var != y->var) return x->var - y->var;
+    return x->first - y->first;
+}
+
+// walks each block backwards from its live_out, the way ir_cfg_liveness would for a single instruction,
+// and records the stretches over which each var is live
+// a var is in its slot's way wherever it's live before or after an instruction, and a value that's written
+// but never read still takes the slot for the instruction writing it
+static void frame_liveness(void)
+{
+    ir_cfg* cfg = frame.cfg;
+    int n_vars = cfg->vars->n_values;
+    int* open = malloc((n_vars ? n_vars : 1) * sizeof(int)); // where the var's current range ends, -1 if there's none
+    for(int i = 0; i < n_vars; i++) open[i] = -1;
+    vector_int* live = vector_int_new(); // the vars with an open range, possibly closed since
+
+    for(int b = 0; b < cfg->blocks->n_values; b++) {
+        ir_block* block = cfg->blocks->values[b];
+        for(int w = 0; w < cfg->n_words; w++) {
+            for(uint64_t bits = block->live_out[w]; bits; bits &= bits - 1) {
+                int v = w * 64 + __builtin_ctzll(bits);
+                open[v] = block->end - 1;
+                vector_int_add(live, v);
+            }
+        }
+
+        for(int ip = block->end - 1; ip >= block->start; ip--) {
+            int def = ir_cfg_def(cfg, ip);
+            if(def != -1) {
+                frame_add_range(def, ip, open[def] == -1 ? ip : open[def]);
+                open[def] = -1;
+            }
+
+            for(int* u = ir_cfg_uses_begin(cfg, ip); u < ir_cfg_uses_end(cfg, ip); u++) {
+                int v = *u;
+                if(open[v] != -1) continue;
+                open[v] = ip;
+                vector_int_add(live, v);
+            }
+        }
+
+        for(int i = 0; i < live->n_values; i++) {
+            int v = live->values[i];
+            if(open[v] != -1) frame_add_range(v, block->start, open[v]);
+            open[v] = -1;
+        }
+        live->n_values = 0;
+    }
+
+    // a var read and written by the first instruction of a block gets two ranges starting there,
+    // so the ones that overlap or touch are merged to keep them apart for the binary search
+    qsort(frame.ranges, frame.n_ranges, sizeof(frame_range), frame_range_cmp);
+    int n = 0;
+    for(int i = 0; i < frame.n_ranges; i++) {
+        frame_range* prev = n ? &frame.ranges[n - 1] : 0;
+        frame_range* r = &frame.ranges[i];
+        if(prev && prev->var == r->var && r->first <= prev->last + 1) {
+            if(r->last > prev->last) prev->last = r->last;
+        }
+        else frame.ranges[n++] = *r;
+    }
+    frame.n_ranges = n;
+
+    frame.var_ranges = calloc(n_vars + 1, sizeof(int));
+    for(int i = 0; i < frame.n_ranges; i++) frame.var_ranges[frame.ranges[i].var + 1]++;
+    for(int v = 0; v < n_vars; v++) frame.var_ranges[v + 1] += frame.var_ranges[v];
+
+    free(open);
+    vector_int_free(live);
+}
+
+// whether the var at cfg index v is live before or after the instruction at ip
+static int frame_occupied(int v, int ip)
+{
+    int low = frame.var_ranges[v];
+    int high = frame.var_ranges[v + 1] - 1;
+    if(low > high) return 0;
+
+    // the last range that starts at or before ip
+    while(low < high) {
+        int mid = (low + high + 1) / 2;
+        if(frame.ranges[mid].first <= ip) low = mid;
+        else high = mid - 1;
+    }
+    return frame.ranges[low].first <= ip && ip <= frame.ranges[low].last;
+}
+
+// whether two vars are ever live at the same time, both their ranges are sorted
+static int frame_interfere(int a, int b)
+{
+    int i = frame.var_ranges[a], j = frame.var_ranges[b];
+    while(i < frame.var_ranges[a + 1] && j < frame.var_ranges[b + 1]) {
+        frame_range* x = &frame.ranges[i];
+        frame_range* y = &frame.ranges[j];
+        if(x->first <= y->last && y->first <= x->last) return 1;
+        if(x->last < y->last) i++;
+        else j++;
+    }
+    return 0;
+}
+
+// vars whose slot can't be shared, since their memory may be read when they're not live
+static int frame_pinned(ir_var* var)
+{
+    int v = ir_cfg_var_index(frame.cfg, var);
+    return v == -1 || bitset_test(frame.exposed, v);
+}
+
+// the position of a param passed on the stack, or -1 for everything else
+static int frame_stack_param(ir_var* var)
+{
+    if(!is_arg(var)) return -1;
+    var_vector* params = symtable_get();
+    for(int i = 6; i < params->n_values; i++)
+        if(strcmp(params->values[i]->name, var->name) == 0) return i - 6;
+    return -1;
+}
+
+// params always take 8 bytes, they come in full registers
+static int frame_var_size(ir_var* var)
+{
+    return is_arg(var) ? 8 : ir_type_size(var->type);
+}
+
+// called at the function's label, before its prologue
+void amd64_frame_begin(int start)
+{
+    if(frame.cfg) amd64_frame_end();
+
+    int fn_start, fn_end;
+    ir_next_fn(start, &fn_start, &fn_end);
+    frame.cfg = ir_cfg_build(fn_start, fn_end);
+    ir_cfg_liveness(frame.cfg);
+    frame.exposed = ir_cfg_exposed_vars(frame.cfg);
+    frame.n_ranges = 0;
+    frame_liveness();
+
+    frame.vars = vector_ir_var_new();
+    frame.referenced = bitset_new(frame.cfg->n_words);
+    frame.asm_start = amd64_asm->n_values;
+    frame.adjusts = vector_amd64_insn_new();
+    frame.fn = amd64_current_fn->name;
+}
+
+// whether the value of var in memory may still be read after the instruction being translated
+int amd64_frame_live(ir_var* var)
+{
+    if(is_global(var) || !frame.cfg || frame_pinned(var)) return 1;
+    return frame_occupied(ir_cfg_var_index(frame.cfg, var), amd64_ip);
+}
+
+// the memory operand for var on the stack frame, which gets its displacement at the end of the function
+amd64_arg amd64_frame_slot(ir_var* var)
+{
+    int v = ir_cfg_var_index(frame.cfg, var);
+    int seen = 0;
+    if(v != -1) {
+        seen = bitset_test(frame.referenced, v);
+        bitset_set(frame.referenced, v);
+    }
+    else for(int i = 0; i < frame.vars->n_values; i++) if(strcmp(frame.vars->values[i]->name, var->name) == 0) seen = 1;
+    if(!seen) vector_ir_var_add(frame.vars, var);
+
+    amd64_arg arg = amd64_arg_ind(RSP, 0);
+    arg.var = var;
+    return arg;
+}
+
+// subq or addq of the frame size to RSP
+void amd64_frame_adjust(char* op)
+{
+    amd64_emit2(op, amd64_arg_imm(0), amd64_arg_reg(RSP));
+    vector_amd64_insn_add(frame.adjusts, amd64_asm->values[amd64_asm->n_values - 1]);
+}
+
+static int frame_first(ir_var* var)
+{
+    int v = ir_cfg_var_index(frame.cfg, var);
+    if(v == -1 || frame.var_ranges[v] == frame.var_ranges[v + 1]) return -1;
+    return frame.ranges[frame.var_ranges[v]].first;
+}
+
+static int frame_var_cmp(const void* a, const void* b)
+{
+    return frame_first(*(ir_var**) a) - frame_first(*(ir_var**) b);
+}
+
+static int frame_find(ir_var* var)
+{
+    for(int i = 0; i < frame.vars->n_values; i++)
+        if(strcmp(frame.vars->values[i]->name, var->name) == 0) return i;
+    return -1;
+}
+
+// gives every var referenced in memory a slot, first fit among the slots of its size
+// the vars go in the order their live ranges begin, so most of them fit in a slot whose previous tenants
+// are done with it without looking at the ranges at all
+// the slots are then packed the widest first, so that each one ends up aligned to its size
+void amd64_frame_end(void)
+{
+    if(!frame.cfg) return;
+
+    var_vector* vars = frame.vars;
+    qsort(vars->values, vars->n_values, sizeof(ir_var*), frame_var_cmp);
+
+    vector_frame_slot* slots = vector_frame_slot_new();
+    int slot_of[vars->n_values ? vars->n_values : 1];
+
+    for(int i = 0; i < vars->n_values; i++) {
+        ir_var* var = vars->values[i];
+        slot_of[i] = -1;
+        if(frame_stack_param(var) != -1) continue;
+
+        int size = frame_var_size(var);
+        int pinned = frame_pinned(var);
+        int v = pinned ? -1 : ir_cfg_var_index(frame.cfg, var);
+
+        for(int s = 0; s < slots->n_values && !pinned && slot_of[i] == -1; s++) {
+            frame_slot* slot = slots->values[s];
+            if(slot->size != size || slot->last == -2) continue;
+
+            int fits = frame_first(var) > slot->last;
+            if(!fits) {
+                fits = 1;
+                for(int j = 0; j < slot->vars->n_values && fits; j++)
+                    if(frame_interfere(v, slot->vars->values[j])) fits = 0;
+            }
+            if(fits) slot_of[i] = s;
+        }
+
+        if(slot_of[i] == -1) {
+            frame_slot* slot = calloc(1, sizeof(frame_slot));
+            slot->size = size;
+            slot->last = -1;
+            slot->vars = vector_int_new();
+            vector_frame_slot_add(slots, slot);
+            slot_of[i] = slots->n_values - 1;
+        }
+
+        frame_slot* slot = slots->values[slot_of[i]];
+        if(pinned) slot->last = -2; // nothing else goes in there
+        else {
+            vector_int_add(slot->vars, v);
+            if(frame.var_ranges[v] != frame.var_ranges[v + 1]) {
+                int last = frame.ranges[frame.var_ranges[v + 1] - 1].last;
+                if(last > slot->last) slot->last = last;
+            }
+        }
+    }
+
+    int offsets[slots->n_values ? slots->n_values : 1];
+    int offset = 0;
+    for(int size = 8; size; size /= 2) {
+        for(int s = 0; s < slots->n_values; s++) {
+            if(slots->values[s]->size != size) continue;
+            offsets[s] = offset;
+            offset += size;
+        }
+    }
+
+    // RSP is 8 bytes off alignment after the call pushed the return address, and pushing the six saved
+    // registers keeps it that way, so the frame has to be 8 more than a multiple of 16
+    int size = ((offset + 7) & ~15) | 8;
+
+    // the stack arguments are above the saved registers and the return address, the first one lowest
+    for(int i = frame.asm_start; i < amd64_asm->n_values; i++) {
+        amd64_insn* insn = amd64_asm->values[i];
+        for(int a = 0; a < insn->n_args; a++) {
+            amd64_arg* arg = &insn->args[a];
+            if(!arg->var) continue;
+            int stack_param = frame_stack_param(arg->var);
+            if(stack_param != -1) arg->imm += size + 7 * 8 + stack_param * 8;
+            else arg->imm += offsets[slot_of[frame_find(arg->var)]];
+            arg->var = 0;
+        }
+    }
+    for(int i = 0; i < frame.adjusts->n_values; i++) frame.adjusts->values[i]->args[0].imm = size;
+
+    int unshared = 0;
+    for(int v = 0; v < frame.cfg->vars->n_values; v++) {
+        ir_var* var = frame.cfg->vars->values[v];
+        if(!is_global(var) && frame_stack_param(var) == -1) unshared += frame_var_size(var);
+    }
+    frame_stats = realloc(frame_stats, (n_frame_stats + 1) * sizeof(frame_stat));
+    frame_stats[n_frame_stats++] = (frame_stat) { frame.fn, ((unshared + 7) & ~15) | 8, size, slots->n_values, vars->n_values };
+    amd64_stats_frame(frame.fn, size);
+
+    for(int s = 0; s < slots->n_values; s++) {
+        vector_int_free(slots->values[s]->vars);
+        free(slots->values[s]);
+    }
+    vector_frame_slot_free(slots);
+    vector_ir_var_free(frame.vars);
+    vector_amd64_insn_free(frame.adjusts);
+    free(frame.referenced);
+    free(frame.exposed);
+    free(frame.var_ranges);
+    ir_cfg_free(frame.cfg);
+    frame.cfg = 0;
+}
+
+void amd64_frame_stats(FILE* f)
+{
+    int unshared = 0, size = 0;
+    fprintf(f, "stack frames: bytes with a slot for every variable -> with the slots shared\n");
+    for(int i = 0; i < n_frame_stats; i++) {
+        frame_stat* s = &frame_stats[i];
+        fprintf(f, "    %-20s%d -> %d (%d slots for %d vars)\n", s->fn, s->unshared, s->size, s->slots, s->vars);
+        unshared += s->unshared;
+        size += s->size;
+    }
+    fprintf(f, "    %-20s%d -> %d\n", "total", unshared, size);
+}
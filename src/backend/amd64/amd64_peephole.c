@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <backend/amd64/amd64.h>
+#include <backend/amd64/amd64_asm.h>
+
+// peephole optimization over the emitted instruction records
+// the translator works one IR instruction at a time, so it leaves behind things like a spill
+// immediately followed by a reload of the same variable, or a load into R15 that's only used once
+// each rule looks at the instruction at some position and the ones right after it,
+// and returns how many instructions it removed
+
+typedef struct {
+    char* name;
+    int (*apply)(vector_amd64_insn* code, int i);
+    int removed;
+} peephole_rule;
+
+static int is_op(amd64_insn* insn, char* op)
+{
+    return insn->type == AMD64_INSN && strcmp(insn->op, op) == 0;
+}
+
+static int is_op_of(amd64_insn* insn, char** ops)
+{
+    for(; *ops; ops++) if(is_op(insn, *ops)) return 1;
+    return 0;
+}
+
+static int is_imul(amd64_insn* insn)
+{
+    return is_op(insn, "imulq") || is_op(insn, "imull");
+}
+
+static int is_reg64(amd64_arg* arg)
+{
+    return arg->type == AMD64_ARG_REG && arg->size == 8;
+}
+
+static int arg_equal(amd64_arg* a, amd64_arg* b)
+{
+    if(a->type != b->type) return 0;
+
+    switch(a->type) {
+        case AMD64_ARG_REG: return a->reg == b->reg && a->size == b->size;
+        case AMD64_ARG_IMM: return a->imm == b->imm;
+        case AMD64_ARG_SYM: return strcmp(a->sym, b->sym) == 0;
+        case AMD64_ARG_MEM:
+        if(a->sym || b->sym) return a->sym && b->sym && strcmp(a->sym, b->sym) == 0;
+        return a->reg == b->reg && a->index == b->index && a->imm == b->imm && (a->index == -1 || a->scale == b->scale);
+    }
+
+    return 0;
+}
+
+// whether computing the address of a memory operand reads reg
+static int mem_uses(amd64_arg* arg, int reg)
+{
+    return arg->type == AMD64_ARG_MEM && (arg->reg == reg || arg->index == reg);
+}
+
+static uint32_t arg_regs(amd64_arg* arg)
+{
+    uint32_t regs = 0;
+    if(arg->reg != -1) regs |= 1u << arg->reg;
+    if(arg->type == AMD64_ARG_MEM && arg->index != -1) regs |= 1u << arg->index;
+    return regs;
+}
+
+// the registers an instruction reads and writes, including the implicit ones
+// returns 1 for jumps, calls, labels and anything else that isn't straight-line code
+static int insn_effects(amd64_insn* insn, uint32_t* reads, uint32_t* writes)
+{
+    static char* read_only[] = { "cmpq", "testq", "pushq", NULL };
+    static char* write_only[] = { "movq", "movl", "movb", "leaq", "leal", "movzbq", "movzbl", "movsbq", "movslq", "popq", NULL };
+    static char* read_write[] = { "addq", "subq", "andq", "orq", "xorq", "shlq", "sarq", "shrq", "negq", "notq", "incq", "decq",
+                                  "addl", "subl", "andl", "orl", "xorl", "shll", "negl", "notl", "incl", "decl",
+                                  "setl", "setle", "setg", "setge", "sete", "setne", "setz", "cmoveq", "cmovneq", NULL };
+
+    *reads = 0;
+    *writes = 0;
+    if(insn->type == AMD64_DELETED) return 0;
+    if(insn->type != AMD64_INSN) return 1;
+    if(is_op(insn, "nop")) return 0;
+
+    amd64_arg* dst = &insn->args[insn->n_args - 1];
+    for(int i = 0; i < insn->n_args; i++) *reads |= arg_regs(&insn->args[i]);
+
+    // a register destination that's only written to isn't read, but a memory one still reads its address
+    if(is_op_of(insn, write_only) || (is_op(insn, "xorl") && arg_equal(&insn->args[0], &insn->args[1]))) {
+        if(dst->type == AMD64_ARG_REG) {
+            *writes = 1u << dst->reg;
+            *reads &= ~arg_regs(dst);
+            for(int i = 0; i < insn->n_args - 1; i++) *reads |= arg_regs(&insn->args[i]);
+        }
+    }
+    else if(is_imul(insn) && insn->n_args == 3) {
+        *writes = 1u << dst->reg;
+        *reads = arg_regs(&insn->args[0]) | arg_regs(&insn->args[1]);
+    }
+    else if(is_op_of(insn, read_write) || (is_imul(insn) && insn->n_args == 2)) {
+        if(dst->type == AMD64_ARG_REG) *writes = 1u << dst->reg;
+    }
+    else if(is_op(insn, "imulq") || is_op(insn, "mulq")) {
+        *reads |= 1u << RAX;
+        *writes = 1u << RAX | 1u << RDX;
+    }
+    else if(is_op(insn, "idivq") || is_op(insn, "divq")) {
+        *reads |= 1u << RAX | 1u << RDX;
+        *writes = 1u << RAX | 1u << RDX;
+    }
+    else if(is_op(insn, "cqto")) {
+        *reads = 1u << RAX;
+        *writes = 1u << RDX;
+    }
+    else if(!is_op_of(insn, read_only)) return 1;
+
+    return 0;
+}
+
+// R15 never carries a value out of the instructions emitted for one IR instruction, so it's dead at
+// any jump or label, while the other registers are assumed to be live there
+static int reg_dead_after(vector_amd64_insn* code, int i, int reg)
+{
+    for(int j = i + 1; j < code->n_values; j++) {
+        uint32_t reads, writes;
+        if(insn_effects(code->values[j], &reads, &writes)) return reg == R15;
+        if(reads & (1u << reg)) return 0;
+        if(writes & (1u << reg)) return 1;
+    }
+
+    return 1;
+}
+
+static int next_insn(vector_amd64_insn* code, int i)
+{
+    for(i++; i < code->n_values; i++)
+        if(code->values[i]->type != AMD64_DELETED) return i;
+    return -1;
+}
+
+static void delete_insn(vector_amd64_insn* code, int i)
+{
+    code->values[i]->type = AMD64_DELETED;
+}
+
+// the translator emits a nop for every IR NOP, which mostly carry labels
+static int peephole_nop(vector_amd64_insn* code, int i)
+{
+    if(!is_op(code->values[i], "nop")) return 0;
+    delete_insn(code, i);
+    return 1;
+}
+
+// movq %r, %r
+static int peephole_self_move(vector_amd64_insn* code, int i)
+{
+    amd64_insn* insn = code->values[i];
+    if(!is_op(insn, "movq") || !arg_equal(&insn->args[0], &insn->args[1])) return 0;
+    delete_insn(code, i);
+    return 1;
+}
+
+// jmp L directly followed by L:, possibly among other labels
+static int peephole_jump_to_next(vector_amd64_insn* code, int i)
+{
+    amd64_insn* insn = code->values[i];
+    if(!is_op(insn, "jmp")) return 0;
+
+    for(int j = next_insn(code, i); j != -1 && code->values[j]->type == AMD64_LABEL; j = next_insn(code, j)) {
+        if(strcmp(code->values[j]->op, insn->args[0].sym) == 0) {
+            delete_insn(code, i);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// whatever comes after a jmp or a ret up to the next label is never executed,
+// like the rest of an IR return after a tail call has already jumped away
+static int peephole_unreachable(vector_amd64_insn* code, int i)
+{
+    if(!is_op(code->values[i], "jmp") && !is_op(code->values[i], "ret")) return 0;
+
+    int removed = 0;
+    for(int j = next_insn(code, i); j != -1 && code->values[j]->type == AMD64_INSN; j = next_insn(code, j)) {
+        delete_insn(code, j);
+        removed++;
+    }
+
+    return removed;
+}
+
+// a store or load between %r and M, followed by a load of M into %r or a store of %r into M
+static int peephole_store_reload(vector_amd64_insn* code, int i)
+{
+    amd64_insn* first = code->values[i];
+    int j = next_insn(code, i);
+    if(j == -1 || !is_op(first, "movq") || !is_op(code->values[j], "movq")) return 0;
+    amd64_insn* second = code->values[j];
+
+    amd64_arg* reg = 0;
+    amd64_arg* mem = 0;
+    if(is_reg64(&first->args[0]) && first->args[1].type == AMD64_ARG_MEM) {
+        reg = &first->args[0];
+        mem = &first->args[1];
+    }
+    else if(first->args[0].type == AMD64_ARG_MEM && is_reg64(&first->args[1])) {
+        mem = &first->args[0];
+        reg = &first->args[1];
+    }
+    else return 0;
+
+    // loading into a register used for the address changes what the address means
+    if(mem_uses(mem, reg->reg)) return 0;
+
+    int reload = arg_equal(&second->args[0], mem) && arg_equal(&second->args[1], reg);
+    int store = arg_equal(&second->args[0], reg) && arg_equal(&second->args[1], mem);
+    if(!reload && !store) return 0;
+
+    delete_insn(code, j);
+    return 1;
+}
+
+// movq M, %a; op %a, %b -> op M, %b when %a isn't needed afterwards
+// a load that's only tested against zero becomes cmpq $0, M
+static int peephole_load_op(vector_amd64_insn* code, int i)
+{
+    static char* ops[] = { "addq", "subq", "andq", "orq", "xorq", "cmpq", NULL };
+
+    amd64_insn* load = code->values[i];
+    if(!is_op(load, "movq") || load->args[0].type != AMD64_ARG_MEM || !is_reg64(&load->args[1])) return 0;
+    int j = next_insn(code, i);
+    if(j == -1) return 0;
+
+    amd64_insn* op = code->values[j];
+    int a = load->args[1].reg;
+
+    if(is_op(op, "testq") && arg_equal(&op->args[0], &load->args[1]) && arg_equal(&op->args[1], &load->args[1])) {
+        if(!reg_dead_after(code, j, a)) return 0;
+        op->op = "cmpq";
+        op->args[0] = amd64_arg_imm(0);
+        op->args[1] = load->args[0];
+        delete_insn(code, i);
+        return 1;
+    }
+
+    if(!(is_op_of(op, ops) || (is_op(op, "imulq") && op->n_args == 2))) return 0;
+    if(!arg_equal(&op->args[0], &load->args[1]) || !is_reg64(&op->args[1]) || op->args[1].reg == a) return 0;
+    if(!reg_dead_after(code, j, a)) return 0;
+
+    op->args[0] = load->args[0];
+    delete_insn(code, i);
+    return 1;
+}
+
+// movq M, %a; op x, %a; movq %a, M -> op x, M when %a isn't needed afterwards
+static int peephole_load_op_store(vector_amd64_insn* code, int i)
+{
+    static char* binary[] = { "addq", "subq", "andq", "orq", "xorq", "shlq", "sarq", "shrq", NULL };
+    static char* unary[] = { "negq", "notq", "incq", "decq", NULL };
+
+    amd64_insn* load = code->values[i];
+    if(!is_op(load, "movq") || load->args[0].type != AMD64_ARG_MEM || !is_reg64(&load->args[1])) return 0;
+    int j = next_insn(code, i);
+    int k = j == -1 ? -1 : next_insn(code, j);
+    if(k == -1) return 0;
+
+    amd64_arg* mem = &load->args[0];
+    amd64_arg* a = &load->args[1];
+    amd64_insn* op = code->values[j];
+    amd64_insn* store = code->values[k];
+    if(mem_uses(mem, a->reg)) return 0;
+    if(!is_op(store, "movq") || !arg_equal(&store->args[0], a) || !arg_equal(&store->args[1], mem)) return 0;
+
+    amd64_arg* dst;
+    if(is_op_of(op, unary)) dst = &op->args[0];
+    else if(is_op_of(op, binary) && (op->args[0].type == AMD64_ARG_IMM || (op->args[0].type == AMD64_ARG_REG && op->args[0].reg != a->reg)))
+        dst = &op->args[1];
+    else return 0;
+
+    if(!arg_equal(dst, a) || !reg_dead_after(code, k, a->reg)) return 0;
+
+    *dst = *mem;
+    delete_insn(code, i);
+    delete_insn(code, k);
+    return 2;
+}
+
+static peephole_rule rules[] = {
+    { "nop",               peephole_nop,           0 },
+    { "self-move",         peephole_self_move,     0 },
+    { "jump-to-next",      peephole_jump_to_next,  0 },
+    { "unreachable",       peephole_unreachable,   0 },
+    { "store-reload",      peephole_store_reload,  0 },
+    { "load-op-store",     peephole_load_op_store, 0 },
+    { "load-op",           peephole_load_op,       0 },
+};
+
+#define N_RULES (sizeof(rules) / sizeof(rules[0]))
+
+// applies the rules until none of them match anywhere, then drops the deleted records
+void amd64_peephole(void)
+{
+    vector_amd64_insn* code = amd64_asm;
+    int changed;
+
+    do {
+        changed = 0;
+        for(int i = 0; i < code->n_values; i++) {
+            for(int r = 0; r < N_RULES && code->values[i]->type != AMD64_DELETED; r++) {
+                int removed = rules[r].apply(code, i);
+                rules[r].removed += removed;
+                if(removed) changed = 1;
+            }
+        }
+    } while(changed);
+
+    int n = 0;
+    for(int i = 0; i < code->n_values; i++) {
+        if(code->values[i]->type == AMD64_DELETED) free(code->values[i]);
+        else code->values[n++] = code->values[i];
+    }
+    code->n_values = n;
+}
+
+void amd64_peephole_stats(FILE* f)
+{
+    int total = 0;
+    fprintf(f, "peephole: instructions removed per rule\n");
+    for(int r = 0; r < N_RULES; r++) {
+        fprintf(f, "    %-20s%d\n", rules[r].name, rules[r].removed);
+        total += rules[r].removed;
+    }
+    fprintf(f, "    %-20s%d\n", "total", total);
+}
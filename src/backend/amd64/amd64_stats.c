@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <IR/IR.h>
+#include <IR/IR_cfg.h>
+#include <backend/amd64/amd64.h>
+
+// code quality statistics for --stats and --stats-json
+// the IR side of a function is counted at its label, register allocation after every block of it,
+// and the emitted instructions once the peephole pass is done with them
+
+typedef struct {
+    char* op;
+    int n;
+} mnemonic_stat;
+
+typedef struct {
+    char* fn;
+    int ir_insns;
+    int blocks; // basic blocks in the cfg, not the smaller ones registers are allocated over
+    int vars;
+    int colors; // the most registers any block of the function uses
+    int spilled; // vars the register allocator had to keep in memory
+    int loads; // vars loaded from memory into a register
+    int stores; // and stored back
+    int frame_size;
+    int insns;
+    mnemonic_stat* mnemonics;
+    int n_mnemonics;
+} fn_stat;
+
+int amd64_stats_enabled = 0;
+int amd64_n_loads = 0;
+int amd64_n_stores = 0;
+
+static fn_stat* fn_stats = 0;
+static int n_fn_stats = 0;
+static int loads_start, stores_start; // the counters when the current function began
+
+static fn_stat* current(void)
+{
+    return n_fn_stats ? &fn_stats[n_fn_stats - 1] : 0;
+}
+
+static void close_current(void)
+{
+    fn_stat* s = current();
+    if(!s) return;
+    s->loads = amd64_n_loads - loads_start;
+    s->stores = amd64_n_stores - stores_start;
+}
+
+// called at the function's label, before its prologue
+void amd64_stats_begin(int start)
+{
+    if(!amd64_stats_enabled) return;
+    close_current();
+
+    int fn_start, fn_end;
+    ir_next_fn(start, &fn_start, &fn_end);
+    ir_cfg* cfg = ir_cfg_build(fn_start, fn_end);
+    ir_cfg_liveness(cfg); // which also collects the vars
+
+    fn_stats = realloc(fn_stats, (n_fn_stats + 1) * sizeof(fn_stat));
+    fn_stats[n_fn_stats++] = (fn_stat) {
+        .fn = amd64_current_fn->name,
+        .ir_insns = fn_end - fn_start,
+        .blocks = cfg->blocks->n_values,
+        .vars = cfg->vars->n_values
+    };
+    ir_cfg_free(cfg);
+
+    loads_start = amd64_n_loads;
+    stores_start = amd64_n_stores;
+}
+
+// called after a block is colored, with the number of vars taken out of the graph to make it colorable
+void amd64_stats_block(var_graph* g, int spilled)
+{
+    fn_stat* s = current();
+    if(!amd64_stats_enabled || !s) return;
+    for(int i = 0; i < g->nodes->n_values; i++) if(g->colors[i] + 1 > s->colors) s->colors = g->colors[i] + 1;
+    s->spilled += spilled;
+}
+
+void amd64_stats_frame(char* fn, int size)
+{
+    for(int i = 0; amd64_stats_enabled && i < n_fn_stats; i++)
+        if(strcmp(fn_stats[i].fn, fn) == 0) fn_stats[i].frame_size = size;
+}
+
+static void count_mnemonic(fn_stat* s, char* op)
+{
+    s->insns++;
+    for(int i = 0; i < s->n_mnemonics; i++) {
+        if(strcmp(s->mnemonics[i].op, op)) continue;
+        s->mnemonics[i].n++;
+        return;
+    }
+    s->mnemonics = realloc(s->mnemonics, (s->n_mnemonics + 1) * sizeof(mnemonic_stat));
+    s->mnemonics[s->n_mnemonics++] = (mnemonic_stat) { op, 1 };
+}
+
+static int compare_mnemonics(const void* a, const void* b)
+{
+    return strcmp(((mnemonic_stat*) a)->op, ((mnemonic_stat*) b)->op);
+}
+
+// goes over the final code, where every function starts at a label with its name
+static void count_mnemonics(void)
+{
+    static int counted = 0;
+    if(counted) return;
+    counted = 1;
+    close_current();
+
+    fn_stat* s = 0;
+    for(int i = 0; i < amd64_asm->n_values; i++) {
+        amd64_insn* insn = amd64_asm->values[i];
+        if(insn->type == AMD64_LABEL) {
+            for(int f = 0; f < n_fn_stats; f++) if(strcmp(fn_stats[f].fn, insn->op) == 0) s = &fn_stats[f];
+        }
+        else if(insn->type == AMD64_INSN && s) count_mnemonic(s, insn->op);
+    }
+    for(int i = 0; i < n_fn_stats; i++) qsort(fn_stats[i].mnemonics, fn_stats[i].n_mnemonics, sizeof(mnemonic_stat), compare_mnemonics);
+}
+
+void amd64_stats(FILE* f)
+{
+    count_mnemonics();
+    fprintf(f, "functions: IR instructions, blocks, vars, registers, spilled vars, loads, stores, frame bytes, instructions\n");
+    for(int i = 0; i < n_fn_stats; i++) {
+        fn_stat* s = &fn_stats[i];
+        fprintf(f, "    %-20s%6d%6d%6d%6d%6d%6d%6d%6d%6d\n", s->fn, s->ir_insns, s->blocks, s->vars, s->colors,
+                s->spilled, s->loads, s->stores, s->frame_size, s->insns);
+    }
+}
+
+void amd64_stats_json(FILE* f)
+{
+    count_mnemonics();
+    fprintf(f, "{\n    \"functions\": [\n");
+    for(int i = 0; i < n_fn_stats; i++) {
+        fn_stat* s = &fn_stats[i];
+        fprintf(f, "        {\n");
+        fprintf(f, "            \"name\": \"%s\",\n", s->fn);
+        fprintf(f, "            \"ir_insns\": %d,\n", s->ir_insns);
+        fprintf(f, "            \"blocks\": %d,\n", s->blocks);
+        fprintf(f, "            \"vars\": %d,\n", s->vars);
+        fprintf(f, "            \"colors\": %d,\n", s->colors);
+        fprintf(f, "            \"spilled\": %d,\n", s->spilled);
+        fprintf(f, "            \"loads\": %d,\n", s->loads);
+        fprintf(f, "            \"stores\": %d,\n", s->stores);
+        fprintf(f, "            \"frame_size\": %d,\n", s->frame_size);
+        fprintf(f, "            \"insns\": %d,\n", s->insns);
+        fprintf(f, "            \"mnemonics\": {");
+        for(int m = 0; m < s->n_mnemonics; m++)
+            fprintf(f, "%s \"%s\": %d", m ? "," : "", s->mnemonics[m].op, s->mnemonics[m].n);
+        fprintf(f, " }\n");
+        fprintf(f, "        }%s\n", i + 1 < n_fn_stats ? "," : "");
+    }
+    fprintf(f, "    ]\n}\n");
+}
@@ -7,6 +7,8 @@
 
 #define FN() ;//if(verbose_asm) printf("%s\n", __func__)
 
+int amd64_op_size = 8;
+
 // assumes var has its register; spills the previous reg value if needed and loads this
 void ensure_reg(ir_var* var)
 {
@@ -30,17 +32,6 @@ void amd64_store(ir_var* var, int reg)
     else amd64_spill(reg, var);
 }
 
-int stackframe_find(ir_var* var)
-{
-    var_vector* local_vars = stack_status->values[stack_status->n_values-1];
-    for(int i = 0; i < local_vars->n_values; i++) 
-        if(local_vars->values[i] && strcmp(var->name, local_vars->values[i]->name) == 0)
-            return i;
-    
-    assert(1);
-    return -1;
-}
-
 // this must be at the start of every function
 void amd64_prologue(void)
 {
@@ -56,30 +47,12 @@ void amd64_prologue(void)
     amd64_push(R14);
     amd64_push(R15);
 
-    // allocate space for params and locals
+    // the stack frame has the arguments passed through the stack above the return address,
+    // and slots for the register params and local variables below the saved registers
+    // its size is only known once the whole function has been translated, see amd64_frame.c
     var_vector* params = symtable_get();
-    var_vector* local_vars = ir_get_local_vars(amd64_current_fn->name);
-    amd64_sub_ri(RSP, (min(params->n_values, 6) + local_vars->n_values) * 8);
-
-    // then update the internal compiler state to reflect this
-    // first build the stack frame
-    stackframe_build();
-
-    // the stackframe will be as follows:
-    // arguments passed through the stack (n >= 0)
-    // return address
-    // stack space for the register params (0 <= n <= 6)
-    // stack space for local variables
-
-    // add the stack arguments
-    for(int i = params->n_values - 1; i > 5; i--) stackframe_add(params->values[i]);
-    // then the return address, or rather a dummy in its place
-    stackframe_add(ir_dummy_var());
-    // then the reg args
-    for(int i = 0; i < min(params->n_values, 6); i++) stackframe_add(params->values[i]);
-    // and finally the local variables
-    for(int i = 0; i < local_vars->n_values; i++) stackframe_add(local_vars->values[i]);
-    vector_ir_var_free(local_vars);
+    amd64_frame_begin(amd64_ip);
+    amd64_frame_adjust("subq");
 
     // put the register-passed arguments on the stack in their parameter slots
     // this is terribly unoptimized but it works
@@ -94,19 +67,11 @@ void amd64_prologue(void)
     }
 }
 
-// this must be at the end of every function
-void amd64_epilogue(void)
+// undoes the prologue, leaving the stack as it was when the function was called
+static void amd64_leave(void)
 {
-    // deallocate local vars to clean up the stack
-    // so add the number of variables after the dummy return value
-    int n = 0;
-    for(int i = 0; i < stackframe_top->n_values; i++) {
-        if(strcmp(stackframe_top->values[i]->name, "dummy") == 0) {
-            n = stackframe_top->n_values - (i + 1);
-            break;
-        }
-    }
-    amd64_add_ri(RSP, n * 8);
+    // deallocate the params and locals to clean up the stack
+    amd64_frame_adjust("addq");
 
     amd64_pop(R15);
     amd64_pop(R14);
@@ -116,9 +81,23 @@ void amd64_epilogue(void)
 
     amd64_mov(RSP, RBP);
     amd64_pop(RBP);
+}
+
+// this must be at the end of every function
+void amd64_epilogue(void)
+{
+    amd64_leave();
     amd64_ret();
 }
 
+// a tail call reuses the caller's return address, so the callee returns straight to the caller's caller
+// IR_tail.c only marks calls whose args all go in registers, so there's nothing on the stack to keep
+static void amd64_tail_call(char* label)
+{
+    amd64_leave();
+    amd64_jmp(label);
+}
+
 // fix this later
 void amd64_fn_call(ir_fn_call* call)
 {
@@ -142,6 +121,10 @@ void amd64_fn_call(ir_fn_call* call)
     }
 
     call:
+    if(call->is_tail) {
+        amd64_tail_call(call->fn_label + 3);
+        return;
+    }
     amd64_call(call->fn_label + 3); // go past `fn.`
     if(call->result) amd64_spill(RAX, call->result);
 }
@@ -168,7 +151,73 @@ void amd64_proc_call(ir_proc_call* call)
     }
     
     call:
-    amd64_call(call->fn_label + 3);
+    if(call->is_tail) amd64_tail_call(call->fn_label + 3);
+    else amd64_call(call->fn_label + 3);
+}
+
+// whether the operand is a value of the type as it is, going by the value of a literal and the type of a var
+static int amd64_value_fits(type_info* type, ir_value* value)
+{
+    if(value->type == IR_LIT) return ir_canonical(type, value->content.lit.i) == value->content.lit.i;
+    return ir_type_contains(type, value->content.var->type);
+}
+
+// whether op on operands that fit the type always gives a value of the type, so that it needn't be truncated
+// right is 0 for the unary ones
+static int amd64_result_fits(ir_op op, type_info* type, ir_value* left, ir_value* right)
+{
+    if(ir_type_size(type) == 8) return 1;
+    int fits = amd64_value_fits(type, left) && (!right || amd64_value_fits(type, right));
+
+    switch(op) {
+        case IR_LESSER:
+        case IR_LESSER_EQUAL:
+        case IR_GREATER:
+        case IR_GREATER_EQUAL:
+        case IR_EQUAL:
+        case IR_NOT_EQUAL:
+        case IR_LOGICAL_NOT:
+        return 1;
+
+        // signed int overflow is undefined, so sign-extended operands give a sign-extended result
+        // a char result isn't covered by that, its arithmetic happens in int and is converted back
+        case IR_ADD:
+        case IR_SUBTRACT:
+        case IR_MULTIPLY:
+        case IR_MINUS:
+        return fits && ir_type_size(type) == 4 && !ir_is_unsigned(type);
+
+        // these don't give anything further from zero than their operands
+        case IR_DIVIDE:
+        case IR_MODULO:
+        case IR_RSHIFT:
+        case IR_BINARY_AND:
+        case IR_BINARY_OR:
+        return fits;
+
+        case IR_BINARY_NOT:
+        return fits && !ir_is_unsigned(type);
+
+        default: return 0;
+    }
+}
+
+// a result that may not fit its type is computed with 32-bit instructions where only the low bits of the
+// operands matter, which is shorter and leaves a uint zero-extended already
+static void amd64_size_op(ir_op op, type_info* type, int fits)
+{
+    amd64_op_size = 8;
+    if(fits || ir_type_size(type) == 8) return;
+    if(op == IR_ADD || op == IR_SUBTRACT || op == IR_MULTIPLY || op == IR_LSHIFT || op == IR_MINUS || op == IR_BINARY_NOT)
+        amd64_op_size = 4;
+}
+
+// and then whatever isn't a value of the type yet is truncated to it in reg
+static void amd64_truncate(int reg, type_info* type, int fits)
+{
+    int zero_extended = amd64_op_size == 4 && ir_type_size(type) == 4 && ir_is_unsigned(type);
+    amd64_op_size = 8;
+    if(!fits && !zero_extended) amd64_extend(reg, type);
 }
 
 void amd64_un_rr(ir_un* un)
@@ -178,12 +227,14 @@ void amd64_un_rr(ir_un* un)
     ir_var* result = un->result;
 
     int reg_result = get_reg(result);
+    int fits = amd64_result_fits(un->op, result->type, un->operand, 0);
     if(!check_reg(result)) amd64_spill(reg_result, reg_status[reg_result]);
 
     // move the operand into the result register, and do the calculation there
     if(check_reg(operand)) amd64_mov(reg_result, get_reg(operand));
     else amd64_load(reg_result, operand);
 
+    amd64_size_op(un->op, result->type, fits);
     switch(un->op) {
         case IR_MINUS:
         amd64_neg(reg_result);
@@ -197,13 +248,9 @@ void amd64_un_rr(ir_un* un)
         amd64_logical_not_r(reg_result);
         break;
 
-        case IR_DEREFERENCE:
-        amd64_mov(R15, reg_result);
-        amd64_deref_mov_rr(reg_result, R15);
-        break;
-
         default: break;
     }
+    amd64_truncate(reg_result, result->type, fits);
 
     reg_status[reg_result] = result;
 }
@@ -218,6 +265,8 @@ void amd64_un_mr(ir_un* un)
     int reg_operand = get_reg(operand);
     ensure_reg(operand);
 
+    // the store truncates the result to its type
+    amd64_size_op(un->op, result->type, amd64_result_fits(un->op, result->type, un->operand, 0));
     switch(un->op) {
         case IR_MINUS:       
         amd64_neg(reg_operand);
@@ -231,12 +280,9 @@ void amd64_un_mr(ir_un* un)
         amd64_logical_not_r(reg_operand);
         break;
 
-        case IR_DEREFERENCE:
-        amd64_deref_mov_mr(result, reg_operand);
-        break;
-        
         default: break;
     }
+    amd64_op_size = 8;
     reg_status[reg_operand] = 0; // the value in the register changed
 
     // now move it into the result register
@@ -250,10 +296,12 @@ void amd64_un_rm(ir_un* un)
     FN();
     ir_var* result = un->result;
     int reg_result = get_reg(result);
+    int fits = amd64_result_fits(un->op, result->type, un->operand, 0);
     if(!check_reg(result)) amd64_spill(reg_result, reg_status[reg_result]);
     
     amd64_load(reg_result, un->operand);
 
+    amd64_size_op(un->op, result->type, fits);
     switch(un->op) {
         case IR_MINUS:
         amd64_neg(reg_result);
@@ -267,13 +315,9 @@ void amd64_un_rm(ir_un* un)
         amd64_logical_not_r(reg_result);
         break;
 
-        case IR_DEREFERENCE:
-        amd64_mov(R15, reg_result);
-        amd64_deref_mov_rr(reg_result, R15);
-        break;
-
         default: break;
     }
+    amd64_truncate(reg_result, result->type, fits);
 
     reg_status[reg_result] = result;
 }
@@ -285,595 +329,486 @@ void amd64_un_mm(ir_un* un)
 
     amd64_load(13, un->operand);
 
+    amd64_size_op(un->op, result->type, amd64_result_fits(un->op, result->type, un->operand, 0));
     switch(un->op) {
         case IR_MINUS:       amd64_neg(13);           break;
         case IR_BINARY_NOT:  amd64_not(13);           break;
         case IR_LOGICAL_NOT: amd64_logical_not_r(13); break;
 
-        case IR_DEREFERENCE:
-        amd64_load(R15, un->operand);
-        amd64_deref_mov_mr(un->result, R15);
-        break;
-
         default: break;
     }
+    amd64_op_size = 8;
 
     amd64_spill(13, result);
 }
 
-void amd64_bin_rrr(ir_bin* bin)
-{
-    FN();
-    ir_var* result = bin->result;
-    ir_var* left = bin->left->content.var;
-    ir_var* right = bin->right->content.var;
-    int reg_left = get_reg(left);
-    int reg_right = get_reg(right);
-    int reg_result = get_reg(result);
-
-    ensure_reg(left);
-    ensure_reg(right);
-    if(!check_reg(result)) amd64_spill(reg_result, reg_status[reg_result]);
-
-    switch(bin->op) {
-        case IR_SUBTRACT:
-        // I want: result = left - right
-        // sub(dst, src) is dst = dst - src
-        // so I need to move left into reg_result and sub(result, right)
-        amd64_mov(reg_result, reg_left);
-        amd64_sub_rr(reg_result, reg_right);
-        break;
-
-        case IR_ADD:
-        amd64_mov(reg_result, reg_left);
-        amd64_add_rr(reg_result, reg_right);
-        break;
-
-        case IR_MULTIPLY:
-        amd64_mov(reg_result, reg_left);
-        amd64_imul_rr(reg_result, reg_right);
-        break;
-
-        case IR_LESSER:
-        // for example, result in rax, left in rbx, right in rcx
-        // cmp %rcx, %rbx (pay attention to operand ordering, a > b = cmp b, a)
-        // setl %al (set if less)
-        // movzbq %al, %rax (move with zero-extend from byte to quad)
-        amd64_cmp_rr(reg_left, reg_right);
-        amd64_setl_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
-
-        case IR_LESSER_EQUAL:
-        amd64_cmp_rr(reg_left, reg_right);
-        amd64_setle_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
-
-        case IR_GREATER:
-        amd64_cmp_rr(reg_left, reg_right);
-        amd64_setg_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
-
-        case IR_GREATER_EQUAL:
-        amd64_cmp_rr(reg_left, reg_right);
-        amd64_setge_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
-
-        case IR_EQUAL:
-        amd64_cmp_rr(reg_left, reg_right);
-        amd64_sete_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
+// a bin operand after it's been looked at once:
+// either a register, or a value that fits in an instruction (memory or a 32-bit immediate)
+typedef struct {
+    int reg; // -1 if the operand isn't in a register
+    ir_value* value;
+} amd64_operand;
 
-        case IR_NOT_EQUAL:
-        amd64_cmp_rr(reg_left, reg_right);
-        amd64_setne_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
+static int is_reg_op(amd64_operand op) { return op.reg != -1; }
+static int is_imm_op(amd64_operand op) { return op.reg == -1 && op.value->type == IR_LIT; }
+static int is_imm_op_of(amd64_operand op, int64_t imm) { return is_imm_op(op) && op.value->content.lit.i == imm; }
 
-        default: break;
+// spills whatever is in reg so that an instruction with fixed registers can clobber it
+static void amd64_evict(int reg)
+{
+    if(reg < g->nodes->n_values && reg_status[reg]) {
+        amd64_spill(reg, reg_status[reg]);
+        reg_status[reg] = 0;
     }
-
-    reg_status[reg_result] = result;
 }
 
-void amd64_bin_mrr(ir_bin* bin)
+// a register to work in besides R15, a free one if there is one and otherwise an evicted one
+// RAX, RCX and RDX are left to the instructions that need them in particular
+static int amd64_scratch(int avoid1, int avoid2)
 {
-    FN();
-    ir_var* result = bin->result;
-    ir_var* left = bin->left->content.var;
-    ir_var* right = bin->right->content.var;
-    int reg_left = get_reg(left);
-    int reg_right = get_reg(right);
-
-    ensure_reg(left);
-    ensure_reg(right);
+    static int regs[] = { RBX, RSI, RDI, R8, R9, R10, R11, R12, R13, R14 };
 
-    switch(bin->op) {
-        case IR_SUBTRACT:
-        amd64_sub_rr(reg_left, reg_right);
-        reg_status[reg_left] = 0;
-        amd64_spill(reg_left, result);
-        break;
+    for(int i = 0; i < sizeof(regs) / sizeof(regs[0]); i++) {
+        int reg = regs[i];
+        if(reg != avoid1 && reg != avoid2 && (reg >= g->nodes->n_values || !reg_status[reg])) return reg;
+    }
 
-        case IR_ADD:
-        amd64_add_rr(reg_left, reg_right);
-        reg_status[reg_left] = 0;
-        amd64_spill(reg_left, result);
-        break;
+    int reg = avoid1 != RBX && avoid2 != RBX ? RBX : avoid1 != RSI && avoid2 != RSI ? RSI : RDI;
+    amd64_evict(reg);
+    return reg;
+}
 
-        case IR_MULTIPLY:
-        amd64_imul_rr(reg_left, reg_right);
-        amd64_spill(reg_left, result);
-        reg_status[reg_left] = 0;
-        break;
+// makes sure register operands are loaded, and puts literals too wide for an immediate into R15
+// a var in memory narrower than the operation can't be used from there, so it's loaded into a scratch register
+// that's neither of the ones to avoid
+static amd64_operand amd64_get_operand(ir_value* value, int avoid1, int avoid2)
+{
+    amd64_operand op = { -1, value };
 
-        case IR_LESSER:
-        amd64_cmp_rr(reg_left, reg_right);
-        amd64_setl_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
+    if(value->type == IR_VAR && has_reg(value->content.var)) {
+        ensure_reg(value->content.var);
+        op.reg = get_reg(value->content.var);
+    }
+    else if(value->type == IR_VAR && ir_type_size(value->content.var->type) < amd64_op_size) {
+        op.reg = amd64_scratch(avoid1, avoid2);
+        amd64_load_var(op.reg, value->content.var);
+    }
+    else if(value->type == IR_LIT && !amd64_is_imm32(value->content.lit.i)) {
+        amd64_mov_ri(R15, value->content.lit.i);
+        op.reg = R15;
+    }
 
-        case IR_LESSER_EQUAL:
-        amd64_cmp_rr(reg_left, reg_right);
-        amd64_setle_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
+    return op;
+}
 
-        case IR_GREATER:
-        amd64_cmp_rr(reg_left, reg_right);
-        amd64_setg_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
+// dst = op
+static void amd64_place(int dst, amd64_operand op)
+{
+    if(is_reg_op(op)) amd64_mov_rr(dst, op.reg);
+    else amd64_mov_rv(dst, op.value);
+}
 
-        case IR_GREATER_EQUAL:
-        amd64_cmp_rr(reg_left, reg_right);
-        amd64_setge_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
+static void amd64_add_rx(int dst, amd64_operand op)
+{
+    if(is_reg_op(op)) amd64_add_rr(dst, op.reg);
+    else amd64_add_rv(dst, op.value);
+}
 
-        case IR_EQUAL:
-        amd64_cmp_rr(reg_left, reg_right);
-        amd64_sete_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
+static void amd64_sub_rx(int dst, amd64_operand op)
+{
+    if(is_reg_op(op)) amd64_sub_rr(dst, op.reg);
+    else amd64_sub_rv(dst, op.value);
+}
 
-        case IR_NOT_EQUAL:
-        amd64_cmp_rr(reg_left, reg_right);
-        amd64_setne_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
+static int log2_exact(int64_t n)
+{
+    if(n <= 0 || (n & (n - 1))) return -1;
+    int i = 0;
+    while(n >>= 1) i++;
+    return i;
+}
 
+static void amd64_setcc_r(ir_op op, int reg)
+{
+    switch(op) {
+        case IR_LESSER:        amd64_setl_r(reg);  break;
+        case IR_LESSER_EQUAL:  amd64_setle_r(reg); break;
+        case IR_GREATER:       amd64_setg_r(reg);  break;
+        case IR_GREATER_EQUAL: amd64_setge_r(reg); break;
+        case IR_EQUAL:         amd64_sete_r(reg);  break;
+        case IR_NOT_EQUAL:     amd64_setne_r(reg); break;
         default: break;
     }
 }
 
-void amd64_bin_rrm(ir_bin* bin)
+// the comparison that gives the same result with its operands swapped
+static ir_op amd64_swapped_cmp(ir_op op)
 {
-    ir_var* result = bin->result;
-    ir_var* left = bin->left->content.var;
-    int reg_result = get_reg(result);
-    int reg_left = get_reg(left);
-
-    ensure_reg(left);
-    if(!check_reg(result)) amd64_spill(reg_result, reg_status[reg_result]);
-
-    switch(bin->op) {
-        case IR_SUBTRACT:
-        // result = left - right
-        // sub(left, right): left = left - right
-        // mov left -> result
-        amd64_mov(reg_result, reg_left);
-        amd64_sub_rv(reg_result, bin->right);
-        break;
-
-        case IR_ADD:
-        amd64_mov(reg_result, reg_left);
-        amd64_add_rv(reg_result, bin->right);
-        break;
-
-        case IR_MULTIPLY:
-        // register-register-memory multiplication can't be done in a single instruction
-        // so move the register operand into the result register (to avoid clobbering the operand register)
-        amd64_mov(reg_result, reg_left);
-        amd64_imul_rv(reg_result, bin->right);
-        break;
-
-        case IR_LESSER:
-        amd64_cmp_rv(reg_left, bin->right);
-        amd64_setl_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
-
-        case IR_LESSER_EQUAL:
-        amd64_cmp_rv(reg_left, bin->right);
-        amd64_setle_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
-
-        case IR_GREATER:
-        amd64_cmp_rv(reg_left, bin->right);
-        amd64_setg_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
-
-        case IR_GREATER_EQUAL:
-        amd64_cmp_rv(reg_left, bin->right);
-        amd64_setge_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
-
-        case IR_EQUAL:
-        amd64_cmp_rv(reg_left, bin->right);
-        amd64_sete_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
-
-        case IR_NOT_EQUAL:
-        amd64_cmp_rv(reg_left, bin->right);
-        amd64_setne_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
-
-        default: break;
+    switch(op) {
+        case IR_LESSER:        return IR_GREATER;
+        case IR_LESSER_EQUAL:  return IR_GREATER_EQUAL;
+        case IR_GREATER:       return IR_LESSER;
+        case IR_GREATER_EQUAL: return IR_LESSER_EQUAL;
+        default:               return op;
     }
-
-    reg_status[reg_result] = result;
 }
 
-void amd64_bin_mrm(ir_bin* bin)
+// cmp against the right operand, test when that's zero
+static void amd64_cmp_rx(int reg, amd64_operand op)
 {
-    FN();
-    ir_var* result = bin->result;
-    ir_var* left = bin->left->content.var;
-    int reg_left = get_reg(left);
-    
-    ensure_reg(left);
-
-    switch(bin->op) {
-        case IR_SUBTRACT:
-        amd64_sub_rv(reg_left, bin->right);
-        amd64_spill(reg_left, result);
-        reg_status[reg_left] = 0;
-        break;
-
-        case IR_ADD:
-        amd64_add_rv(reg_left, bin->right);
-        amd64_spill(reg_left, result);
-        reg_status[reg_left] = 0;
-        break;
-
-        case IR_MULTIPLY:
-        amd64_imul_rv(reg_left, bin->right);
-        amd64_spill(reg_left, result);
-        reg_status[reg_left] = 0;
-        break;
-
-        case IR_LESSER:
-        amd64_cmp_rv(reg_left, bin->right);
-        amd64_setl_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
-
-        case IR_LESSER_EQUAL:
-        amd64_cmp_rv(reg_left, bin->right);
-        amd64_setle_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
-
-        case IR_GREATER:
-        amd64_cmp_rv(reg_left, bin->right);
-        amd64_setg_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
-
-        case IR_GREATER_EQUAL:
-        amd64_cmp_rv(reg_left, bin->right);
-        amd64_setge_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
-
-        case IR_EQUAL:
-        amd64_cmp_rv(reg_left, bin->right);
-        amd64_sete_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
-
-        case IR_NOT_EQUAL:
-        amd64_cmp_rv(reg_left, bin->right);
-        amd64_setne_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
+    if(is_imm_op_of(op, 0)) amd64_test_rr(reg, reg);
+    else if(is_reg_op(op)) amd64_cmp_rr(reg, op.reg);
+    else amd64_cmp_rv(reg, op.value);
+}
 
-        default: break;
+// the operand was in a register that's about to be clobbered, but evicting it left it consistent in memory
+// a var narrower than the operation can't be used from there, so it's reloaded into a scratch register
+// other than avoid, like amd64_get_operand would have
+static amd64_operand amd64_evicted(amd64_operand op, int reg, int avoid)
+{
+    if(op.reg != reg || op.value->type != IR_VAR) return op;
+    ir_var* var = op.value->content.var;
+    if(ir_type_size(var->type) < amd64_op_size) {
+        op.reg = amd64_scratch(reg, avoid);
+        amd64_load_var(op.reg, var);
     }
+    else op.reg = -1;
+    return op;
 }
 
-void amd64_bin_rmr(ir_bin* bin)
+static void amd64_mul_rx(amd64_operand op, int is_unsigned)
 {
-    FN();
-    ir_var* result = bin->result;
-    ir_var* right = bin->right->content.var;
-    int reg_result = get_reg(result);
-    int reg_right = get_reg(right);
-
-    ensure_reg(right);
-    if(!check_reg(result)) amd64_spill(reg_result, reg_status[reg_result]);
-
-    switch(bin->op) {
-        case IR_SUBTRACT:
-        amd64_load(reg_result, bin->left);
-        amd64_sub_rr(reg_result, reg_right);
-        break;
+    if(is_reg_op(op)) is_unsigned ? amd64_mul_r(op.reg) : amd64_imul_r(op.reg);
+    else is_unsigned ? amd64_mul_m(op.value->content.var) : amd64_imul_m(op.value->content.var);
+}
 
-        case IR_ADD:
-        amd64_load(reg_result, bin->left);
-        amd64_add_rr(reg_result, reg_right);
-        break;
+// magic numbers for dividing by a constant with a multiply-high, from Hacker's Delight chapter 10
+// signed: q = mulhi(x, magic) (+ or - x) >> shift, plus one if that came out negative
+typedef struct {
+    int64_t magic;
+    int shift;
+} amd64_sdiv_magic;
+
+// unsigned: q = mulhi(x, magic) >> shift, and if add is set the multiplier overflowed 64 bits
+// so it's ((x - q) / 2 + q) >> (shift - 1) instead
+typedef struct {
+    uint64_t magic;
+    int shift;
+    int add;
+} amd64_udiv_magic;
+
+// d must not be -1, 0 or 1
+static amd64_sdiv_magic amd64_signed_magic(int64_t d)
+{
+    const uint64_t two63 = (uint64_t) 1 << 63;
+    uint64_t ad = d < 0 ? -(uint64_t) d : (uint64_t) d;
+    uint64_t t = two63 + ((uint64_t) d >> 63);
+    uint64_t anc = t - 1 - t % ad; // absolute value of nc
+    uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc; // 2^p / |nc| and its remainder
+    uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;   // 2^p / |d| and its remainder
+    uint64_t delta;
+    int p = 63;
+
+    do {
+        p++;
+        q1 *= 2; r1 *= 2;
+        if(r1 >= anc) { q1++; r1 -= anc; }
+        q2 *= 2; r2 *= 2;
+        if(r2 >= ad) { q2++; r2 -= ad; }
+        delta = ad - r2;
+    } while(q1 < delta || (q1 == delta && r1 == 0));
+
+    amd64_sdiv_magic m = { (int64_t) (q2 + 1), p - 64 };
+    if(d < 0) m.magic = -(uint64_t) m.magic;
+    return m;
+}
 
-        case IR_MULTIPLY:
-        amd64_load(reg_result, bin->left);
-        amd64_imul_rr(reg_result, reg_right);
-        break;
+// d must be above 1 and below 2^63
+static amd64_udiv_magic amd64_unsigned_magic(uint64_t d)
+{
+    const uint64_t two63 = (uint64_t) 1 << 63;
+    amd64_udiv_magic m = { 0, 0, 0 };
+    uint64_t nc = -1 - (-d) % d;
+    uint64_t q1 = two63 / nc, r1 = two63 - q1 * nc;
+    uint64_t q2 = (two63 - 1) / d, r2 = (two63 - 1) - q2 * d;
+    uint64_t delta;
+    int p = 63;
+
+    do {
+        p++;
+        if(r1 >= nc - r1) { q1 = 2 * q1 + 1; r1 = 2 * r1 - nc; }
+        else { q1 = 2 * q1; r1 = 2 * r1; }
+        if(r2 + 1 >= d - r2) {
+            if(q2 >= two63 - 1) m.add = 1;
+            q2 = 2 * q2 + 1;
+            r2 = 2 * r2 + 1 - d;
+        }
+        else {
+            if(q2 >= two63) m.add = 1;
+            q2 = 2 * q2;
+            r2 = 2 * r2 + 1;
+        }
+        delta = d - 1 - r2;
+    } while(p < 128 && (q1 < delta || (q1 == delta && r1 == 0)));
 
-        case IR_LESSER:
-        // comparing right with left instead of left with right, and flipping the set insn
-        // lesser becomes greater or equal
-        amd64_cmp_rv(reg_right, bin->left);
-        amd64_setge_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
+    m.magic = q2 + 1;
+    m.shift = p - 64;
+    return m;
+}
 
-        case IR_LESSER_EQUAL:
-        amd64_cmp_rv(reg_right, bin->left);
-        amd64_setg_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
+// x / d and x % d through the division instruction, returns the register with the result
+static int amd64_emit_idiv(ir_op op, amd64_operand left, amd64_operand right, int is_unsigned)
+{
+    amd64_evict(RAX);
+    amd64_evict(RDX);
+    right = amd64_evicted(amd64_evicted(right, RAX, left.reg), RDX, left.reg);
+
+    amd64_place(RAX, left);
+    if(is_imm_op(right)) {
+        amd64_mov_ri(R15, right.value->content.lit.i);
+        right.reg = R15;
+    }
 
-        case IR_GREATER:
-        amd64_cmp_rv(reg_right, bin->left);
-        amd64_setle_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
+    if(is_unsigned) amd64_xor_rr(RDX);
+    else amd64_cqto();
 
-        case IR_GREATER_EQUAL:
-        amd64_cmp_rv(reg_right, bin->left);
-        amd64_setl_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
+    if(is_reg_op(right)) is_unsigned ? amd64_div_r(right.reg) : amd64_idiv_r(right.reg);
+    else is_unsigned ? amd64_div_m(right.value->content.var) : amd64_idiv_m(right.value->content.var);
 
-        case IR_EQUAL:
-        amd64_cmp_rv(reg_right, bin->left);
-        amd64_sete_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
+    return op == IR_DIVIDE ? RAX : RDX;
+}
 
-        case IR_NOT_EQUAL:
-        amd64_cmp_rv(reg_right, bin->left);
-        amd64_setne_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
+// turns the quotient in RDX into the remainder, x - q * d
+static void amd64_emit_remainder(amd64_operand x, int64_t d)
+{
+    amd64_imul_rri(RDX, RDX, d);
+    amd64_neg(RDX);
+    amd64_add_rx(RDX, x);
+}
 
-        default: break;
+// division by a constant that isn't a power of two, as a multiply-high and shifts
+static int amd64_emit_magic_div(ir_op op, amd64_operand x, int64_t d, int is_unsigned)
+{
+    amd64_evict(RAX);
+    amd64_evict(RDX);
+    x = amd64_evicted(amd64_evicted(x, RAX, -1), RDX, -1);
+
+    if(is_unsigned) {
+        amd64_udiv_magic m = amd64_unsigned_magic(d);
+        amd64_mov_ri(RAX, m.magic);
+        amd64_mul_rx(x, 1);
+        if(m.add) {
+            amd64_place(RAX, x);
+            amd64_sub_rr(RAX, RDX);
+            amd64_shr_ri(RAX, 1);
+            amd64_add_rr(RDX, RAX);
+            if(m.shift > 1) amd64_shr_ri(RDX, m.shift - 1);
+        }
+        else if(m.shift) amd64_shr_ri(RDX, m.shift);
+    }
+    else {
+        amd64_sdiv_magic m = amd64_signed_magic(d);
+        amd64_mov_ri(RAX, m.magic);
+        amd64_mul_rx(x, 0);
+        if(d > 0 && m.magic < 0) amd64_add_rx(RDX, x);
+        if(d < 0 && m.magic > 0) amd64_sub_rx(RDX, x);
+        if(m.shift) amd64_sar_ri(RDX, m.shift);
+        // round towards zero by adding one to negative quotients
+        amd64_mov_rr(RAX, RDX);
+        amd64_shr_ri(RAX, 63);
+        amd64_add_rr(RDX, RAX);
     }
 
-    reg_status[reg_result] = result;
+    if(op == IR_MODULO) amd64_emit_remainder(x, d);
+    return RDX;
 }
 
-void amd64_bin_mmr(ir_bin* bin)
+// signed division by +-2^k rounds towards zero, so negative dividends get 2^k - 1 added before the shift
+// and the remainder is x minus the dividend rounded that way
+static int amd64_emit_pow2_div(int dst, ir_op op, amd64_operand x, int64_t d, int k, int is_unsigned)
 {
-    FN();
-    ir_var* result = bin->result;
-    ir_var* right = bin->right->content.var;
-    int reg_right = get_reg(right);
-
-    ensure_reg(right);
-
-    switch(bin->op) {
-        case IR_SUBTRACT:
-        // left - right = -(right - left)
-        amd64_neg(reg_right);
-        amd64_sub_rv(reg_right, bin->left);
-        amd64_spill(reg_right, result);
-        reg_status[reg_right] = 0;
-        break;
-
-        case IR_ADD:
-        amd64_add_rv(reg_right, bin->left);
-        amd64_spill(reg_right, result);
-        reg_status[reg_right] = 0;
-        break;
-
-        case IR_MULTIPLY:
-        amd64_imul_rv(reg_right, bin->left);
-        amd64_spill(reg_right, result);
-        reg_status[reg_right] = 0;
-        break;
-
-        case IR_LESSER:
-        amd64_cmp_rv(reg_right, bin->left);
-        amd64_setge_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
-
-        case IR_LESSER_EQUAL:
-        amd64_cmp_rv(reg_right, bin->left);
-        amd64_setg_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
+    int work = is_reg_op(x) && x.reg == dst ? R15 : dst;
 
-        case IR_GREATER:
-        amd64_cmp_rv(reg_right, bin->left);
-        amd64_setle_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
+    amd64_place(work, x);
+    if(is_unsigned) {
+        if(op == IR_DIVIDE) amd64_shr_ri(work, k);
+        else amd64_and_ri(work, d - 1);
+        return work;
+    }
 
-        case IR_GREATER_EQUAL:
-        amd64_cmp_rv(reg_right, bin->left);
-        amd64_setl_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
+    // the bias is 2^k - 1 for negative x and 0 otherwise
+    if(k > 1) amd64_sar_ri(work, 63);
+    amd64_shr_ri(work, 64 - k);
+    amd64_add_rx(work, x);
 
-        case IR_EQUAL:
-        amd64_cmp_rv(reg_right, bin->left);
-        amd64_sete_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
+    if(op == IR_DIVIDE) {
+        amd64_sar_ri(work, k);
+        if(d < 0) amd64_neg(work);
+    }
+    else {
+        amd64_and_ri(work, -((int64_t) 1 << k));
+        amd64_neg(work);
+        amd64_add_rx(work, x);
+    }
 
-        case IR_NOT_EQUAL:
-        amd64_cmp_rv(reg_right, bin->left);
-        amd64_setne_r(R15);
-        amd64_movzbq_r(R15);
-        amd64_spill(R15, result);
-        break;
+    return work;
+}
 
+// k for a divisor of 2^k (or -2^k if signed) that amd64_emit_pow2_div can handle, -1 otherwise
+static int amd64_pow2_divisor(int64_t d, int is_unsigned)
+{
+    if(is_unsigned && d < 0) return -1;
+    int k = log2_exact(d < 0 ? -d : d);
+    return k > 0 ? k : -1;
+}
 
-        default: break;
-    }
+// the divisors left over for amd64_emit_magic_div
+static int amd64_magic_divisor(int64_t d, int is_unsigned)
+{
+    if(d == 0 || d == 1 || d == -1 || (is_unsigned && d < 0)) return 0;
+    return amd64_pow2_divisor(d, is_unsigned) == -1;
 }
 
-void amd64_bin_mmm(ir_bin* bin)
+// shifts by a variable amount need the count in CL, the result is computed in R15 if the destination is RCX
+static int amd64_emit_shift(int dst, ir_op op, amd64_operand left, amd64_operand right, int is_unsigned)
 {
-    FN();
-    ir_var* result = bin->result;
-    amd64_load(R15, bin->left);
+    int work = dst == RCX ? R15 : dst;
+    if(!is_reg_op(right) || right.reg != RCX) {
+        amd64_evict(RCX);
+        left = amd64_evicted(left, RCX, right.reg);
+    }
 
-    switch(bin->op) {
-        case IR_SUBTRACT:
-        amd64_sub_rv(R15, bin->right);
-        break;
+    amd64_place(RCX, right);
+    amd64_place(work, left);
+    if(op == IR_LSHIFT) amd64_shl_rc(work);
+    else if(is_unsigned) amd64_shr_rc(work);
+    else amd64_sar_rc(work);
 
-        case IR_ADD:
-        amd64_add_rv(R15, bin->right);
-        break;
+    return work;
+}
 
-        case IR_MULTIPLY:
-        amd64_imul_rv(R15, bin->right);
-        break;
+// the selector's tables are generated from amd64_bin.rules by amd64_burg
+// r, m and i are what an operand is to begin with, and d is only reached through a chain rule
+enum { AMD64_NT_R, AMD64_NT_M, AMD64_NT_I, AMD64_NT_D };
 
-        case IR_LESSER:
-        amd64_cmp_rv(R15, bin->right);
-        amd64_setl_r(R15);
-        amd64_movzbq_r(R15);
-        break;
-
-        case IR_LESSER_EQUAL:
-        amd64_cmp_rv(R15, bin->right);
-        amd64_setg_r(R15);
-        amd64_movzbq_r(R15);
-        break;
+#define AMD64_BIN_ARGS ir_op op, int dst, amd64_operand left, amd64_operand right, int is_unsigned
+#define IMM(op) ((op).value->content.lit.i)
 
-        case IR_GREATER:
-        amd64_cmp_rv(R15, bin->right);
-        amd64_setle_r(R15);
-        amd64_movzbq_r(R15);
-        break;
+// cost returns -1 if the rule doesn't apply, emit returns the register the result is in
+typedef struct {
+    ir_op op;
+    int left, right;
+    int (*cost)(AMD64_BIN_ARGS);
+    int (*emit)(AMD64_BIN_ARGS);
+    char* pattern;
+} amd64_bin_rule;
 
-        case IR_GREATER_EQUAL:
-        amd64_cmp_rv(R15, bin->right);
-        amd64_setl_r(R15);
-        amd64_movzbq_r(R15);
-        break;
+typedef struct {
+    int to, from;
+    int (*cost)(AMD64_BIN_ARGS);
+    int (*emit)(AMD64_BIN_ARGS);
+} amd64_chain_rule;
 
-        case IR_EQUAL:
-        amd64_cmp_rv(R15, bin->right);
-        amd64_sete_r(R15);
-        amd64_movzbq_r(R15);
-        break;
+#include "amd64_bin_rules.h"
 
-        case IR_NOT_EQUAL:
-        amd64_cmp_rv(R15, bin->right);
-        amd64_setne_r(R15);
-        amd64_movzbq_r(R15);
-        break;
+static int amd64_operand_kind(amd64_operand op)
+{
+    if(is_reg_op(op)) return AMD64_NT_R;
+    return is_imm_op(op) ? AMD64_NT_I : AMD64_NT_M;
+}
 
-        default: break;
+// the cheapest way to make the left operand into nt, -1 if there's none
+static int amd64_chain_cost(int nt, AMD64_BIN_ARGS, int* chain)
+{
+    int from = amd64_operand_kind(left);
+    int best = -1;
+
+    *chain = -1;
+    if(nt == from) return 0;
+
+    for(int i = 0; i < AMD64_N_CHAIN_RULES; i++) {
+        if(amd64_chain_rules[i].to != nt || amd64_chain_rules[i].from != from) continue;
+        int cost = amd64_chain_rules[i].cost(op, dst, left, right, is_unsigned);
+        if(cost != -1 && (best == -1 || cost < best)) {
+            best = cost;
+            *chain = i;
+        }
     }
 
-    amd64_spill(R15, result);
+    return best;
 }
 
-void amd64_bin_rmm(ir_bin* bin)
+// computes the result in its register, or in R15 and then stores it if it doesn't have one
+// literal operands become immediates where they fit, and out of the rules that match the operands
+// (either way around for the commutative ops) the one with the lowest cost is emitted
+void amd64_bin(ir_bin* bin)
 {
     FN();
     ir_var* result = bin->result;
-    int reg_result = get_reg(result);
-    if(!check_reg(result)) amd64_spill(reg_result, reg_status[reg_result]);
-    amd64_load(reg_result, bin->left);
-
-    switch(bin->op) {
-        case IR_SUBTRACT:
-        amd64_sub_rv(reg_result, bin->right);
-        break;
-
-        case IR_ADD:
-        amd64_add_rv(reg_result, bin->right);
-        break;
-
-        case IR_MULTIPLY:
-        amd64_imul_rv(reg_result, bin->right);
-        break;
-
-        case IR_LESSER:
-        amd64_cmp_rv(reg_result, bin->right);
-        amd64_setl_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
-
-        case IR_GREATER:
-        amd64_cmp_rv(reg_result, bin->right);
-        amd64_setg_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
-
-        case IR_LESSER_EQUAL:
-        amd64_cmp_rv(reg_result, bin->right);
-        amd64_setle_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
+    int dst = has_reg(result) ? get_reg(result) : R15;
+    int is_unsigned = ir_is_unsigned(bin->type);
+    int is_shift = bin->op == IR_LSHIFT || bin->op == IR_RSHIFT;
+    int fits = amd64_result_fits(bin->op, result->type, bin->left, bin->right);
+    amd64_size_op(bin->op, result->type, fits);
+
+    amd64_operand left = amd64_get_operand(bin->left, dst, -1);
+    amd64_operand right = { -1, bin->right };
+    // only the low 6 bits of a shift count matter, so it's always an immediate
+    if(!is_shift || bin->right->type != IR_LIT) right = amd64_get_operand(bin->right, dst, left.reg);
+    // both would only be in R15 if neither fit in 32 bits, and value numbering folds that
+    assert(!(left.reg == R15 && right.reg == R15));
+
+    if(dst != R15 && !check_reg(result)) {
+        amd64_spill(dst, reg_status[dst]);
+        reg_status[dst] = 0;
+    }
 
-        case IR_GREATER_EQUAL:
-        amd64_cmp_rv(reg_result, bin->right);
-        amd64_setge_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
+    amd64_bin_rule* best = 0;
+    int best_cost = -1, best_chain = -1, best_swapped = 0;
+
+    for(int swapped = 0; swapped <= amd64_bin_commutative(bin->op); swapped++) {
+        ir_op op = swapped ? amd64_swapped_cmp(bin->op) : bin->op;
+        amd64_operand l = swapped ? right : left;
+        amd64_operand r = swapped ? left : right;
+
+        for(int* i = amd64_bin_rules_for(op); *i != -1; i++) {
+            amd64_bin_rule* rule = &amd64_bin_rules[*i];
+            if(rule->right != amd64_operand_kind(r)) continue;
+
+            int chain;
+            int chain_cost = amd64_chain_cost(rule->left, op, dst, l, r, is_unsigned, &chain);
+            if(chain_cost == -1) continue;
+            int cost = rule->cost(op, dst, l, r, is_unsigned);
+            if(cost == -1) continue;
+
+            if(!best || chain_cost + cost < best_cost) {
+                best = rule;
+                best_cost = chain_cost + cost;
+                best_chain = chain;
+                best_swapped = swapped;
+            }
+        }
+    }
 
-        case IR_EQUAL:
-        amd64_cmp_rv(reg_result, bin->right);
-        amd64_sete_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
+    assert(best);
+    if(verbose_asm) printf("--- pattern: %s, cost %d\n", best->pattern, best_cost);
+    ir_op op = best_swapped ? amd64_swapped_cmp(bin->op) : bin->op;
+    amd64_operand l = best_swapped ? right : left;
+    amd64_operand r = best_swapped ? left : right;
 
-        case IR_NOT_EQUAL:
-        amd64_cmp_rv(reg_result, bin->right);
-        amd64_setne_r(reg_result);
-        amd64_movzbq_r(reg_result);
-        break;
+    if(best_chain != -1) amd64_chain_rules[best_chain].emit(op, dst, l, r, is_unsigned);
+    int out = best->emit(op, dst, l, r, is_unsigned);
 
-        default: break;
+    // a store to memory truncates on its own
+    if(dst == R15) {
+        amd64_op_size = 8;
+        amd64_spill(out, result);
+    }
+    else {
+        amd64_mov_rr(dst, out);
+        amd64_truncate(dst, result->type, fits);
+        reg_status[dst] = result;
     }
-
-    reg_status[reg_result] = result;
 }
 
 void amd64_copy_xr(ir_copy* copy)
@@ -885,6 +820,7 @@ void amd64_copy_xr(ir_copy* copy)
     ensure_reg(src);
 
     amd64_store(dst, reg_src);
+    if(has_reg(dst) && !ir_type_contains(dst->type, src->type)) amd64_extend(get_reg(dst), dst->type);
 }
 
 // dst has its register, and src is either a memory operand without its register or a literal
@@ -894,7 +830,12 @@ void amd64_copy_rv(ir_copy* copy)
     ir_var* dst = copy->dst;
     int dst_reg = get_reg(dst);
     if(!check_reg(dst)) amd64_spill(dst_reg, reg_status[dst_reg]);
-    amd64_load(dst_reg, copy->src);
+
+    if(copy->src->type == IR_LIT) amd64_load_lit(dst_reg, ir_canonical(dst->type, copy->src->content.lit.i));
+    else {
+        amd64_load_var(dst_reg, copy->src->content.var);
+        if(!ir_type_contains(dst->type, copy->src->content.var->type)) amd64_extend(dst_reg, dst->type);
+    }
     reg_status[dst_reg] = dst;
 }
 
@@ -905,18 +846,152 @@ void amd64_copy_mm(ir_copy* copy)
     amd64_spill(13, copy->dst);
 }
 
-void amd64_deref_assign(ir_deref_assign* insn)
+// the memory operand for ptr + index * scale + disp, as ir_fold_addresses left it
+// whichever of ptr and index isn't in a register goes into scratch, and if neither is,
+// the index is scaled in scratch and the pointer added to it
+static amd64_arg amd64_address(ir_value* ptr, ir_var* index, int scale, int64_t disp, int scratch)
 {
-    if(insn->src->type == IR_VAR && has_reg(insn->src->content.var) && check_reg(insn->src->content.var)) 
-        amd64_spill(get_reg(insn->src->content.var), insn->src->content.var);
-    
-    if(has_reg(insn->dst)) {
-        if(!check_reg(insn->dst)) amd64_load(R15, insn->dst);
-        else amd64_mov(R15, get_reg(insn->dst));        
+    int index_reg = -1;
+    if(index && has_reg(index)) {
+        ensure_reg(index);
+        index_reg = get_reg(index);
+    }
+
+    if(ptr->type == IR_VAR && has_reg(ptr->content.var)) {
+        ensure_reg(ptr->content.var);
+        int base = get_reg(ptr->content.var);
+        if(!index) return amd64_arg_ind(base, disp);
+        if(index_reg == -1) {
+            amd64_load(scratch, index);
+            index_reg = scratch;
+        }
+        return amd64_arg_sib(base, index_reg, scale, disp);
+    }
+
+    if(index && index_reg == -1) {
+        amd64_load(scratch, index);
+        if(scale > 1) amd64_shl_ri(scratch, log2_exact(scale));
+        amd64_add_rv(scratch, ptr);
+        return amd64_arg_ind(scratch, disp);
     }
-    else amd64_load(R15, insn->dst);
 
-    amd64_copy_through_ptr_rv(R15, insn->src);
+    amd64_mov_rv(scratch, ptr);
+    if(!index) return amd64_arg_ind(scratch, disp);
+    return amd64_arg_sib(scratch, index_reg, scale, disp);
+}
+
+// dst = *(src + index * scale + disp), loaded straight into dst's register,
+// which usually also holds the address while it's computed if the pointer isn't in one
+void amd64_assign_deref(ir_assign_deref* load)
+{
+    FN();
+    ir_var* dst = load->dst;
+    int out = has_reg(dst) ? get_reg(dst) : R15;
+
+    if(out != R15 && !check_reg(dst)) {
+        amd64_spill(out, reg_status[out]);
+        reg_status[out] = 0;
+    }
+
+    // x = *(p + x * 8) can't load p into x's register, that's where the index is
+    int scratch = load->index && strcmp(load->index->name, dst->name) == 0 ? R15 : out;
+    amd64_arg addr = amd64_address(load->src, load->index, load->scale, load->disp, scratch);
+    amd64_mov_ra(out, addr, &load->type);
+
+    if(out == R15) amd64_spill(R15, dst);
+    else {
+        if(!ir_type_contains(dst->type, &load->type)) amd64_extend(out, dst->type);
+        reg_status[out] = dst;
+    }
+}
+
+// *(dst + index * scale + disp) = src
+// the value goes straight from its register or as an immediate, and through R15 only if it's in memory
+// a narrow store takes the low bytes of either
+void amd64_deref_assign(ir_deref_assign* store)
+{
+    FN();
+    ir_value* src = store->src;
+    int value = -1;
+
+    if(src->type == IR_VAR && has_reg(src->content.var)) {
+        ensure_reg(src->content.var);
+        value = get_reg(src->content.var);
+    }
+    else if(src->type == IR_VAR || (ir_type_size(&store->type) == 8 && !amd64_is_imm32(src->content.lit.i))) {
+        amd64_mov_rv(R15, src);
+        value = R15;
+    }
+
+    int scratch = R15;
+    if(value == R15) {
+        int ptr_reg = has_reg(store->dst) ? get_reg(store->dst) : -1;
+        int index_reg = store->index && has_reg(store->index) ? get_reg(store->index) : -1;
+        // the address only needs a register of its own if the pointer or the index is in memory
+        if(ptr_reg == -1 || (store->index && index_reg == -1)) scratch = amd64_scratch(ptr_reg, index_reg);
+    }
+
+    ir_value ptr = { .content.var = store->dst, .type = IR_VAR };
+    amd64_arg addr = amd64_address(&ptr, store->index, store->scale, store->disp, scratch);
+
+    if(value == -1) amd64_mov_ai(addr, src->content.lit.i, &store->type);
+    else amd64_mov_ar(addr, value, &store->type);
+}
+
+// value in a register, its own or a scratch one that's neither of the ones to avoid
+static int amd64_select_reg(ir_value* value, int avoid1, int avoid2)
+{
+    if(value->type == IR_VAR && has_reg(value->content.var)) {
+        ensure_reg(value->content.var);
+        return get_reg(value->content.var);
+    }
+    int reg = amd64_scratch(avoid1, avoid2);
+    amd64_load(reg, value);
+    return reg;
+}
+
+// result = cond ? if_true : if_false without a branch: one side goes into the result's register,
+// and a cmov replaces it with the other one depending on cond
+// the result never shares a register with the operands unless it's one of them, see ir_get_interference_graph
+void amd64_select(ir_select* select)
+{
+    FN();
+    ir_var* result = select->result;
+    int dst = has_reg(result) ? get_reg(result) : R15;
+    // x = c ? x : y has x where it has to be already, so y is moved in when c is zero instead
+    int inverted = select->if_true->type == IR_VAR && strcmp(select->if_true->content.var->name, result->name) == 0;
+    ir_value* keep = inverted ? select->if_true : select->if_false;
+    ir_value* pick = inverted ? select->if_false : select->if_true;
+
+    if(dst != R15 && !check_reg(result)) {
+        amd64_spill(dst, reg_status[dst]);
+        reg_status[dst] = 0;
+    }
+    // a condition that is the result itself has to be copied out before its register gets the kept side
+    int cond = -1;
+    if(select->cond->type == IR_VAR && strcmp(select->cond->content.var->name, result->name) == 0) {
+        int keep_reg = keep->type == IR_VAR && has_reg(keep->content.var) ? get_reg(keep->content.var) : -1;
+        cond = amd64_select_reg(select->cond, dst, keep_reg);
+        if(cond == dst) {
+            cond = amd64_scratch(dst, keep_reg);
+            amd64_mov_rr(cond, dst);
+        }
+    }
+    // loading a zero is a xor, so everything is loaded before the test
+    if(keep->type == IR_VAR && has_reg(keep->content.var)) {
+        ensure_reg(keep->content.var);
+        amd64_mov_rr(dst, get_reg(keep->content.var));
+    }
+    else amd64_load(dst, keep);
+
+    if(cond == -1) cond = amd64_select_reg(select->cond, dst, -1);
+    int other = amd64_select_reg(pick, dst, cond);
+    amd64_test_rr(cond, cond);
+    if(inverted) amd64_cmove_rr(other, dst);
+    else amd64_cmovne_rr(other, dst);
+
+    if(dst == R15) amd64_spill(R15, result);
+    else reg_status[dst] = result;
 }
 
 void amd64_condjmp(ir_if* condjmp)
@@ -936,7 +1011,7 @@ void amd64_condjmp(ir_if* condjmp)
     }
     
     amd64_test_rr(cond_reg, cond_reg);
-    amd64_jnz_r(condjmp->if_true);
+    amd64_jnz_r(ir_label_name(condjmp->if_true));
 
     //if(condjmp->if_false) {
     //    asm_add("__if_false\n");
@@ -945,7 +1020,7 @@ void amd64_condjmp(ir_if* condjmp)
 
 void amd64_exit(ir_return* ret)
 {
-    asm_add("movq $60, %%rax\n");
+    amd64_mov_ri(RAX, 60);
     if(ret->value) {
         if(ret->value->type == IR_VAR && has_reg(ret->value->content.var) && check_reg(ret->value->content.var)) 
             amd64_mov(5, get_reg(ret->value->content.var));
@@ -953,5 +1028,5 @@ void amd64_exit(ir_return* ret)
     }
     else amd64_load_lit(5, 0);
 
-    asm_add("syscall\n");
+    amd64_emit0("syscall");
 }
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+// compile throughput benchmark, the benchmark() target in meson.build
+// generates programs of doubling size with imgen, once with more and more functions and once with bigger
+// and bigger functions, and compiles each one with imc --asm-only --time-passes-json
+// it prints lines per second for every size, and for every phase its CPU time, allocated bytes and peak RSS
+// on the biggest program, with how they grew from the one before as an exponent of the number of lines
+// a phase whose time or allocated bytes grow faster than lines^1.5 is flagged as super-linear
+// last, one program of about a million IR instructions is compiled on its own for the passes that insert code
+
+#define MAX_STEPS 7 // fn_symtable holds 1009 functions
+#define MAX_PHASES 128
+#define SUPERLINEAR 1.5 // flagged above this exponent
+#define MIN_MS 2.0 // times below this are too noisy to tell anything
+#define INSERT_PROGRAM "-f 1000 -s 15 -d 2 -v 8 -c 0" // about 500k lines, a million IR instructions once lowered
+
+typedef struct {
+    char path[256];
+    double cpu_ms[MAX_STEPS];
+    double bytes[MAX_STEPS];
+    long peak_rss[MAX_STEPS];
+} bench_phase;
+
+static char* imc;
+static char* imgen;
+static char dir[] = "/tmp/imc_bench.XXXXXX";
+static bench_phase phases[MAX_PHASES];
+static int n_phases;
+
+static bench_phase* find_phase(char* path)
+{
+    for(int i = 0; i < n_phases; i++) if(strcmp(phases[i].path, path) == 0) return &phases[i];
+    if(n_phases == MAX_PHASES) return 0;
+    bench_phase* p = &phases[n_phases++];
+    memset(p, 0, sizeof(bench_phase));
+    strcpy(p->path, path);
+    return p;
+}
+
+static int count_lines(char* file)
+{
+    FILE* f = fopen(file, "r");
+    if(!f) return 0;
+    int n = 0, c;
+    while((c = fgetc(f)) != EOF) if(c == '\n') n++;
+    fclose(f);
+    return n;
+}
+
+// reads what imc --time-passes-json wrote, one phase per line
+static int read_phases(char* file, int step)
+{
+    FILE* f = fopen(file, "r");
+    if(!f) return 0;
+    char line[1024];
+    while(fgets(line, sizeof(line), f)) {
+        char path[256];
+        int depth, runs;
+        double wall, cpu;
+        unsigned long allocs, bytes;
+        long rss;
+        if(sscanf(line, " { \"path\": \"%255[^\"]\", \"depth\": %d, \"runs\": %d, \"wall_ms\": %lf, \"cpu_ms\": %lf, \"allocs\": %lu, \"bytes\": %lu, \"peak_rss_kib\": %ld",
+                  path, &depth, &runs, &wall, &cpu, &allocs, &bytes, &rss) != 8) continue;
+        bench_phase* p = find_phase(path);
+        if(!p) continue;
+        p->cpu_ms[step] = cpu;
+        p->bytes[step] = bytes;
+        p->peak_rss[step] = rss;
+    }
+    fclose(f);
+    return 1;
+}
+
+// the exponent k in b / a = (lines_b / lines_a)^k
+static double growth(double a, double b, int lines_a, int lines_b)
+{
+    return a > 0 && b > 0 && lines_b > lines_a ? log(b / a) / log((double) lines_b / lines_a) : 0;
+}
+
+// runs one series, where only the option opt of imgen doubles with every step
+static int run_series(char* name, char* opt, int base, char* fixed, int steps)
+{
+    char cmd[1024], im[256], json[256];
+    int lines[MAX_STEPS];
+    double total_ms[MAX_STEPS];
+    n_phases = 0;
+
+    printf("series: %s (imgen %s)\n", name, fixed);
+    printf("    %10s%10s%12s%12s\n", name, "lines", "lines/s", "peak KiB");
+    for(int s = 0; s < steps; s++) {
+        int n = base << s;
+        sprintf(im, "%s/%s%d.im", dir, name, n);
+        sprintf(json, "%s/%s%d.json", dir, name, n);
+        sprintf(cmd, "%s %s %s %d > %s", imgen, fixed, opt, n, im);
+        if(system(cmd)) return 0;
+        sprintf(cmd, "%s --asm-only --time-passes-json %s -o %s/out.s %s > /dev/null", imc, json, dir, im);
+        if(system(cmd) || !read_phases(json, s)) {
+            printf("imc failed on %s\n", im);
+            return 0;
+        }
+
+        lines[s] = count_lines(im);
+        bench_phase* root = find_phase("imc");
+        total_ms[s] = root->cpu_ms[s];
+        printf("    %10d%10d%12.0f%12ld\n", n, lines[s], total_ms[s] > 0 ? lines[s] / (total_ms[s] / 1e3) : 0, root->peak_rss[s]);
+    }
+
+    // the last two steps are the least noisy
+    int a = steps - 2, b = steps - 1;
+    int flagged = 0;
+    printf("    %-48s%12s%8s%14s%8s%12s\n", "phase", "cpu ms", "growth", "bytes", "growth", "peak KiB");
+    for(int i = 0; i < n_phases; i++) {
+        bench_phase* p = &phases[i];
+        double time_growth = growth(p->cpu_ms[a], p->cpu_ms[b], lines[a], lines[b]);
+        double bytes_growth = growth(p->bytes[a], p->bytes[b], lines[a], lines[b]);
+        int slow = p->cpu_ms[b] >= MIN_MS && time_growth > SUPERLINEAR;
+        int big = bytes_growth > SUPERLINEAR;
+        printf("    %-48s%12.3f%8.2f%14.0f%8.2f%12ld%s\n", p->path, p->cpu_ms[b], time_growth, p->bytes[b], bytes_growth,
+               p->peak_rss[b], slow || big ? "  super-linear" : "");
+        flagged += slow || big;
+    }
+    printf("    %d of %d phases grow super-linearly\n\n", flagged, n_phases);
+    return 1;
+}
+
+// the loop passes put a preheader in front of every loop they change, and strength reduction adds the bumps,
+// so on a program this size anything that moves the rest of the program per insertion shows right away
+static int run_insertions(void)
+{
+    static char* passes[] = { "imc/ir_init/ir_hoist_loop_invariants", "imc/ir_init/ir_reduce_induction_variables", "imc" };
+    char cmd[1024], im[256], json[256];
+    n_phases = 0;
+
+    sprintf(im, "%s/insert.im", dir);
+    sprintf(json, "%s/insert.json", dir);
+    sprintf(cmd, "%s %s > %s", imgen, INSERT_PROGRAM, im);
+    if(system(cmd)) return 0;
+    sprintf(cmd, "%s --asm-only --time-passes-json %s -o %s/out.s %s > /dev/null", imc, json, dir, im);
+    if(system(cmd) || !read_phases(json, 0)) {
+        printf("imc failed on %s\n", im);
+        return 0;
+    }
+
+    printf("insertions (imgen %s): %d lines\n", INSERT_PROGRAM, count_lines(im));
+    printf("    %-48s%12s%14s\n", "phase", "cpu ms", "bytes");
+    for(int i = 0; i < sizeof(passes) / sizeof(char*); i++) {
+        bench_phase* p = find_phase(passes[i]);
+        printf("    %-48s%12.3f%14.0f\n", p->path, p->cpu_ms[0], p->bytes[0]);
+    }
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 3) {
+        printf("Usage: compile_bench [imc] [imgen] [steps]\n");
+        return 1;
+    }
+    imc = argv[1];
+    imgen = argv[2];
+    int steps = argc > 3 ? atoi(argv[3]) : 5;
+    if(steps < 2 || steps > MAX_STEPS) steps = 5;
+    if(!mkdtemp(dir)) {
+        printf("compile_bench: couldn't create %s\n", dir);
+        return 1;
+    }
+
+    int ok = run_series("functions", "-f", 8, "-s 8 -d 2 -v 8 -c 10", steps)
+          && run_series("statements", "-s", 4, "-f 4 -d 1 -v 8 -c 10", steps)
+          && run_insertions();
+
+    char cmd[256];
+    sprintf(cmd, "rm -rf %s", dir);
+    system(cmd);
+    return !ok;
+}
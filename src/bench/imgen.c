@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// generates a synthetic IMPERIVM C program for benchmarking the compiler
+// every function takes one long and has a number of vars, its body is a block of statements where
+// some statements are ifs and loops with blocks of their own, nested up to the given depth,
+// and some are calls to the functions defined before it
+// a block at any depth has the same number of statements, so the size grows quickly with the depth
+// the program is meant to be compiled, the loops are counted so it does terminate when run,
+// but with calls in loops that can take very long
+
+static int n_fns = 16;
+static int n_stmts = 8;
+static int max_depth = 2;
+static int n_vars = 8;
+static int call_density = 10; // percent of the statements that are calls
+static int n_loops = 0; // for naming the loop counters
+
+static int rnd(int n)
+{
+    return rand() % n;
+}
+
+static void indent(int level)
+{
+    for(int i = 0; i <= level; i++) printf("    ");
+}
+
+static void gen_expr(void)
+{
+    static char* ops[] = { "+", "-", "*", "+", "-" };
+    if(rnd(4)) printf("x%d %s x%d", rnd(n_vars), ops[rnd(5)], rnd(n_vars));
+    else printf("x%d %s %d", rnd(n_vars), ops[rnd(5)], rnd(100));
+}
+
+static void gen_cond(void)
+{
+    static char* ops[] = { "<", ">", "==", "!=", "<=", ">=" };
+    printf("x%d %s x%d", rnd(n_vars), ops[rnd(6)], rnd(n_vars));
+}
+
+static void gen_block(int fn, int level);
+
+static void gen_stmt(int fn, int level)
+{
+    int r = rnd(100);
+
+    if(level < max_depth && r < 15) {
+        indent(level);
+        printf("if(");
+        gen_cond();
+        printf(") {\n");
+        gen_block(fn, level + 1);
+        indent(level);
+        if(rnd(2)) {
+            printf("}\n");
+            return;
+        }
+        printf("}\n");
+        indent(level);
+        printf("else {\n");
+        gen_block(fn, level + 1);
+        indent(level);
+        printf("}\n");
+    }
+    else if(level < max_depth && r < 25) {
+        // a counted loop, so that the program terminates
+        int counter = n_loops++;
+        indent(level);
+        printf("long c%d = 0;\n", counter);
+        indent(level);
+        printf("while(c%d < %d) {\n", counter, 2 + rnd(8));
+        gen_block(fn, level + 1);
+        indent(level + 1);
+        printf("c%d = c%d + 1;\n", counter, counter);
+        indent(level);
+        printf("}\n");
+    }
+    else if(fn > 0 && r < 25 + call_density) {
+        indent(level);
+        printf("x%d = f%d(x%d);\n", rnd(n_vars), rnd(fn), rnd(n_vars));
+    }
+    else {
+        indent(level);
+        printf("x%d = ", rnd(n_vars));
+        gen_expr();
+        printf(";\n");
+    }
+}
+
+static void gen_block(int fn, int level)
+{
+    for(int i = 0; i < n_stmts; i++) gen_stmt(fn, level);
+}
+
+static void gen_fn(int fn)
+{
+    printf("long f%d(long a)\n{\n", fn);
+    for(int i = 0; i < n_vars; i++) printf("    long x%d = a + %d;\n", i, i);
+    gen_block(fn, 0);
+    printf("    return x%d;\n}\n\n", rnd(n_vars));
+}
+
+static void usage(void)
+{
+    printf("Usage: imgen [options]\nOptions:\n");
+    printf("    %-12s%s\n", "-f [n]", "Number of functions (16)");
+    printf("    %-12s%s\n", "-s [n]", "Statements per block (8)");
+    printf("    %-12s%s\n", "-d [n]", "How deep ifs and loops nest (2)");
+    printf("    %-12s%s\n", "-v [n]", "Vars per function (8)");
+    printf("    %-12s%s\n", "-c [n]", "Percent of the statements that are calls (10)");
+    printf("    %-12s%s\n", "-r [n]", "Random seed (1)");
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    int seed = 1;
+    int c;
+    while((c = getopt(argc, argv, "f:s:d:v:c:r:")) != -1) {
+        switch(c) {
+            case 'f': n_fns = atoi(optarg); break;
+            case 's': n_stmts = atoi(optarg); break;
+            case 'd': max_depth = atoi(optarg); break;
+            case 'v': n_vars = atoi(optarg); break;
+            case 'c': call_density = atoi(optarg); break;
+            case 'r': seed = atoi(optarg); break;
+            default: usage();
+        }
+    }
+    if(n_fns < 1 || n_stmts < 1 || max_depth < 0 || n_vars < 1) usage();
+    srand(seed);
+
+    for(int i = 0; i < n_fns; i++) gen_fn(i);
+
+    printf("int main()\n{\n    long s = 0;\n");
+    for(int i = 0; i < n_fns; i++) printf("    s = s + f%d(%d);\n", i, i);
+    printf("    return s %% 256;\n}\n");
+    return 0;
+}
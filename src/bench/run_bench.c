@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// runtime benchmark for the generated code, the benchmark() target in meson.build
+// every .im file in the bench directory is a kernel, compiled with imc and, as the C it also is, with gcc -O0 and -O2
+// each binary runs a number of times and the fastest run counts, with cycles and instructions from perf_event_open
+// when the kernel allows it, otherwise only the time
+// the exit codes of the three have to agree, which catches miscompiles along the way
+// prints a table and writes the same as JSON for tracking over time
+
+#define MAX_KERNELS 64
+#define N_COMPILERS 3
+
+typedef struct {
+    double ms; // the fastest run
+    int64_t cycles, instructions; // of that run, -1 without perf events
+    int status;
+} bench_result;
+
+typedef struct {
+    char name[256];
+    bench_result results[N_COMPILERS];
+    int ok; // it built and all three exit the same way
+} bench_kernel;
+
+static char* compilers[N_COMPILERS] = { "imc", "gcc -O0", "gcc -O2" };
+static char* json_names[N_COMPILERS] = { "imc", "gcc_O0", "gcc_O2" };
+
+static char* imc;
+static char* bench_dir;
+static int reps = 5;
+static char dir[] = "/tmp/imc_run.XXXXXX";
+static bench_kernel kernels[MAX_KERNELS];
+static int n_kernels;
+static int have_perf = 1;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int perf_counter(pid_t pid, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+static int64_t perf_read(int fd)
+{
+    int64_t n;
+    if(fd < 0 || read(fd, &n, sizeof(n)) != sizeof(n)) n = -1;
+    if(fd >= 0) close(fd);
+    return n;
+}
+
+// runs the binary once, the child waits on a pipe until its counters are open so they start counting at exec
+static int run_once(char* binary, bench_result* r)
+{
+    int go[2];
+    if(pipe(go)) return 0;
+    pid_t pid = fork();
+    if(pid == 0) {
+        char c;
+        close(go[1]);
+        if(read(go[0], &c, 1) != 1) _exit(127);
+        execl(binary, binary, (char*) 0);
+        _exit(127);
+    }
+    close(go[0]);
+
+    int cycles = -1, insns = -1;
+    if(have_perf) {
+        cycles = perf_counter(pid, PERF_COUNT_HW_CPU_CYCLES);
+        insns = perf_counter(pid, PERF_COUNT_HW_INSTRUCTIONS);
+        if(cycles < 0 || insns < 0) have_perf = 0;
+    }
+
+    double start = now();
+    write(go[1], "x", 1);
+    close(go[1]);
+    int status;
+    waitpid(pid, &status, 0);
+    double ms = (now() - start) * 1e3;
+
+    int64_t n_cycles = perf_read(cycles), n_insns = perf_read(insns);
+    if(r->ms < 0 || ms < r->ms) {
+        r->ms = ms;
+        r->cycles = have_perf ? n_cycles : -1;
+        r->instructions = have_perf ? n_insns : -1;
+    }
+    r->status = WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status);
+    return 1;
+}
+
+static int compile(int compiler, char* src, char* binary)
+{
+    char cmd[4096];
+    if(compiler == 0) sprintf(cmd, "%s %s -o %s > /dev/null 2>&1", imc, src, binary);
+    else sprintf(cmd, "gcc -w -x c %s %s -o %s", compiler == 1 ? "-O0" : "-O2", src, binary);
+    return system(cmd) == 0;
+}
+
+static void run_kernel(bench_kernel* k)
+{
+    char src[1024], binary[1024];
+    sprintf(src, "%s/%s.im", bench_dir, k->name);
+    k->ok = 1;
+    for(int c = 0; c < N_COMPILERS; c++) {
+        bench_result* r = &k->results[c];
+        *r = (bench_result) { -1, -1, -1, -1 };
+        sprintf(binary, "%s/%s.%d", dir, k->name, c);
+        if(!compile(c, src, binary)) {
+            printf("%s: %s failed to compile it\n", k->name, compilers[c]);
+            k->ok = 0;
+            return;
+        }
+        for(int i = 0; i < reps; i++) run_once(binary, r);
+        if(r->status != k->results[0].status) k->ok = 0;
+    }
+}
+
+static int compare_kernels(const void* a, const void* b)
+{
+    return strcmp(((bench_kernel*) a)->name, ((bench_kernel*) b)->name);
+}
+
+static int find_kernels(void)
+{
+    DIR* d = opendir(bench_dir);
+    if(!d) return 0;
+    struct dirent* e;
+    while((e = readdir(d)) && n_kernels < MAX_KERNELS) {
+        int len = strlen(e->d_name);
+        if(len < 4 || strcmp(e->d_name + len - 3, ".im")) continue;
+        snprintf(kernels[n_kernels].name, sizeof(kernels[n_kernels].name), "%.*s", len - 3, e->d_name);
+        n_kernels++;
+    }
+    closedir(d);
+    qsort(kernels, n_kernels, sizeof(bench_kernel), compare_kernels);
+    return 1;
+}
+
+// how many times faster imc's code is than gcc's, below 1 when it's slower
+static double speedup(bench_kernel* k, int compiler)
+{
+    return k->results[0].ms > 0 ? k->results[compiler].ms / k->results[0].ms : 0;
+}
+
+static void print_table(void)
+{
+    printf("%-12s%-10s%12s%16s%16s%10s\n", "kernel", "compiler", "ms", "cycles", "instructions", "speedup");
+    for(int i = 0; i < n_kernels; i++) {
+        bench_kernel* k = &kernels[i];
+        for(int c = 0; c < N_COMPILERS; c++) {
+            bench_result* r = &k->results[c];
+            printf("%-12s%-10s%12.2f", c ? "" : k->name, compilers[c], r->ms);
+            if(r->cycles < 0) printf("%16s%16s", "-", "-");
+            else printf("%16ld%16ld", r->cycles, r->instructions);
+            if(c) printf("%10.2f", speedup(k, c));
+            printf("\n");
+        }
+        if(!k->ok) printf("%-12sexit codes differ: imc %d, gcc -O0 %d, gcc -O2 %d\n", "", k->results[0].status,
+                          k->results[1].status, k->results[2].status);
+    }
+    if(!have_perf) printf("perf events aren't available, so there are no cycles or instructions\n");
+}
+
+static void print_counter(FILE* f, char* name, int64_t n)
+{
+    if(n < 0) fprintf(f, "\"%s\": null", name);
+    else fprintf(f, "\"%s\": %ld", name, n);
+}
+
+static int write_json(char* file)
+{
+    FILE* f = fopen(file, "w");
+    if(!f) return 0;
+    fprintf(f, "{\n    \"reps\": %d,\n    \"kernels\": [\n", reps);
+    for(int i = 0; i < n_kernels; i++) {
+        bench_kernel* k = &kernels[i];
+        fprintf(f, "        {\n            \"name\": \"%s\",\n            \"ok\": %s,\n", k->name, k->ok ? "true" : "false");
+        for(int c = 0; c < N_COMPILERS; c++) {
+            bench_result* r = &k->results[c];
+            fprintf(f, "            \"%s\": { \"ms\": %.3f, ", json_names[c], r->ms);
+            print_counter(f, "cycles", r->cycles);
+            fprintf(f, ", ");
+            print_counter(f, "instructions", r->instructions);
+            fprintf(f, ", \"status\": %d },\n", r->status);
+        }
+        fprintf(f, "            \"speedup_gcc_O0\": %.3f,\n", speedup(k, 1));
+        fprintf(f, "            \"speedup_gcc_O2\": %.3f\n", speedup(k, 2));
+        fprintf(f, "        }%s\n", i + 1 < n_kernels ? "," : "");
+    }
+    fprintf(f, "    ]\n}\n");
+    fclose(f);
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 4) {
+        printf("Usage: run_bench [imc] [bench directory] [json file] [reps]\n");
+        return 1;
+    }
+    imc = argv[1];
+    bench_dir = argv[2];
+    if(argc > 4 && atoi(argv[4]) > 0) reps = atoi(argv[4]);
+    if(!find_kernels() || !n_kernels) {
+        printf("run_bench: no kernels in %s\n", bench_dir);
+        return 1;
+    }
+    if(!mkdtemp(dir)) {
+        printf("run_bench: couldn't create %s\n", dir);
+        return 1;
+    }
+
+    int ok = 1;
+    for(int i = 0; i < n_kernels; i++) {
+        run_kernel(&kernels[i]);
+        ok &= kernels[i].ok;
+    }
+    print_table();
+    if(!write_json(argv[3])) {
+        printf("run_bench: couldn't open %s\n", argv[3]);
+        ok = 0;
+    }
+
+    char cmd[256];
+    sprintf(cmd, "rm -rf %s", dir);
+    system(cmd);
+    return !ok;
+}
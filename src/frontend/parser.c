@@ -47,47 +47,38 @@ void expect(token_type t, char* err)
     current_token++;
 }
 
-// Get a copy of the expression's type info. If it's NULL, return LONG_T.
+// every type is made once and shared from then on, so nothing writes to a type_info and equal types are equal pointers
+static type_info** types[ULONG_T + 1]; // by base type, then by pointer layers
+static uint64_t n_types[ULONG_T + 1];
+
+type_info* type_get(base_type base, uint64_t ptr_layers)
+{
+    if(ptr_layers >= n_types[base]) {
+        uint64_t n = ptr_layers + 4;
+        types[base] = realloc(types[base], n * sizeof(type_info*));
+        memset(types[base] + n_types[base], 0, (n - n_types[base]) * sizeof(type_info*));
+        n_types[base] = n;
+    }
+    if(!types[base][ptr_layers]) {
+        type_info* type = malloc(sizeof(type_info));
+        *type = (type_info) { base, ptr_layers };
+        types[base][ptr_layers] = type;
+    }
+    return types[base][ptr_layers];
+}
+
+// Get the expression's type info. If it's NULL, return LONG_T.
 type_info* expr_get_type(ast_expr* e)
 {
     switch(e->type) {
-        case EXPR_NONE: goto long_type;
-        
-        case EXPR_UNARY: {
-            if(!e->content.un.type) goto long_type;
-            type_info* type = malloc(sizeof(type_info));
-            memcpy(type, e->content.un.type, sizeof(type_info));
-            return type;
-        }
-
-        case EXPR_BINARY: {
-            if(!e->content.bin.type) goto long_type;
-            type_info* type = malloc(sizeof(type_info));
-            memcpy(type, e->content.bin.type, sizeof(type_info));
-            return type;
-        }
-
-        case EXPR_VARIABLE: {
-            if(!e->content.var.type) goto long_type;
-            type_info* type = malloc(sizeof(type_info));
-            memcpy(type, e->content.var.type, sizeof(type_info));
-            return type;
-        }
-
-        case EXPR_FN_CALL: {
-            type_info* type = malloc(sizeof(type_info));
-            memcpy(type, e->content.call.fn->ret_type, sizeof(type_info));
-            return type;
-        }
-
-        case EXPR_LITERAL: goto long_type;
+        case EXPR_NONE: break;
+        case EXPR_UNARY: if(e->content.un.type) return e->content.un.type; break;
+        case EXPR_BINARY: if(e->content.bin.type) return e->content.bin.type; break;
+        case EXPR_VARIABLE: if(e->content.var.type) return e->content.var.type; break;
+        case EXPR_FN_CALL: return e->content.call.fn->ret_type;
+        case EXPR_LITERAL: break;
     }
-
-    long_type:;
-    type_info* type = malloc(sizeof(type_info));
-    type->base = LONG_T;
-    type->ptr_layers = 0;
-    return type;
+    return type_get(LONG_T, 0);
 }
 
 int get_op_prec(token_type type)
@@ -95,6 +86,7 @@ int get_op_prec(token_type type)
     switch(type) {
         case OR_OR: return 5;
         case AND_AND: return 6;
+        case LESSER_LESSER: case GREATER_GREATER: return 8;
         case PLUS: case MINUS: return 10;
         case STAR: case SLASH: case PERCENT: return 20;
         case LESSER: case GREATER: case LESSER_EQUAL: case GREATER_EQUAL: return 30;
@@ -212,9 +204,9 @@ ast_expr* parse_nud(void)
             e->content.un.op = O_DEREFERENCE;
             e->content.un.e = operand;
 
-            e->content.un.type = expr_get_type(operand);
-            if(!e->content.un.type->ptr_layers) report_error(t->line, "Dereferencing a non-pointer");
-            e->content.un.type->ptr_layers--;
+            type_info* type = expr_get_type(operand);
+            if(!type->ptr_layers) report_error(t->line, "Dereferencing a non-pointer");
+            e->content.un.type = type_get(type->base, type->ptr_layers - 1);
             break;
         }
 
@@ -226,8 +218,8 @@ ast_expr* parse_nud(void)
             e->content.un.op = O_REFERENCE;
             e->content.un.e = operand;
 
-            e->content.un.type = expr_get_type(operand);
-            e->content.un.type->ptr_layers++;
+            type_info* type = expr_get_type(operand);
+            e->content.un.type = type_get(type->base, type->ptr_layers + 1);
             break;
         }
 
@@ -326,7 +318,7 @@ type_info* parse_type(void)
     token* t1 = 0;
     token* t2 = 0;
     token* t3 = 0;
-    type_info* t = malloc(sizeof(type_info));
+    base_type base;
 
     if(token_is(peek(), 6, SIGNED, UNSIGNED, LONG, INT, CHAR, VOID)) t1 = advance();
     if(token_is(peek(), 6, SIGNED, UNSIGNED, LONG, INT, CHAR, VOID)) t2 = advance();
@@ -373,19 +365,19 @@ type_info* parse_type(void)
         if(t1->type == VOID) goto _void;
     }
 
-    _signed_long:    t->base = LONG_T;   goto ptrs;
-    _unsigned_long:  t->base = ULONG_T;  goto ptrs;
-    _signed_int:     t->base = INT_T;    goto ptrs;
-    _unsigned_int:   t->base = UINT_T;   goto ptrs;
-    _signed_char:    t->base = CHAR_T;   goto ptrs;
-    _unsigned_char:  t->base = UCHAR_T;  goto ptrs;
-    _void:           t->base = VOID_T;   goto ptrs;
+    _signed_long:    base = LONG_T;   goto ptrs;
+    _unsigned_long:  base = ULONG_T;  goto ptrs;
+    _signed_int:     base = INT_T;    goto ptrs;
+    _unsigned_int:   base = UINT_T;   goto ptrs;
+    _signed_char:    base = CHAR_T;   goto ptrs;
+    _unsigned_char:  base = UCHAR_T;  goto ptrs;
+    _void:           base = VOID_T;   goto ptrs;
 
-    ptrs:
-    t->ptr_layers = 0;
-    while(match(STAR)) t->ptr_layers++;
+    ptrs:;
+    uint64_t ptr_layers = 0;
+    while(match(STAR)) ptr_layers++;
 
-    return t;
+    return type_get(base, ptr_layers);
 }
 
 ast_stmt* parse_block(ast_ctxt* ctxt)
@@ -504,7 +496,7 @@ ast_stmt* parse_fn_decl(type_info* type, token* name)
     // they need to be pruned from the param vector
     for(int i = 0; i < fn->content.fn.params->n_values; i++)
         if(vector_ast_var_contains(root->content.b.ctxt->vars, fn->content.fn.params->values[i]))
-            vector_ast_var_remove(fn->content.fn.params, i);
+            vector_ast_var_remove(fn->content.fn.params, i--);
 
     if(is(LBRACE)) {
         // parse the function body
@@ -47,6 +47,9 @@ typedef enum {
     IR_SUBTRACT,
     IR_MULTIPLY,
     IR_DIVIDE,
+    IR_MODULO,
+    IR_LSHIFT,
+    IR_RSHIFT,
     IR_LESSER,
     IR_GREATER,
     IR_LESSER_EQUAL,
@@ -97,37 +100,54 @@ typedef struct {
     ir_value* src;
 } ir_copy;
 
+// labels are numbers handed out by ir_autolabel and ir_fn_label, 0 meaning no label
+// they only turn into text when something prints them, see ir_label_name
+
 typedef struct {
-    char* dst;
+    int dst;
 } ir_goto;
 
 typedef struct {
     ir_value* cond;
-    char* if_true;
-    char* if_false; // basically `else`, can be null
+    int if_true;
+    int if_false; // basically `else`, can be 0
 } ir_if;
 
+typedef struct {
+    ir_var* result;
+    ir_value* cond;
+    ir_value* if_true; // picked if cond isn't zero
+    ir_value* if_false;
+} ir_select;
+
 typedef struct {
     char* fn_label;
     vector_ir_value* args;
     ir_var* result;
     ast_fn* ast_fn;
+    int is_tail; // set if the result is returned right away, see IR_tail.c
 } ir_fn_call;
 
 typedef struct {
     char* fn_label;
     vector_ir_value* args;
+    int is_tail;
 } ir_proc_call;
 
 typedef struct {
     char* fn; // the function/procedure this return call belongs to
     ir_value* value; // null in case of a procedure
-    int is_last; // set to 1 if this is the last return statement in its function
 } ir_return;
 
 struct ir_ptr_stuff {
     ir_var* dst;
     ir_value* src;
+    // loads and stores can have more of the address folded in by ir_fold_addresses,
+    // which is then the pointer (src of a load, dst of a store) + index * scale + disp
+    ir_var* index; // null if there's none
+    int scale;
+    int64_t disp;
+    type_info type; // of the value in memory
 };
 
 typedef struct ir_ptr_stuff ir_assign_ref; // dst = &src
@@ -147,6 +167,7 @@ typedef struct ir_insn {
         ir_assign_ref assign_ref;
         ir_assign_deref assign_deref;
         ir_deref_assign deref_assign;
+        ir_select select;
     } content;
     enum {
         IR_NOP,
@@ -161,8 +182,9 @@ typedef struct ir_insn {
         IR_ASSIGN_REF, // x = &y
         IR_ASSIGN_DEREF, // x = *y
         IR_DEREF_ASSIGN, // *x = y
+        IR_SELECT, // x = c ? y : z, see IR_select.c
     } type;
-    char* label; // usually null, only set in case there's a label on that line
+    int label; // usually 0, only set in case there's a label on that line
 } ir_insn;
 
 // just don't think about this too hard
@@ -181,14 +203,34 @@ extern vector_ir_insn* ir;
 extern char* ir_output;
 extern int verbose_asm;
 extern int print_blocks;
+extern int inline_threshold; // see IR_inline.c
+extern int select_limit; // see IR_select.c
+extern int n_temps, n_labels, n_inlined; // the numbers the next temporary, label and inlined call get
 extern hashmap_ast_fn_vector_ir_var* fn_symtable; // holds all parameters for each function
 
 ir_value* ir_expr(ast_expr* e);
-ir_var* ir_dummy_var(void);
 ir_var* ir_temp(type_info*);
 ir_value* ir_value_lit(long);
-char* ir_autolabel(void);
+ir_value* ir_value_var(ir_var*);
+int ir_is_unsigned(type_info*);
+int ir_type_size(type_info*);
+int64_t ir_canonical(type_info*, int64_t);
+int ir_type_contains(type_info* to, type_info* from);
+type_info ir_pointee(type_info*);
+int ir_autolabel(void);
+int ir_fn_label(ast_fn* fn);
+int ir_named_label(char* name);
+char* ir_label_name(int label);
+ast_fn* ir_label_fn(int label);
 var_vector* ir_get_vars(int start, int end);
 var_graph* ir_get_interference_graph(var_vector* vars, int start, int end);
+void ir_optimize(void);
+void ir_read(char* src); // see IR_read.c
+void ir_reserve_name(char* name);
+int ir_save(char* file); // see IR_binary.c
+int ir_load(char* file);
+
+// variable names end in .g for globals, .l for locals and temporaries, and .p for parameters
+static inline int ir_is_global(ir_var* var) { return var->name[strlen(var->name)-1] == 'g'; }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,79 @@
+#ifndef _IMPERIVM_IR_IR_CFG_H
+#define _IMPERIVM_IR_IR_CFG_H
+
+#include <IR/IR.h>
+#include <util/bitset.h>
+
+// control flow graph of a single function
+// unlike the blocks handed out by ir_get_block, which also end at calls because the backend
+// spills everything around them, these are basic blocks in the textbook sense:
+// they start at a label or after a jump, and end with a jump, a return, or right before a label
+
+typedef struct ir_block {
+    int start; // index of the first instruction in ir
+    int end;   // one past the last instruction
+    vector_int* succs; // indices into cfg->blocks
+    vector_int* preds;
+    uint64_t* use; // vars read in the block before being written to
+    uint64_t* def; // vars written to in the block
+    uint64_t* live_in;
+    uint64_t* live_out;
+    int idom; // immediate dominator, -1 for the entry and unreachable blocks
+    int rpo; // position in reverse postorder, -1 if unreachable
+    vector_int* dom_children; // blocks immediately dominated by this one
+} ir_block;
+
+ptr_vector(ir_block);
+
+typedef struct {
+    int start; // the function's range in ir
+    int end;
+    vector_ir_block* blocks; // blocks->values[0] is the entry block
+    vector_int* rpo; // reachable blocks in reverse postorder, filled in by ir_cfg_dominators
+    var_vector* vars; // every var in the function, the bitsets are indexed by position in this vector
+    int n_words; // size of each bitset
+    int* var_map; // open addressing table, var name -> position in vars
+    int var_map_size;
+    int* label_map; // label -> block index, as pairs of the two
+    int label_map_size;
+    // the function's instructions as flat arrays, filled in by ir_cfg_liveness along with the var numbering,
+    // so the analyses scan these instead of chasing pointers; entry i is ir[start + i], vars are numbered as above
+    uint8_t* ops; // instruction type
+    int* defs; // the var written to, or -1
+    int* use_start; // the vars read by entry i are uses[use_start[i]] up to uses[use_start[i + 1]]
+    int* uses;
+} ir_cfg;
+
+static inline int ir_cfg_def(ir_cfg* cfg, int ip) { return cfg->defs[ip - cfg->start]; }
+static inline int* ir_cfg_uses_begin(ir_cfg* cfg, int ip) { return cfg->uses + cfg->use_start[ip - cfg->start]; }
+static inline int* ir_cfg_uses_end(ir_cfg* cfg, int ip) { return cfg->uses + cfg->use_start[ip - cfg->start + 1]; }
+
+// natural loop, the union of all back edges into one header
+typedef struct {
+    int header; // block index, the only way into the loop
+    uint64_t* blocks; // bitset over cfg->blocks
+    vector_int* body; // the same blocks as a list, header first
+    vector_int* exits; // blocks in the loop that can leave it, by a jump or a return
+} ir_loop;
+
+ptr_vector(ir_loop);
+
+int ir_is_fn_label(ir_insn* insn);
+int ir_next_fn(int from, int* start, int* end);
+ir_var* ir_insn_def(ir_insn* insn);
+void ir_insn_uses(ir_insn* insn, var_vector* uses);
+int ir_insn_is_pure(ir_insn* insn);
+int ir_op_is_pure(int op);
+ir_cfg* ir_cfg_build(int start, int end);
+void ir_cfg_free(ir_cfg* cfg);
+int ir_cfg_var_index(ir_cfg* cfg, ir_var* var);
+uint64_t* ir_cfg_exposed_vars(ir_cfg* cfg);
+int ir_cfg_label_block(ir_cfg* cfg, int label);
+int ir_cfg_block_of(ir_cfg* cfg, int index);
+void ir_cfg_liveness(ir_cfg* cfg);
+void ir_cfg_dominators(ir_cfg* cfg);
+int ir_cfg_dominates(ir_cfg* cfg, int a, int b);
+vector_ir_loop* ir_cfg_loops(ir_cfg* cfg);
+void ir_loops_free(vector_ir_loop* loops);
+
+#endif
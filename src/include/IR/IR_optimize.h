@@ -2,16 +2,33 @@
 #define _IMPERIVM_IR_IR_OPTIMIZE_H
 
 #include <IR/IR.h>
+#include <IR/IR_cfg.h>
 
 int ir_get_block(int* start, int* end);
 var_vector* ir_get_vars(int start, int end);
 var_vector* ir_get_local_vars(char* fn);
 ast_fn* ir_get_ast_fn(char* fn_name);
-void ir_block_remove_unused_assignments(int start, int end);
+int ir_block_remove_unused_assignments(ir_cfg* cfg, ir_block* b, uint64_t* pinned);
 void ir_move_instr_after(int src, int dst);
 void ir_remove_instruction(ir_insn* instr);
 void ir_block_reorder_instructions(int start, int end);
 void ir_remove_redundant_assignments(void);
+void ir_insert_before(int index, ir_insn* insn);
+void ir_insert_many(int index, ir_insn** insns, int n);
+void ir_compact(void);
+void ir_for_each_fn(void (*pass)(void* arg), void* arg);
+int ir_remove_unreachable_code(void);
+int ir_thread_jumps(void);
+void ir_simplify_cfg(void);
+void ir_remove_dead_code(void);
+int ir_number_values(void);
+int ir_loop_insert_preheader(ir_cfg* cfg, ir_loop* loop, ir_insn** insns, int n);
+void ir_hoist_loop_invariants(void);
+void ir_reduce_induction_variables(void);
+void ir_fold_addresses(void);
+void ir_inline_functions(void);
+void ir_eliminate_tail_calls(void);
+void ir_convert_ifs(void);
 ir_value* ir_short_circuit(ast_expr* e);
 var_graph* ir_get_interference_graph(var_vector* vars, int start, int end);
 
@@ -84,10 +84,44 @@
 // padding | ret_addr
 // after the function returns, we'll decrement RSP by 8 to restore the stack
 
-ptr_vector(char);
+// the emitted code is kept as a list of records rather than text,
+// so that it can still be inspected and rewritten after translation
+
+typedef enum {
+    AMD64_ARG_REG, // %reg, size bytes wide
+    AMD64_ARG_IMM, // $imm
+    AMD64_ARG_MEM, // imm(%reg,%index,scale), or sym(%rip) for globals
+    AMD64_ARG_SYM  // a label, as the target of a jump or call
+} amd64_arg_type;
+
+typedef struct {
+    amd64_arg_type type;
+    int reg;     // register, or the base register of a memory operand (-1 if there isn't one)
+    int size;    // 1, 4 or 8
+    int index;   // index register of a memory operand, -1 if there isn't one
+    int scale;
+    int64_t imm; // immediate value, or the displacement of a memory operand
+    char* sym;
+    ir_var* var; // the stack slot a memory operand is relative to, until the frame is laid out
+} amd64_arg;
+
+typedef enum {
+    AMD64_INSN,   // op followed by its args, in AT&T order (the destination is last)
+    AMD64_LABEL,  // op is the label
+    AMD64_RAW,    // op is output as is, for directives and data
+    AMD64_DELETED // removed by the peephole optimizer
+} amd64_insn_type;
+
+typedef struct {
+    amd64_insn_type type;
+    char* op;
+    int n_args;
+    amd64_arg args[3];
+} amd64_insn;
+
+ptr_vector(amd64_insn);
 ptr_vector(vector_ir_var);
-#define asm_vector vector_char
-#define _asm_add(value) vector_char_add(amd64_asm, value)
+#define asm_vector vector_amd64_insn
 #define _is_global(var) (var->name[strlen(var->name)-1] == 'g')
 #define _is_arg(var) (var->name[strlen(var->name)-1] == 'p')
 #define _is_local(var) (var->name[strlen(var->name)-1] == 'l')
@@ -122,14 +156,16 @@ extern ir_var** reg_status;
 extern var_graph* g;
 extern stack_vector* stack_status;
 extern ast_fn* amd64_current_fn;
+extern int amd64_ip;
+extern int amd64_op_size;
+extern int amd64_stats_enabled;
+extern int amd64_n_loads;
+extern int amd64_n_stores;
 
 static inline int has_reg(ir_var* var) { for(int i = 0; i < g->nodes->n_values; i++) if(strcmp(g->nodes->values[i]->name, var->name) == 0) return 1; return 0; }
 static inline int get_reg(ir_var* var) { for(int i = 0; i < g->nodes->n_values; i++) if(strcmp(g->nodes->values[i]->name, var->name) == 0) return g->colors[i]; assert(1); return 0; } // return i;
 static inline int check_reg(ir_var* var) { if(get_reg(var) == -1) return 1; if(reg_status[get_reg(var)] && strcmp(reg_status[get_reg(var)]->name, var->name) == 0) return 1; return 0; }
 
-#define stackframe_top stack_status->values[stack_status->n_values-1]
-int stackframe_find(ir_var* var);
-
 static inline void stackframe_build(void) { vector_vector_ir_var_add(stack_status, vector_ir_var_new()); }
 static inline void stackframe_clean(void) { vector_ir_var_free(stack_status->values[stack_status->n_values-1]); vector_vector_ir_var_remove(stack_status, stack_status->n_values-1); }
 static inline void stackframe_add(ir_var* var) { vector_ir_var_add(stack_status->values[stack_status->n_values-1], var); }
@@ -137,12 +173,6 @@ static inline void stackframe_add(ir_var* var) { vector_ir_var_add(stack_status-
 static inline long is_global(ir_var* var) { return var->name[strlen(var->name)-1] == 'g'; }
 static inline long is_arg(ir_var* var)    { return var->name[strlen(var->name)-1] == 'p'; }
 static inline long is_local(ir_var* var)  { return var->name[strlen(var->name)-1] == 'l'; }
-static inline long get_local_pos(ir_var* var) { return stackframe_find(var); }
-static inline long local_var_get_offset(ir_var* var) { return (stack_status->values[stack_status->n_values-1]->n_values - (get_local_pos(var) + 1)); }
-static inline long get_offset(ir_var* var) {
-    //if(is_arg(var)) return ((arg_get_offset(var)) * 8);
-    return ((local_var_get_offset(var)) * 8);
-}
 
 static inline int get_arg_reg(ir_var* var)
 {
@@ -169,6 +199,28 @@ void amd64_init(void);
 void amd64_color_registers(var_graph* g, int start, int end);
 void amd64_global_vars(void);
 void amd64_translate(var_graph* graph, int start, int end);
+void amd64_add(amd64_insn* insn);
+void amd64_format(amd64_insn* insn, char* buffer);
+void amd64_print(FILE* f);
+
+// amd64_frame.c
+void amd64_frame_begin(int start);
+void amd64_frame_end(void);
+int amd64_frame_live(ir_var* var);
+amd64_arg amd64_frame_slot(ir_var* var);
+void amd64_frame_adjust(char* op);
+void amd64_frame_stats(FILE* f);
+
+// amd64_peephole.c
+void amd64_peephole(void);
+void amd64_peephole_stats(FILE* f);
+
+// amd64_stats.c
+void amd64_stats_begin(int start);
+void amd64_stats_block(var_graph* g, int spilled);
+void amd64_stats_frame(char* fn, int size);
+void amd64_stats(FILE* f);
+void amd64_stats_json(FILE* f);
 
 // amd64_translate.c
 void ensure_reg(ir_var* var);
@@ -181,21 +233,23 @@ void amd64_un_rr(ir_un* un);
 void amd64_un_mr(ir_un* un);
 void amd64_un_rm(ir_un* un);
 void amd64_un_mm(ir_un* un);
-void amd64_bin_rrr(ir_bin* bin);
-void amd64_bin_mrr(ir_bin* bin);
-void amd64_bin_rrm(ir_bin* bin);
-void amd64_bin_mrm(ir_bin* bin);
-void amd64_bin_rmr(ir_bin* bin);
-void amd64_bin_mmr(ir_bin* bin);
-void amd64_bin_mmm(ir_bin* bin);
-void amd64_bin_rmm(ir_bin* bin);
+void amd64_bin(ir_bin* bin);
 void amd64_copy_xr(ir_copy* copy);
 void amd64_copy_rv(ir_copy* copy);
 void amd64_copy_mm(ir_copy* copy);
-void amd64_deref_assign(ir_deref_assign* insn);
+void amd64_assign_deref(ir_assign_deref* load);
+void amd64_deref_assign(ir_deref_assign* store);
+void amd64_select(ir_select* select);
 void amd64_condjmp(ir_if* condjmp);
 void amd64_exit(ir_return* ret);
 
-static inline void asm_add(char* value) { vector_char_add(amd64_asm, value); if(verbose_asm) printf("%s", value); }
+// adds text that doesn't need to be looked at again, like directives
+static inline void asm_add(char* value)
+{
+    amd64_insn* insn = calloc(1, sizeof(amd64_insn));
+    insn->type = AMD64_RAW;
+    insn->op = value;
+    amd64_add(insn);
+}
 
 #endif
@@ -2,6 +2,7 @@
 #define _IMPERIVM_BACKEND_AMD64_ASM_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <vector.h> // I've yet to move the whole compiler to templated vectors
@@ -67,6 +68,27 @@ static inline char* amd64_reg_name(int reg)
     }
 }
 
+static inline char* amd64_reg32_name(int reg)
+{
+    switch(reg) {
+        case 0: return "eax";
+        case 1: return "ebx";
+        case 2: return "ecx";
+        case 3: return "edx";
+        case 4: return "esi";
+        case 5: return "edi";
+        case 6: return "r8d";
+        case 7: return "r9d";
+        case 8: return "r10d";
+        case 9: return "r11d";
+        case 10: return "r12d";
+        case 11: return "r13d";
+        case 12: return "r14d";
+        case 13: return "r15d";
+        default: return NULL;
+    }
+}
+
 static inline char* amd64_reg8_name(int reg)
 {
     switch(reg) {
@@ -96,10 +118,12 @@ static inline char* amd64_type_to_str(type_info* t)
     switch(t->base) {
         case CHAR_T:
         case UCHAR_T:
+        return "byte";
+
         case INT_T:
         case UINT_T:
-        return "long"; // ?
-        
+        return "long";
+
         case LONG_T: 
         case ULONG_T:
         default:
@@ -107,28 +131,150 @@ static inline char* amd64_type_to_str(type_info* t)
     }
 }
 
+// most instructions only take a sign-extended 32-bit immediate, only mov can load a full 64-bit one
+static inline int amd64_is_imm32(int64_t imm)
+{
+    return imm >= INT32_MIN && imm <= INT32_MAX;
+}
+
+// operands
+
+static inline amd64_arg amd64_arg_reg(int reg)
+{
+    return (amd64_arg) { .type = AMD64_ARG_REG, .reg = reg, .size = 8, .index = -1 };
+}
+
+// the low byte of reg, for setcc
+static inline amd64_arg amd64_arg_reg8(int reg)
+{
+    return (amd64_arg) { .type = AMD64_ARG_REG, .reg = reg, .size = 1, .index = -1 };
+}
+
+// the low 32 bits of reg, writing them clears the upper half
+static inline amd64_arg amd64_arg_reg32(int reg)
+{
+    return (amd64_arg) { .type = AMD64_ARG_REG, .reg = reg, .size = 4, .index = -1 };
+}
+
+static inline amd64_arg amd64_arg_sized(int reg, int size)
+{
+    return (amd64_arg) { .type = AMD64_ARG_REG, .reg = reg, .size = size, .index = -1 };
+}
+
+// reg as an operand of the arithmetic being emitted, which is 32-bit while amd64_op_size says so
+static inline amd64_arg amd64_arg_op(int reg)
+{
+    return amd64_arg_sized(reg, amd64_op_size);
+}
+
+// picks the q or the l form of an instruction to go with amd64_arg_op
+#define AMD64_OP(q, l) (amd64_op_size == 4 ? l : q)
+
+static inline amd64_arg amd64_arg_imm(int64_t imm)
+{
+    return (amd64_arg) { .type = AMD64_ARG_IMM, .imm = imm, .reg = -1, .index = -1 };
+}
+
+// disp(%base)
+static inline amd64_arg amd64_arg_ind(int base, int64_t disp)
+{
+    return (amd64_arg) { .type = AMD64_ARG_MEM, .reg = base, .imm = disp, .index = -1 };
+}
+
+// disp(%base,%index,scale)
+static inline amd64_arg amd64_arg_sib(int base, int index, int scale, int64_t disp)
+{
+    return (amd64_arg) { .type = AMD64_ARG_MEM, .reg = base, .index = index, .scale = scale, .imm = disp };
+}
+
+// the memory location of a variable, RIP-relative for globals and on the stack frame otherwise
+static inline amd64_arg amd64_arg_var(ir_var* var)
+{
+    if(is_global(var)) return (amd64_arg) { .type = AMD64_ARG_MEM, .reg = -1, .index = -1, .sym = var->name };
+    return amd64_frame_slot(var);
+}
+
+// a jump or call target
+static inline amd64_arg amd64_arg_sym(char* label)
+{
+    return (amd64_arg) { .type = AMD64_ARG_SYM, .reg = -1, .index = -1, .sym = label };
+}
+
+// instructions are kept as records until the end so that the peephole optimizer can look at them
+
+static inline void amd64_emit(char* op, int n_args, amd64_arg a, amd64_arg b, amd64_arg c)
+{
+    amd64_insn* insn = calloc(1, sizeof(amd64_insn));
+    insn->type = AMD64_INSN;
+    insn->op = op;
+    insn->n_args = n_args;
+    insn->args[0] = a;
+    insn->args[1] = b;
+    insn->args[2] = c;
+    amd64_add(insn);
+}
+
+#define amd64_emit0(op)          amd64_emit(op, 0, (amd64_arg) {0}, (amd64_arg) {0}, (amd64_arg) {0})
+#define amd64_emit1(op, a)       amd64_emit(op, 1, a, (amd64_arg) {0}, (amd64_arg) {0})
+#define amd64_emit2(op, a, b)    amd64_emit(op, 2, a, b, (amd64_arg) {0})
+#define amd64_emit3(op, a, b, c) amd64_emit(op, 3, a, b, c)
+
 static inline void amd64_label(char* label)
 {
-    char buffer[64];
-    sprintf(buffer, "%s:\n", label);
-    if(strncmp(label, "fn.", 3)) asm_add(strdup(buffer));
-    else if(strcmp(label, "fn.main") == 0) asm_add("main:\n");
-    else asm_add(strdup(buffer+3));
+    amd64_insn* insn = calloc(1, sizeof(amd64_insn));
+    insn->type = AMD64_LABEL;
+    insn->op = label;
+    amd64_add(insn);
+}
+
+// reg = a value of the type from src, memory or a register, sign- or zero-extended to 64 bits
+// registers always hold values like that, so that any of them can be used as a whole
+static inline void amd64_movx(amd64_arg src, int reg, type_info* type)
+{
+    int size = ir_type_size(type);
+    if(src.type == AMD64_ARG_REG) src.size = size;
+
+    if(size == 8) amd64_emit2("movq", src, amd64_arg_reg(reg));
+    else if(size == 4 && ir_is_unsigned(type)) amd64_emit2("movl", src, amd64_arg_reg32(reg)); // writing 32 bits clears the rest
+    else if(size == 4) amd64_emit2("movslq", src, amd64_arg_reg(reg));
+    else if(ir_is_unsigned(type)) amd64_emit2("movzbl", src, amd64_arg_reg32(reg));
+    else amd64_emit2("movsbq", src, amd64_arg_reg(reg));
+}
+
+// truncates reg to the type, for a value that may not fit in it
+static inline void amd64_extend(int reg, type_info* type)
+{
+    if(ir_type_size(type) < 8) amd64_movx(amd64_arg_reg(reg), reg, type);
+}
+
+// dst = the low bytes of reg, as many as the type takes
+static inline void amd64_movt(int reg, amd64_arg dst, type_info* type)
+{
+    switch(ir_type_size(type)) {
+        case 1: amd64_emit2("movb", amd64_arg_reg8(reg), dst); break;
+        case 4: amd64_emit2("movl", amd64_arg_reg32(reg), dst); break;
+        default: amd64_emit2("movq", amd64_arg_reg(reg), dst); break;
+    }
 }
 
 static inline void amd64_load_var(int reg, ir_var* var)
 {
-    char buffer[64];
-    if(is_global(var)) sprintf(buffer, "movq %s(%%rip), %%%s\n", var->name, amd64_reg_name(reg));
-    else sprintf(buffer, "movq %ld(%%rsp), %%%s\n", get_offset(var), amd64_reg_name(reg));
-    asm_add(strdup(buffer));
+    amd64_n_loads++;
+    amd64_movx(amd64_arg_var(var), reg, var->type);
+}
+
+// dst = 0, shorter than a mov and recognized as dependency breaking; clobbers the flags
+static inline void amd64_xor_rr(int dst)
+{
+    amd64_emit2("xorl", amd64_arg_reg32(dst), amd64_arg_reg32(dst));
 }
 
+// a movl zero-extends, and is shorter than the movq that a negative or wider value needs
 static inline void amd64_load_lit(int reg, uint64_t lit)
 {
-    char buffer[64];
-    sprintf(buffer, "movq $%lu, %%%s\n", lit, amd64_reg_name(reg));
-    asm_add(strdup(buffer));
+    if(!lit) amd64_xor_rr(reg);
+    else if(lit <= UINT32_MAX) amd64_emit2("movl", amd64_arg_imm(lit), amd64_arg_reg32(reg));
+    else amd64_emit2("movq", amd64_arg_imm(lit), amd64_arg_reg(reg));
 }
 
 static inline void amd64_load_val(int reg, ir_value* value)
@@ -137,67 +283,48 @@ static inline void amd64_load_val(int reg, ir_value* value)
     else amd64_load_lit(reg, value->content.lit.i);
 }
 
+// a value nothing reads anymore stays in the register, and a temporary that's never spilled gets no slot
 static inline void amd64_spill(int reg, ir_var* var)
 {
-    if(!var) return;
-
-    char buffer[64];
-    if(is_global(var)) sprintf(buffer, "movq %%%s, %s(%%rip)\n", amd64_reg_name(reg), var->name);
-    else sprintf(buffer, "movq %%%s, %ld(%%rsp)\n", amd64_reg_name(reg), get_offset(var));
-    asm_add(strdup(buffer));
+    if(!var || !amd64_frame_live(var)) return;
+    amd64_n_stores++;
+    amd64_movt(reg, amd64_arg_var(var), var->type);
 }
 
 static inline void amd64_neg_r(int reg)
 {
-    char buffer[64];
-    sprintf(buffer, "negq %%%s\n", amd64_reg_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit1(AMD64_OP("negq", "negl"), amd64_arg_op(reg));
 }
 
 static inline void amd64_neg_m(ir_var* var)
 {
-    char buffer[64];
-    if(is_global(var)) sprintf(buffer, "negq %s(%%rip)\n", var->name);
-    else sprintf(buffer, "negq %ld(%%rsp)\n", get_offset(var));
-    asm_add(strdup(buffer));
+    amd64_emit1("negq", amd64_arg_var(var));
 }
 
 static inline void amd64_not_r(int reg)
 {
-    char buffer[64];
-    sprintf(buffer, "notq %%%s\n", amd64_reg_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit1(AMD64_OP("notq", "notl"), amd64_arg_op(reg));
 }
 
 // binary NOT
 static inline void amd64_not_m(ir_var* var)
 {
-    char buffer[64];
-    if(is_global(var)) sprintf(buffer, "notq %s(%%rip)\n", var->name);
-    else sprintf(buffer, "notq %ld(%%rsp)\n", get_offset(var));
-    asm_add(strdup(buffer));
+    amd64_emit1("notq", amd64_arg_var(var));
 }
 
 static inline void amd64_cmp_rr(int op1, int op2)
 {
-    char buffer[64];
-    sprintf(buffer, "cmp %%%s, %%%s\n", amd64_reg_name(op2), amd64_reg_name(op1));
-    asm_add(strdup(buffer));
+    amd64_emit2("cmpq", amd64_arg_reg(op2), amd64_arg_reg(op1));
 }
 
 static inline void amd64_cmp_rm(int reg_op, ir_var* mem_op)
 {
-    char buffer[64];
-    if(is_global(mem_op)) sprintf(buffer, "cmp %s(%%rip), %%%s", mem_op->name, amd64_reg_name(reg_op));
-    else sprintf(buffer, "cmp %ld(%%rsp), %%%s\n", get_offset(mem_op), amd64_reg_name(reg_op));
-    asm_add(strdup(buffer));
+    amd64_emit2("cmpq", amd64_arg_var(mem_op), amd64_arg_reg(reg_op));
 }
 
 static inline void amd64_cmp_ri(int reg_op, int64_t imm_op)
 {
-    char buffer[64];
-    sprintf(buffer, "cmp $%ld, %%%s\n", imm_op, amd64_reg_name(reg_op));
-    asm_add(strdup(buffer));
+    amd64_emit2("cmpq", amd64_arg_imm(imm_op), amd64_arg_reg(reg_op));
 }
 
 static inline void amd64_cmp_rv(int reg_op, ir_value* v)
@@ -209,57 +336,43 @@ static inline void amd64_cmp_rv(int reg_op, ir_value* v)
 // sets the low byte of reg to 0 or 1 if the last cmp evaluated to less
 static inline void amd64_setl_r(int reg)
 {
-    char buffer[64];
-    sprintf(buffer, "setl %%%s\n", amd64_reg8_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit1("setl", amd64_arg_reg8(reg));
 }
 
 // lesser or equal
 static inline void amd64_setle_r(int reg)
 {
-    char buffer[64];
-    sprintf(buffer, "setle %%%s\n", amd64_reg8_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit1("setle", amd64_arg_reg8(reg));
 }
 
 // greater
 static inline void amd64_setg_r(int reg)
 {
-    char buffer[64];
-    sprintf(buffer, "setg %%%s\n", amd64_reg8_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit1("setg", amd64_arg_reg8(reg));
 }
 
 // greater or equal
 static inline void amd64_setge_r(int reg)
 {
-    char buffer[64];
-    sprintf(buffer, "setge %%%s\n", amd64_reg8_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit1("setge", amd64_arg_reg8(reg));
 }
 
 // equal
 static inline void amd64_sete_r(int reg)
 {
-    char buffer[64];
-    sprintf(buffer, "sete %%%s\n", amd64_reg8_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit1("sete", amd64_arg_reg8(reg));
 }
 
 // not equal
 static inline void amd64_setne_r(int reg)
 {
-    char buffer[64];
-    sprintf(buffer, "setne %%%s\n", amd64_reg_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit1("setne", amd64_arg_reg8(reg));
 }
 
 // movzbq from the low byte in reg to the whole 64-bit reg
 static inline void amd64_movzbq_r(int reg)
 {
-    char buffer[64];
-    sprintf(buffer, "movzbq %%%s, %%%s\n", amd64_reg8_name(reg), amd64_reg_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit2("movzbq", amd64_arg_reg8(reg), amd64_arg_reg(reg));
 }
 
 static inline void amd64_logical_not_r(int reg)
@@ -268,36 +381,25 @@ static inline void amd64_logical_not_r(int reg)
     // then setz (set the register to 1 if ZF, otherwise 0)
     // and movzbq (zero-extend move from byte to quad, clears the upper bits of the register)
 
-    char buffer[64];
-    sprintf(buffer, "test %%%s, %%%s\n", amd64_reg_name(reg), amd64_reg_name(reg));
-    asm_add(strdup(buffer));
-    sprintf(buffer, "setz %%%s\n", amd64_reg8_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit2("testq", amd64_arg_reg(reg), amd64_arg_reg(reg));
+    amd64_emit1("setz", amd64_arg_reg8(reg));
     amd64_movzbq_r(reg);
 }
 
 static inline void amd64_mov_rr(int dst, int src)
 {
     if(dst == src) return;
-
-    char buffer[64];
-    sprintf(buffer, "movq %%%s, %%%s\n", amd64_reg_name(src), amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_emit2("movq", amd64_arg_reg(src), amd64_arg_reg(dst));
 }
 
 static inline void amd64_mov_ri(int dst, int64_t imm)
 {
-    char buffer[64];
-    sprintf(buffer, "movq $%ld, %%%s\n", imm, amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_load_lit(dst, imm);
 }
 
 static inline void amd64_mov_rm(int dst, ir_var* src)
 {
-    char buffer[64];
-    if(is_global(src)) sprintf(buffer, "movq %s(%%rip), %%%s\n", src->name, amd64_reg_name(dst));
-    else sprintf(buffer, "movq %ld(%%rsp), %%%s\n", get_offset(src), amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_load_var(dst, src);
 }
 
 static inline void amd64_mov_rv(int dst, ir_value* value)
@@ -306,73 +408,47 @@ static inline void amd64_mov_rv(int dst, ir_value* value)
     else amd64_mov_ri(dst, value->content.lit.i);
 }
 
-// Dereferences ptr_reg and places the value in dst_reg.
-static inline void amd64_deref_mov_rr(int dst_reg, int ptr_reg)
-{
-    char buffer[64];
-    sprintf(buffer, "movq (%%%s), %%%s\n", amd64_reg_name(ptr_reg), amd64_reg_name(dst_reg));
-    asm_add(strdup(buffer));
-}
-
-static inline void amd64_deref_mov_mr(ir_var* dst, int ptr_reg)
-{
-    char buffer[64];
-    if(is_global(dst)) sprintf(buffer, "movq (%%%s), %s(%%rip)\n", amd64_reg_name(ptr_reg), dst->name);
-    else sprintf(buffer, "movq (%%%s), %ld(%%rsp)\n", amd64_reg_name(ptr_reg), get_offset(dst));
-    asm_add(strdup(buffer));
-}
-
-// Puts the value of src into the memory pointed to by dst_ptr_reg.
-static inline void amd64_copy_through_ptr_rm(int dst_ptr_reg, ir_var* src)
+// dst = *addr, addr being a memory operand built by amd64_address and type what's stored there
+static inline void amd64_mov_ra(int dst, amd64_arg addr, type_info* type)
 {
-    char buffer[64];
-    if(is_global(src)) sprintf(buffer, "movq %s(%%rip), (%%%s)\n", src->name, amd64_reg_name(dst_ptr_reg));
-    else sprintf(buffer, "movq %ld(%%rsp), (%%%s)\n", get_offset(src), amd64_reg_name(dst_ptr_reg));
-    asm_add(strdup(buffer));
+    amd64_movx(addr, dst, type);
 }
 
-static inline void amd64_copy_through_ptr_ri(int dst_ptr_reg, int64_t src)
+// *addr = src
+static inline void amd64_mov_ar(amd64_arg addr, int src, type_info* type)
 {
-    char buffer[64];
-    sprintf(buffer, "movq $%ld, (%%%s)\n", src, amd64_reg_name(dst_ptr_reg));
-    asm_add(strdup(buffer));
+    amd64_movt(src, addr, type);
 }
 
-static inline void amd64_copy_through_ptr_rv(int dst_ptr_reg, ir_value* src)
+// a narrow store takes any immediate of its width, a quad one only a sign-extended 32-bit one
+static inline void amd64_mov_ai(amd64_arg addr, int64_t imm, type_info* type)
 {
-    if(src->type == IR_VAR) amd64_copy_through_ptr_rm(dst_ptr_reg, src->content.var);
-    else amd64_copy_through_ptr_ri(dst_ptr_reg, src->content.lit.i);
+    switch(ir_type_size(type)) {
+        case 1: amd64_emit2("movb", amd64_arg_imm((int8_t) imm), addr); break;
+        case 4: amd64_emit2("movl", amd64_arg_imm((int32_t) imm), addr); break;
+        default: amd64_emit2("movq", amd64_arg_imm(imm), addr); break;
+    }
 }
 
 // dst = dst - src
 static inline void amd64_sub_rr(int dst, int src)
 {
-    char buffer[64];
-    sprintf(buffer, "subq %%%s, %%%s\n", amd64_reg_name(src), amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_emit2(AMD64_OP("subq", "subl"), amd64_arg_op(src), amd64_arg_op(dst));
 }
 
 static inline void amd64_sub_rm(int dst, ir_var* src)
 {
-    char buffer[64];
-    if(is_global(src)) sprintf(buffer, "subq %s(%%rip), %%%s\n", src->name, amd64_reg_name(dst));
-    else sprintf(buffer, "subq %ld(%%rsp), %%%s\n", get_offset(src), amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_emit2(AMD64_OP("subq", "subl"), amd64_arg_var(src), amd64_arg_op(dst));
 }
 
 static inline void amd64_sub_mr(ir_var* dst, int src)
 {
-    char buffer[64];
-    if(is_global(dst)) sprintf(buffer, "subq %%%s, %s(%%rip)\n", amd64_reg_name(src), dst->name);
-    else sprintf(buffer, "subq %%%s, %ld(%%rsp)\n", amd64_reg_name(src), get_offset(dst));
-    asm_add(strdup(buffer));
+    amd64_emit2(AMD64_OP("subq", "subl"), amd64_arg_op(src), amd64_arg_var(dst));
 }
 
 static inline void amd64_sub_ri(int dst, int64_t src)
 {
-    char buffer[64];
-    sprintf(buffer, "subq $%ld, %%%s\n", src, amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_emit2(AMD64_OP("subq", "subl"), amd64_arg_imm(src), amd64_arg_op(dst));
 }
 
 static inline void amd64_sub_rv(int reg, ir_value* value)
@@ -384,32 +460,22 @@ static inline void amd64_sub_rv(int reg, ir_value* value)
 // dst = dst + src
 static inline void amd64_add_rr(int dst, int src)
 {
-    char buffer[64];
-    sprintf(buffer, "addq %%%s, %%%s\n", amd64_reg_name(src), amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_emit2(AMD64_OP("addq", "addl"), amd64_arg_op(src), amd64_arg_op(dst));
 }
 
 static inline void amd64_add_rm(int dst, ir_var* src)
 {
-    char buffer[64];
-    if(is_global(src)) sprintf(buffer, "addq %s(%%rip), %%%s\n", src->name, amd64_reg_name(dst));
-    else sprintf(buffer, "addq %ld(%%rsp), %%%s\n", get_offset(src), amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_emit2(AMD64_OP("addq", "addl"), amd64_arg_var(src), amd64_arg_op(dst));
 }
 
 static inline void amd64_add_mr(ir_var* dst, int src)
 {
-    char buffer[64];
-    if(is_global(dst)) sprintf(buffer, "addq %%%s, %s(%%rip)\n", amd64_reg_name(src), dst->name);
-    else sprintf(buffer, "addq %%%s, %ld(%%rsp)\n", amd64_reg_name(src), get_offset(dst));
-    asm_add(strdup(buffer));
+    amd64_emit2(AMD64_OP("addq", "addl"), amd64_arg_op(src), amd64_arg_var(dst));
 }
 
 static inline void amd64_add_ri(int dst, int64_t src)
 {
-    char buffer[64];
-    sprintf(buffer, "addq $%ld, %%%s\n", src, amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_emit2(AMD64_OP("addq", "addl"), amd64_arg_imm(src), amd64_arg_op(dst));
 }
 
 static inline void amd64_add_rv(int reg, ir_value* value)
@@ -418,68 +484,165 @@ static inline void amd64_add_rv(int reg, ir_value* value)
     else amd64_add_ri(reg, value->content.lit.i);
 }
 
+// dst = dst + 1
+static inline void amd64_inc_r(int dst)
+{
+    amd64_emit1(AMD64_OP("incq", "incl"), amd64_arg_op(dst));
+}
+
+// dst = dst - 1
+static inline void amd64_dec_r(int dst)
+{
+    amd64_emit1(AMD64_OP("decq", "decl"), amd64_arg_op(dst));
+}
+
+// dst = base + disp, a three-operand add that leaves the flags alone
+static inline void amd64_lea_rri(int dst, int base, int64_t disp)
+{
+    amd64_emit2(AMD64_OP("leaq", "leal"), amd64_arg_ind(base, disp), amd64_arg_op(dst));
+}
+
+// dst = base + index * scale, where scale is 1, 2, 4 or 8
+static inline void amd64_lea_rrr(int dst, int base, int index, int scale)
+{
+    amd64_emit2(AMD64_OP("leaq", "leal"), amd64_arg_sib(base, index, scale, 0), amd64_arg_op(dst));
+}
+
+// dst = dst << imm
+static inline void amd64_shl_ri(int dst, int imm)
+{
+    amd64_emit2(AMD64_OP("shlq", "shll"), amd64_arg_imm(imm), amd64_arg_op(dst));
+}
+
+// dst = dst >> imm, arithmetic
+static inline void amd64_sar_ri(int dst, int imm)
+{
+    amd64_emit2("sarq", amd64_arg_imm(imm), amd64_arg_reg(dst));
+}
+
+// dst = dst >> imm, logical
+static inline void amd64_shr_ri(int dst, int imm)
+{
+    amd64_emit2("shrq", amd64_arg_imm(imm), amd64_arg_reg(dst));
+}
+
+// dst = dst << CL, shifts by a variable amount only take the count in CL
+static inline void amd64_shl_rc(int dst)
+{
+    amd64_emit2(AMD64_OP("shlq", "shll"), amd64_arg_reg8(RCX), amd64_arg_op(dst));
+}
+
+static inline void amd64_sar_rc(int dst)
+{
+    amd64_emit2("sarq", amd64_arg_reg8(RCX), amd64_arg_reg(dst));
+}
+
+static inline void amd64_shr_rc(int dst)
+{
+    amd64_emit2("shrq", amd64_arg_reg8(RCX), amd64_arg_reg(dst));
+}
+
+// dst = dst & imm
+static inline void amd64_and_ri(int dst, int64_t imm)
+{
+    amd64_emit2(AMD64_OP("andq", "andl"), amd64_arg_imm(imm), amd64_arg_op(dst));
+}
+
+// sign-extends RAX into RDX:RAX before a signed division
+static inline void amd64_cqto(void)
+{
+    amd64_emit0("cqto");
+}
+
+// signed division; RDX:RAX / reg, the quotient goes in RAX and the remainder in RDX
+static inline void amd64_idiv_r(int reg)
+{
+    amd64_emit1("idivq", amd64_arg_reg(reg));
+}
+
+static inline void amd64_idiv_m(ir_var* var)
+{
+    amd64_emit1("idivq", amd64_arg_var(var));
+}
+
+// unsigned division, RDX has to be zeroed first
+static inline void amd64_div_r(int reg)
+{
+    amd64_emit1("divq", amd64_arg_reg(reg));
+}
+
+static inline void amd64_div_m(ir_var* var)
+{
+    amd64_emit1("divq", amd64_arg_var(var));
+}
+
+// unsigned multiplication; RAX * reg = RDX:RAX
+static inline void amd64_mul_r(int reg)
+{
+    amd64_emit1("mulq", amd64_arg_reg(reg));
+}
+
+static inline void amd64_mul_m(ir_var* var)
+{
+    amd64_emit1("mulq", amd64_arg_var(var));
+}
+
 static inline void amd64_jmp(char* label)
 {
-    char buffer[64];
-    sprintf(buffer, "jmp %s\n", label);
-    asm_add(strdup(buffer));
+    amd64_emit1("jmp", amd64_arg_sym(label));
 }
 
 // does a bitwise AND, discards the value, and updates some flags, notably ZF and SF
 static inline void amd64_test_rr(int r1, int r2)
 {
-    char buffer[64];
-    sprintf(buffer, "test %%%s, %%%s\n", amd64_reg_name(r1), amd64_reg_name(r2));
-    asm_add(strdup(buffer));
+    amd64_emit2("testq", amd64_arg_reg(r1), amd64_arg_reg(r2));
 }
 
 // jump if not zero
 static inline void amd64_jnz_r(char* label)
 {
-    char buffer[64];
-    sprintf(buffer, "jnz %s\n", label);
-    asm_add(strdup(buffer));
+    amd64_emit1("jnz", amd64_arg_sym(label));
+}
+
+// dst = src if the last test or cmp found them not equal, no branch involved
+static inline void amd64_cmovne_rr(int src, int dst)
+{
+    amd64_emit2("cmovneq", amd64_arg_reg(src), amd64_arg_reg(dst));
+}
+
+// equal
+static inline void amd64_cmove_rr(int src, int dst)
+{
+    amd64_emit2("cmoveq", amd64_arg_reg(src), amd64_arg_reg(dst));
 }
 
 // signed multiplication; RAX * reg = RDX:RAX (the result is 128-bit)
 static inline void amd64_imul_r(int reg)
 {
-    char buffer[64];
-    sprintf(buffer, "imulq %%%s\n", amd64_reg_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit1("imulq", amd64_arg_reg(reg));
 }
 
 // RAX * var = RDX:RAX
 static inline void amd64_imul_m(ir_var* var)
 {
-    char buffer[64];
-    if(is_global(var)) sprintf(buffer, "imulq %s(%%rip)\n", var->name);
-    else sprintf(buffer, "imulq %ld(%%rsp)\n", get_offset(var));
-    asm_add(strdup(buffer));
+    amd64_emit1("imulq", amd64_arg_var(var));
 }
 
 // signed multiplication; dst = dst * src (result remains 64-bit)
 static inline void amd64_imul_rr(int dst, int src)
 {
-    char buffer[64];
-    sprintf(buffer, "imulq %%%s, %%%s\n", amd64_reg_name(src), amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_emit2(AMD64_OP("imulq", "imull"), amd64_arg_op(src), amd64_arg_op(dst));
 }
 
 static inline void amd64_imul_rm(int dst, ir_var* src)
 {
-    char buffer[64];
-    if(is_global(src)) sprintf(buffer, "imulq %s(%%rip), %%%s\n", src->name, amd64_reg_name(dst));
-    else sprintf(buffer, "imulq %ld(%%rsp), %%%s\n", get_offset(src), amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_emit2(AMD64_OP("imulq", "imull"), amd64_arg_var(src), amd64_arg_op(dst));
 }
 
 // dst = dst * imm
 static inline void amd64_imul_ri(int dst, int64_t imm)
 {
-    char buffer[64];
-    sprintf(buffer, "imulq $%ld, %%%s\n", imm, amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_emit2(AMD64_OP("imulq", "imull"), amd64_arg_imm(imm), amd64_arg_op(dst));
 }
 
 static inline void amd64_imul_rv(int dst, ir_value* value)
@@ -490,40 +653,33 @@ static inline void amd64_imul_rv(int dst, ir_value* value)
 
 static inline void amd64_imul_rri(int dst, int src, int64_t imm)
 {
-    char buffer[64];
-    sprintf(buffer, "imulq $%ld, %%%s, %%%s\n", imm, amd64_reg_name(src), amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_emit3(AMD64_OP("imulq", "imull"), amd64_arg_imm(imm), amd64_arg_op(src), amd64_arg_op(dst));
 }
 
 // dst = var * imm
 static inline void amd64_imul_rmi(int dst, ir_var* var, int64_t imm)
 {
-    char buffer[64];
-    if(is_global(var)) sprintf(buffer, "imulq $%ld, %s(%%rip), %%%s\n", imm, var->name, amd64_reg_name(dst));
-    else sprintf(buffer, "imulq $%ld, %ld(%%rsp), %%%s\n", imm, get_offset(var), amd64_reg_name(dst));
-    asm_add(strdup(buffer));
+    amd64_emit3(AMD64_OP("imulq", "imull"), amd64_arg_imm(imm), amd64_arg_var(var), amd64_arg_op(dst));
 }
 
 static inline void amd64_push_r(int reg)
 {
-    char buffer[64];
-    sprintf(buffer, "pushq %%%s\n", amd64_reg_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit1("pushq", amd64_arg_reg(reg));
 }
 
+// a narrow var doesn't have the whole quad in memory, so it's widened in R15 first
 static inline void amd64_push_m(ir_var* var)
 {
-    char buffer[64];
-    if(is_global(var)) sprintf(buffer, "pushq %s(%%rip)\n", var->name);
-    else sprintf(buffer, "pushq %ld(%%rsp)\n", get_offset(var));
-    asm_add(strdup(buffer));
+    if(ir_type_size(var->type) == 8) amd64_emit1("pushq", amd64_arg_var(var));
+    else {
+        amd64_load_var(R15, var);
+        amd64_emit1("pushq", amd64_arg_reg(R15));
+    }
 }
 
 static inline void amd64_push_i(int64_t imm)
 {
-    char buffer[64];
-    sprintf(buffer, "pushq $%ld\n", imm);
-    asm_add(strdup(buffer));
+    amd64_emit1("pushq", amd64_arg_imm(imm));
 }
 
 static inline void amd64_push_v(ir_value* value)
@@ -534,45 +690,36 @@ static inline void amd64_push_v(ir_value* value)
 
 static inline void amd64_pop_r(int reg)
 {
-    char buffer[64];
-    sprintf(buffer, "popq %%%s\n", amd64_reg_name(reg));
-    asm_add(strdup(buffer));
+    amd64_emit1("popq", amd64_arg_reg(reg));
 }
 
 static inline void amd64_pop_m(ir_var* var)
 {
-    char buffer[64];
-    if(is_global(var)) sprintf(buffer, "popq %s(%%rip)\n", var->name);
-    else sprintf(buffer, "popq %ld(%%rsp)\n", get_offset(var));
-    asm_add(strdup(buffer));
+    amd64_emit1("popq", amd64_arg_var(var));
 }
 
 static inline void amd64_call(char* label)
 {
-    char buffer[64];
-    sprintf(buffer, "call %s\n", label);
-    asm_add(strdup(buffer));
+    amd64_emit1("call", amd64_arg_sym(label));
 }
 
 static inline void amd64_ret(void)
 {
-    asm_add("ret\n");
+    amd64_emit0("ret");
 }
 
 static inline void amd64_global_var(ir_var* var, int64_t value)
 {
-    char buffer[64];
-    sprintf(buffer, "%s: .%s %ld\n", var->name, amd64_type_to_str(var->type), value);
+    char buffer[128];
+    sprintf(buffer, ".balign %d\n%s: .%s %ld\n", ir_type_size(var->type), var->name, amd64_type_to_str(var->type), ir_canonical(var->type, value));
     asm_add(strdup(buffer));
 }
 
 // emit code for the exit linux syscall with the given return value
 static inline void _amd64_exit(int64_t status_code)
 {
-    char buffer[64];
-    asm_add("movq $60, %rax\n");
-    sprintf(buffer, "movq %ld, %%rdi\n", status_code);
-    asm_add(strdup(buffer));
+    amd64_mov_ri(RAX, 60);
+    amd64_mov_ri(RDI, status_code);
 }
 
-#endif
\ No newline at end of file
+#endif
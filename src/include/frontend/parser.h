@@ -202,5 +202,6 @@ extern ast_stmt* root; // AST root, a block statement with global scope
 
 void parse(void);
 ast_ctxt* var_def_ctxt(char* var_name, ast_ctxt* current_context);
+type_info* type_get(base_type base, uint64_t ptr_layers);
 
 #endif
\ No newline at end of file
@@ -21,7 +21,7 @@ static hashmap_##T_key##_##T_value* hashmap_##T_key##_##T_value##_new(void) \
 static void hashmap_##T_key##_##T_value##_add(hashmap_##T_key##_##T_value* h, T_key* key, T_value* value) \
 { \
     int hash = HASH(key); \
-    while(h->keys[hash]) hash = HASH(key); \
+    while(h->keys[hash]) hash = (hash + 1) % SIZE; \
     h->keys[hash] = key; \
     h->values[hash] = value; \
 } \
@@ -29,14 +29,14 @@ static void hashmap_##T_key##_##T_value##_add(hashmap_##T_key##_##T_value* h, T_
 static T_value* hashmap_##T_key##_##T_value##_get(hashmap_##T_key##_##T_value* h, T_key* key) \
 { \
     int hash = HASH(key); \
-    while(h->keys[hash] != key) hash = HASH(key); \
+    while(h->keys[hash] != key) hash = (hash + 1) % SIZE; \
     return h->values[hash]; \
 } \
 \
 static int hashmap_##T_key##_##T_value##_has_key(hashmap_##T_key##_##T_value* h, T_key* key) \
 { \
     int hash = HASH(key); \
-    while(h->keys[hash] && h->keys[hash] != key) hash = HASH(key); \
+    while(h->keys[hash] && h->keys[hash] != key) hash = (hash + 1) % SIZE; \
     if(h->keys[hash]) return 1; \
     return 0; \
 }
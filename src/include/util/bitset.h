@@ -0,0 +1,32 @@
+#ifndef _IMPERIVM_UTIL_BITSET_H
+#define _IMPERIVM_UTIL_BITSET_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// fixed-size bitsets for dataflow analysis
+// the size in words is kept by the caller, since all sets in one analysis have the same size
+
+#define bitset_words(n_bits) (((n_bits) + 63) / 64)
+
+static inline uint64_t* bitset_new(int n_words) { return calloc(n_words ? n_words : 1, sizeof(uint64_t)); }
+static inline void bitset_set(uint64_t* s, int bit) { s[bit / 64] |= (uint64_t) 1 << (bit % 64); }
+static inline void bitset_unset(uint64_t* s, int bit) { s[bit / 64] &= ~((uint64_t) 1 << (bit % 64)); }
+static inline int bitset_test(uint64_t* s, int bit) { return (s[bit / 64] >> (bit % 64)) & 1; }
+static inline void bitset_clear(uint64_t* s, int n_words) { memset(s, 0, n_words * sizeof(uint64_t)); }
+static inline void bitset_copy(uint64_t* dst, uint64_t* src, int n_words) { memcpy(dst, src, n_words * sizeof(uint64_t)); }
+
+// dst |= src, returns 1 if dst changed
+static inline int bitset_union(uint64_t* dst, uint64_t* src, int n_words)
+{
+    int changed = 0;
+    for(int i = 0; i < n_words; i++) {
+        uint64_t old = dst[i];
+        dst[i] |= src[i];
+        changed |= old != dst[i];
+    }
+    return changed;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _IMPERIVM_TIMING_H
+#define _IMPERIVM_TIMING_H
+
+#include <stdint.h>
+
+/*  Compile time instrumentation for --time-passes
+
+    Phases nest, and a phase entered again under the same parent adds up with its earlier runs,
+    so a pass run three times or a backend step run for every block shows up once.
+    Each one records wall and CPU time, the allocations made through malloc, calloc and realloc,
+    which are wrapped at link time, and the peak RSS once it's done.
+*/
+
+extern int time_passes; // print a table to stderr
+extern char* time_passes_json; // or write JSON to this file
+
+void timing_init(void);
+void timing_begin(char* name);
+void timing_end(void);
+
+// calls fn() as a phase named after it
+#define timed(fn) do { timing_begin(#fn); fn(); timing_end(); } while(0)
+
+#endif
@@ -10,11 +10,15 @@
 #include <IR/IR.h>
 #include <IR/IR_print.h>
 #include <backend/amd64/amd64.h>
+#include <util/timing.h>
 
 char* ir_out = 0;
+char* ir_bin_out = 0;
 FILE* outfile = 0;
 int verbose_asm = 0;
 int print_blocks = 0;
+int print_stats = 0;
+char* stats_json = 0;
 
 void __attribute__((noreturn)) no_mem(const char* fn, char* file, int line)
 {
@@ -25,9 +29,9 @@ void __attribute__((noreturn)) no_mem(const char* fn, char* file, int line)
 void __attribute__((noreturn)) ir_exit(void)
 {
     printf("IR: %ld\n", ir->n_values);
-    char* mem = calloc(1, 65536);
-    for(int i = 0; i < ir->n_values; i++) ir_print_instr((ir_insn*) ir->values[i], mem + 128 * i);
-    for(int i = 0; i < ir->n_values; i++) printf("%s", mem + 128 * i);
+    char* mem = calloc(ir->n_values, 256);
+    for(int i = 0; i < ir->n_values; i++) ir_print_instr((ir_insn*) ir->values[i], mem + 256 * i);
+    for(int i = 0; i < ir->n_values; i++) printf("%s", mem + 256 * i);
     putchar('\n');
     exit(1);
 }
@@ -63,6 +67,14 @@ void __attribute__((noreturn)) help(void)
     printf("    %-36s%s\n", "--verbose-asm  (-v)", "Output the IR alongside the resulting assembly (implies --asm-only)");
     printf("    %-36s%s\n", "--print-blocks (-p)", "Show basic block boundaries (assumes --verbose-asm)");
     printf("    %-36s%s\n", "--asm-only     (-a)", "Only output assembly");
+    printf("    %-36s%s\n", "--stats", "Print optimization statistics to stderr");
+    printf("    %-36s%s\n", "--stats-json [file]", "Write per-function code statistics as JSON into the specified file");
+    printf("    %-36s%s\n", "--inline-threshold [n]", "Inline calls to functions costing up to n instructions (0 disables)");
+    printf("    %-36s%s\n", "--select-limit [n]", "Turn ifs whose arms have up to n instructions into conditional moves (0 disables)");
+    printf("    %-36s%s\n", "--time-passes", "Print the time and memory spent in each phase and pass to stderr");
+    printf("    %-36s%s\n", "--time-passes-json [file]", "Write the same as JSON into the specified file");
+    printf("    %-36s%s\n", "--ir-bin [file]", "Write the IR in binary into the specified file");
+    printf("    %-36s%s\n", "--from-ir", "Read the file as IR the way --ir or --ir-bin write it, skipping the frontend");
     printf("    %-36s%s\n", "--static       (-s)", "Force static linking");
     printf("    %-36s%s\n", "--help         (-h)", "Print help information and exit");
     printf("    %-36s%s\n", "--version      (-n)", "Print version information and exit");
@@ -84,6 +96,7 @@ int main(int argc, char* argv[])
     char* output = 0;
     static int asm_only = 0;
     static int static_linking = 0;
+    static int from_ir = 0;
 
     if(argc < 2) goto no_args;
 
@@ -99,6 +112,14 @@ int main(int argc, char* argv[])
             {"static", no_argument, &static_linking, 1},
             {"help", no_argument, 0, 'h'},
             {"version", no_argument, 0, 'n'},
+            {"stats", no_argument, &print_stats, 1},
+            {"inline-threshold", required_argument, 0, 0},
+            {"select-limit", required_argument, 0, 0},
+            {"time-passes", no_argument, &time_passes, 1},
+            {"time-passes-json", required_argument, 0, 0},
+            {"stats-json", required_argument, 0, 0},
+            {"from-ir", no_argument, &from_ir, 1},
+            {"ir-bin", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -112,6 +133,11 @@ int main(int argc, char* argv[])
             if(optindex == 1) output = strdup(optarg);
             if(optindex == 6) help();
             if(optindex == 7) version();
+            if(optindex == 9) inline_threshold = atoi(optarg);
+            if(optindex == 10) select_limit = atoi(optarg);
+            if(optindex == 12) time_passes_json = strdup(optarg);
+            if(optindex == 13) stats_json = strdup(optarg);
+            if(optindex == 15) ir_bin_out = strdup(optarg);
             break;
 
             case 'v':
@@ -160,18 +186,33 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    FILE* file = fopen(argv[argc-1], "rb");
-    if(!file) goto bad_file;
-    
-    fseek(file, 0, SEEK_END);
-    uint64_t fsize = ftell(file);
-    rewind(file);
-    
-    char* src = malloc(fsize+1);
-    src[fsize] = 0;
-    uint64_t read = fread(src, 1, fsize, file);
-    if(read != fsize) goto bad_read;
-    fclose(file);
+    timing_init();
+    amd64_stats_enabled = print_stats || stats_json;
+
+    // binary IR is mapped rather than read, see IR_binary.c
+    int binary_ir = 0;
+    if(from_ir) {
+        timing_begin("ir_load");
+        binary_ir = ir_load(argv[argc-1]);
+        timing_end();
+    }
+
+    uint64_t fsize = 0, read = 0;
+    char* src = 0;
+    if(!binary_ir) {
+        FILE* file = fopen(argv[argc-1], "rb");
+        if(!file) goto bad_file;
+
+        fseek(file, 0, SEEK_END);
+        fsize = ftell(file);
+        rewind(file);
+
+        src = malloc(fsize+1);
+        src[fsize] = 0;
+        read = fread(src, 1, fsize, file);
+        if(read != fsize) goto bad_read;
+        fclose(file);
+    }
 
     // overwrite the previous contents, if any
     if(ir_out) {
@@ -179,28 +220,80 @@ int main(int argc, char* argv[])
         fclose(ir);
     } 
 
-    run(src);
+    if(binary_ir) timed(ir_optimize);
+    else if(from_ir) {
+        timing_begin("ir_read");
+        ir_read(src);
+        timing_end();
+        timed(ir_optimize);
+    }
+    else {
+        timing_begin("run");
+        run(src);
+        timing_end();
+        timed(parse);
+        timed(ir_init);
+    }
     free(src);
-    parse();
-    ir_init();
+
+    // the functions go first, so that the IR can be read back with --from-ir
+    if(ir_out) {
+        FILE* f = fopen(ir_out, "a");
+        ir_print_decls(f);
+        fclose(f);
+    }
+    if(ir_bin_out) {
+        timing_begin("ir_save");
+        int saved = ir_save(ir_bin_out);
+        timing_end();
+        if(!saved) {
+            printf("imc: couldn't open %s\n", ir_bin_out);
+            return 1;
+        }
+    }
 
     outfile = stdout;
     if(output) outfile = fopen(output, "wb");
 
+    timing_begin("backend");
     amd64_init();
 
     int start, end;
     while(ir_get_block(&start, &end)) {
         if(print_blocks) fprintf(outfile, "\n<bb>\n");
+        timing_begin("ir_get_interference_graph");
         var_graph* g = ir_get_interference_graph(ir_get_vars(start, end), start, end);
+        timing_end();
+        timing_begin("amd64_color_registers");
         amd64_color_registers(g, start, end);
+        timing_end();
+        timing_begin("amd64_translate");
         amd64_translate(g, start, end);
+        timing_end();
         free(g);
     }
 
+    timed(amd64_peephole);
+    timing_end();
+    if(print_stats) {
+        amd64_peephole_stats(stderr);
+        amd64_frame_stats(stderr);
+        amd64_stats(stderr);
+    }
+    if(stats_json) {
+        FILE* f = fopen(stats_json, "w");
+        if(!f) {
+            printf("imc: couldn't open %s\n", stats_json);
+            return 1;
+        }
+        amd64_stats_json(f);
+        fclose(f);
+    }
+
     if(asm_only && !verbose_asm) {
-        for(int i = 0; i < amd64_asm->n_values; i++) 
-            fprintf(outfile, "%s", amd64_asm->values[i]);
+        timing_begin("amd64_print");
+        amd64_print(outfile);
+        timing_end();
 
         return 0;
     }
@@ -217,8 +310,9 @@ int main(int argc, char* argv[])
     strcat(temp_name, ".s");
 
     FILE* asm_temp = fopen(temp_name, "wb");
-    for(int i = 0; i < amd64_asm->n_values; i++)
-        fprintf(asm_temp, "%s", amd64_asm->values[i]);
+    timing_begin("amd64_print");
+    amd64_print(asm_temp);
+    timing_end();
     fclose(asm_temp);
 
     int len = 0; // output file name length; either 0 or strlen(output) if output is specified
@@ -232,7 +326,10 @@ int main(int argc, char* argv[])
             len ? output : "",
             static_linking ? " -static" : "");
 
+    // gcc runs in a child, so only its wall time counts here
+    timing_begin("gcc");
     system(system_buf);
+    timing_end();
     return 0;
 
     no_args:
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// the IR files of --ir and --ir-bin, the test() target in meson.build
+// every example in the examples directory is compiled from source, and from the IR it was dumped as,
+// in text and in binary, once as it is and once without inlining so --from-ir has calls left to inline,
+// and all of them have to exit the same way
+// then the binary IR of each one is corrupted, a few bytes at a time, and imc has to either compile it
+// or reject it with exit status 1, never crash or hang on it
+
+#define MUTATIONS 200 // per example
+#define TIMEOUT "10"
+
+static char* imc;
+static char dir[] = "/tmp/imc_ir.XXXXXX";
+static int failed;
+
+// the exit status of the command, or -signal if it was killed, 124 if timeout gave up on it
+static int run(char* cmd)
+{
+    int status = system(cmd);
+    if(status == -1) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status);
+}
+
+static int run_binary(char* binary)
+{
+    char cmd[2048];
+    snprintf(cmd, sizeof(cmd), "timeout " TIMEOUT " %s > /dev/null", binary);
+    return run(cmd);
+}
+
+static void fail(char* example, char* what)
+{
+    printf("FAIL %s: %s\n", example, what);
+    failed = 1;
+}
+
+// the status of the example compiled from source, compared to what comes out of its IR
+static void round_trip(char* name, char* src, char* options)
+{
+    char cmd[4096], binary[1024], text[1024], bin[1024];
+    snprintf(binary, sizeof(binary), "%s/%s", dir, name);
+    snprintf(text, sizeof(text), "%s/%s.ir", dir, name);
+    snprintf(bin, sizeof(bin), "%s/%s.bir", dir, name);
+
+    snprintf(cmd, sizeof(cmd), "%s %s --ir %s --ir-bin %s %s -o %s > /dev/null 2>&1", imc, options, text, bin, src, binary);
+    if(run(cmd)) {
+        fail(name, "imc failed on the source");
+        return;
+    }
+    int expected = run_binary(binary);
+
+    char* files[] = { text, bin };
+    for(int i = 0; i < 2; i++) {
+        snprintf(cmd, sizeof(cmd), "timeout " TIMEOUT " %s --from-ir %s -o %s > /dev/null 2>&1", imc, files[i], binary);
+        if(run(cmd)) fail(name, i ? "--from-ir failed on the binary IR" : "--from-ir failed on the IR");
+        else if(run_binary(binary) != expected) fail(name, i ? "the binary IR exits differently" : "the IR exits differently");
+    }
+}
+
+static int read_file(char* file, uint8_t** data, long* size)
+{
+    FILE* f = fopen(file, "rb");
+    if(!f) return 0;
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *data = malloc(*size);
+    int ok = fread(*data, 1, *size, f) == *size;
+    fclose(f);
+    return ok;
+}
+
+// overwrites a few random bytes past the magic and version, where the sections and the records are
+static void corrupt(char* name)
+{
+    char bin[1024], mutated[1024], cmd[4096];
+    snprintf(bin, sizeof(bin), "%s/%s.bir", dir, name);
+    snprintf(mutated, sizeof(mutated), "%s/%s.bad.bir", dir, name);
+    uint8_t* data;
+    long size;
+    if(!read_file(bin, &data, &size) || size <= 8) {
+        fail(name, "no binary IR to corrupt");
+        return;
+    }
+
+    uint8_t* copy = malloc(size);
+    for(int m = 0; m < MUTATIONS; m++) {
+        memcpy(copy, data, size);
+        int n = 1 + rand() % 4;
+        for(int i = 0; i < n; i++) copy[8 + rand() % (size - 8)] = rand() % 4 ? rand() : 0xff;
+
+        FILE* f = fopen(mutated, "wb");
+        fwrite(copy, 1, size, f);
+        fclose(f);
+        snprintf(cmd, sizeof(cmd), "timeout " TIMEOUT " %s --from-ir --asm-only %s -o %s/bad.s > /dev/null 2>&1", imc, mutated, dir);
+        int status = run(cmd);
+        if(status == 0 || status == 1) continue;
+
+        char message[1200];
+        snprintf(message, sizeof(message), "corrupt binary IR gave status %d, kept in %s", status, mutated);
+        fail(name, message);
+        break; // the file is left for a look
+    }
+    free(copy);
+    free(data);
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 3) {
+        printf("Usage: ir_files [imc] [examples directory]\n");
+        return 1;
+    }
+    imc = argv[1];
+    if(!mkdtemp(dir)) {
+        printf("ir_files: couldn't create %s\n", dir);
+        return 1;
+    }
+    DIR* d = opendir(argv[2]);
+    if(!d) {
+        printf("ir_files: no examples in %s\n", argv[2]);
+        return 1;
+    }
+    srand(1);
+
+    struct dirent* e;
+    int n = 0;
+    while((e = readdir(d))) {
+        int len = strlen(e->d_name);
+        if(len < 4 || strcmp(e->d_name + len - 3, ".im")) continue;
+        char name[256], src[1024];
+        snprintf(name, sizeof(name), "%.*s", len - 3, e->d_name);
+        snprintf(src, sizeof(src), "%s/%s", argv[2], e->d_name);
+        round_trip(name, src, "--inline-threshold 0");
+        round_trip(name, src, "");
+        corrupt(name);
+        n++;
+    }
+    closedir(d);
+    printf("%d examples\n", n);
+
+    if(!failed) {
+        char cmd[256];
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+        system(cmd);
+    }
+    return failed;
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <util/timing.h>
+
+#define MAX_PHASES 128
+#define MAX_DEPTH 16
+
+typedef struct {
+    char* name;
+    int parent; // index of the enclosing phase, -1 for the root
+    int depth;
+    int runs;
+    double wall, cpu; // in seconds
+    uint64_t allocs, bytes;
+    long peak_rss; // in KiB
+} timing_phase;
+
+typedef struct {
+    int phase;
+    double wall, cpu;
+    uint64_t allocs, bytes;
+} timing_frame;
+
+int time_passes = 0;
+char* time_passes_json = 0;
+
+static timing_phase phases[MAX_PHASES];
+static int n_phases = 0;
+static timing_frame stack[MAX_DEPTH];
+static int depth = 0;
+static int enabled = 0;
+
+// every allocation the compiler makes goes through these, see the link arguments in meson.build
+// they only count, the memory comes from the real allocator
+static uint64_t n_allocs = 0, n_bytes = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    n_allocs++;
+    n_bytes += size;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+    n_allocs++;
+    n_bytes += n * size;
+    return __real_calloc(n, size);
+}
+
+// a realloc counts with its whole new size, like a malloc and a copy would
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    n_allocs++;
+    n_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+static double timing_clock(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long timing_peak_rss(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+void timing_begin(char* name)
+{
+    if(!enabled) return;
+    if(depth == MAX_DEPTH) {
+        printf("imc: --time-passes: phases nested too deep\n");
+        exit(1);
+    }
+
+    int parent = depth ? stack[depth - 1].phase : -1;
+    int phase = 0;
+    while(phase < n_phases && (phases[phase].parent != parent || strcmp(phases[phase].name, name))) phase++;
+    if(phase == n_phases) {
+        if(n_phases == MAX_PHASES) {
+            printf("imc: --time-passes: too many phases\n");
+            exit(1);
+        }
+        phases[n_phases++] = (timing_phase) { .name = name, .parent = parent, .depth = depth };
+    }
+
+    stack[depth++] = (timing_frame) {
+        .phase = phase,
+        .wall = timing_clock(CLOCK_MONOTONIC),
+        .cpu = timing_clock(CLOCK_PROCESS_CPUTIME_ID),
+        .allocs = n_allocs,
+        .bytes = n_bytes
+    };
+}
+
+void timing_end(void)
+{
+    if(!enabled || !depth) return;
+    timing_frame* f = &stack[--depth];
+    timing_phase* p = &phases[f->phase];
+    p->runs++;
+    p->wall += timing_clock(CLOCK_MONOTONIC) - f->wall;
+    p->cpu += timing_clock(CLOCK_PROCESS_CPUTIME_ID) - f->cpu;
+    p->allocs += n_allocs - f->allocs;
+    p->bytes += n_bytes - f->bytes;
+    p->peak_rss = timing_peak_rss();
+}
+
+static void timing_print(FILE* f)
+{
+    fprintf(f, "time passes: %-33s%10s%10s%6s%12s%14s%12s\n", "", "wall ms", "cpu ms", "runs", "allocs", "bytes", "peak KiB");
+    for(int i = 0; i < n_phases; i++) {
+        timing_phase* p = &phases[i];
+        fprintf(f, "    %*s%-*s%10.3f%10.3f%6d%12lu%14lu%12ld\n", 2 * p->depth, "", 42 - 2 * p->depth, p->name,
+                p->wall * 1e3, p->cpu * 1e3, p->runs, p->allocs, p->bytes, p->peak_rss);
+    }
+}
+
+// the names leading to the phase, like imc/ir_init/ir_optimize_values
+static void timing_path(FILE* f, int phase)
+{
+    if(phases[phase].parent != -1) {
+        timing_path(f, phases[phase].parent);
+        fputc('/', f);
+    }
+    fputs(phases[phase].name, f);
+}
+
+static void timing_print_json(FILE* f)
+{
+    fprintf(f, "{\n    \"peak_rss_kib\": %ld,\n    \"phases\": [\n", timing_peak_rss());
+    for(int i = 0; i < n_phases; i++) {
+        timing_phase* p = &phases[i];
+        fprintf(f, "        { \"path\": \"");
+        timing_path(f, i);
+        fprintf(f, "\", \"depth\": %d, \"runs\": %d, \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"allocs\": %lu, \"bytes\": %lu, \"peak_rss_kib\": %ld }%s\n",
+                p->depth, p->runs, p->wall * 1e3, p->cpu * 1e3, p->allocs, p->bytes, p->peak_rss, i + 1 < n_phases ? "," : "");
+    }
+    fprintf(f, "    ]\n}\n");
+}
+
+// the compiler leaves through exit and returns from all over main, so the report is printed at exit
+// along with closing whatever phases are still open, the root one included
+static void timing_report(void)
+{
+    while(depth) timing_end();
+    if(time_passes) timing_print(stderr);
+    if(!time_passes_json) return;
+
+    FILE* f = fopen(time_passes_json, "w");
+    if(!f) {
+        printf("imc: couldn't open %s\n", time_passes_json);
+        return;
+    }
+    timing_print_json(f);
+    fclose(f);
+}
+
+void timing_init(void)
+{
+    if(!time_passes && !time_passes_json) return;
+    enabled = 1;
+    atexit(timing_report);
+    timing_begin("imc");
+}